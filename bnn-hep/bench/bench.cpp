@@ -0,0 +1,138 @@
+/**
+ * \author Andrey Popov
+ * 
+ * The program times the preprocessing of the input variables and, optionally, the evaluation of a
+ * BNN with the code generated by CodeMaker. The results are appended to a file in CSV format so
+ * that changes in performance can be tracked.
+ * 
+ * The generated code is included if the macros BNN_CODE (the name of the header file in quotes)
+ * and BNN_NAMESPACE (the task name) are defined at compilation. It is done by the Makefile when
+ * variable BNN_CODE is set, e.g. "make bench BNN_CODE=myTask.hpp".
+ */
+
+#include "Logger.hpp"
+#include "TransformGauss.hpp"
+
+#include <TRandom3.h>
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef BNN_CODE
+#define USE_INTERNAL_BINARY_DISCRIMINATOR_ABSTRACT_BASE
+#include BNN_CODE
+#endif
+
+
+using namespace std;
+using namespace logger;
+
+
+/// Measures the wall time of the given callable and writes a line with the result
+template<typename F>
+void Time(ostream &out, string const &name, unsigned dim, unsigned long nEvents,
+ unsigned long nCalls, F const &func)
+{
+    auto const start = chrono::steady_clock::now();
+    func();
+    auto const end = chrono::steady_clock::now();
+    
+    double const seconds = chrono::duration<double>(end - start).count();
+    out << name << "," << dim << "," << nEvents << "," << nCalls << "," << seconds << "," <<
+     1e6 * seconds / nCalls << endl;
+}
+
+
+/// Generates events with the variables distributed exponentially (a typical shape of kinematic
+///variables in HEP) and weights drawn uniformly
+void GenerateEvents(TRandom3 &rGen, unsigned dim, unsigned long nEvents, vector<Double_t> &vars,
+ vector<Double_t> &weights)
+{
+    vars.resize(dim * nEvents);
+    weights.resize(nEvents);
+    
+    for (auto &v: vars)
+        v = rGen.Exp(1.);
+    
+    for (auto &w: weights)
+        w = rGen.Uniform(0.5, 1.5);
+}
+
+
+int main(int argc, char **argv)
+{
+    if (argc > 2)
+    {
+        cerr << "Usage: bnn-hep-bench [resultsFile.csv]\n";
+        return 1;
+    }
+    
+    
+    // Open the output, the header is written if the file is new
+    ofstream outFile;
+    
+    if (argc == 2)
+        outFile.open(argv[1], ios_base::app);
+    
+    ostream &out = (argc == 2) ? outFile : cout;
+    
+    if (argc == 1 or outFile.tellp() == 0)
+        out << "benchmark,dim,events,calls,seconds,us_per_call\n";
+    
+    
+    // The logger is silent
+    Logger log(0);
+    TRandom3 rGen(1);
+    unsigned long const nEvents = 100000;
+    vector<Double_t> vars, weights;
+    
+    
+    // Time building and applying the gaussianisation
+    for (unsigned const dim: {10, 30, 50})
+    {
+        GenerateEvents(rGen, dim, nEvents, vars, weights);
+        TransformGauss transform(log, dim);
+        
+        Time(out, "TransformGauss::Build", dim, nEvents, nEvents, [&]()
+        {
+            for (unsigned long i = 0; i < nEvents; ++i)
+                transform.AddEvent(weights[i], &vars[i * dim]);
+            
+            transform.BuildTransformation();
+        });
+        
+        Time(out, "TransformGauss::Apply", dim, nEvents, nEvents, [&]()
+        {
+            for (unsigned long i = 0; i < nEvents; ++i)
+                transform.ApplyTransformation(&vars[i * dim]);
+        });
+    }
+    
+    
+#ifdef BNN_CODE
+    // Time the evaluation of the BNN with the generated code. It includes the transformations of
+    //the input variables and averaging over the ensemble
+    BNN_NAMESPACE::Initialize();
+    unsigned const dim = BNN_NAMESPACE::inputVarNames.size();
+    BNN_NAMESPACE::BNN bnn;
+    
+    GenerateEvents(rGen, dim, nEvents, vars, weights);
+    Double_t sum = 0.;
+    
+    Time(out, "BNN::operator()", dim, nEvents, nEvents, [&]()
+    {
+        for (unsigned long i = 0; i < nEvents; ++i)
+            sum += bnn(&vars[i * dim]);
+    });
+    
+    // Make sure the computation is not optimised away
+    if (sum != sum)
+        cerr << "The BNN response is NaN.\n";
+#endif
+    
+    
+    return 0;
+}
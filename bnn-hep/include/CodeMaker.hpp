@@ -11,6 +11,7 @@
 #include "Config.hpp"
 #include "InputProcessor.hpp"
 #include "FBMWrapper.hpp"
+#include "NeuralNetwork.hpp"
 
 #include <fstream>
 #include <vector>
@@ -43,8 +44,22 @@ class CodeMaker
         CodeMaker const & operator=(CodeMaker const &) = delete;
     
     private:
+        /**
+         * \brief Selects a subset of the ensemble that reproduces its averaged output.
+         * 
+         * The outputs are compared on the events held out from the training set. Subsets obtained
+         * by taking every k-th network, which reduces the correlation between neighbouring
+         * iterations, are tried first; it gives an upper bound on the size of the subset. Then
+         * networks are added greedily one by one, each time picking the one that brings the
+         * average closest to the full ensemble. The smaller subset within the tolerance wins.
+         */
+        void ThinEnsemble();
+        
         /// Writes a class to incorporate the BNN
         void WriteBNNClass();
+        
+        /// Writes a class to apply the student network distilled from the ensemble
+        void WriteStudentClass();
     
     private:
         Logger &log;  ///< Logger instance
@@ -53,4 +68,9 @@ class CodeMaker
         FBMWrapper const &fbm;  ///< Instance of FBM wrapper
         std::ofstream file;  ///< File that will store the source code
         std::vector<NeuralNetwork> nets;  ///< Ensamble of the neural networks
+        unsigned nNetsTotal;  ///< Number of networks in the ensemble before the thinning
+        bool isDistilled;  ///< Indicates whether the ensemble is distilled into a student network
+        NeuralNetwork student;  ///< Network distilled from the ensemble
+        double studentDeviation;  ///< RMS deviation of the student from the ensemble
+        std::vector<unsigned> transformClasses;  ///< Indices of the written transformation classes
 };
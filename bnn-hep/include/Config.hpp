@@ -53,6 +53,21 @@ class Config
             string trainEventsFileName;
         };
         
+        /// Structure to keep the parameters of the distillation of the ensemble into one network
+        struct Distillation
+        {
+            /// Number of passes over the events (zero if the distillation is disabled)
+            unsigned epochs;
+            /// Number of neurons in the hidden layer of the student network
+            unsigned numberNeurons;
+            /// Maximum number of events to fit the student network to
+            unsigned long maxEvents;
+            /// Number of events in a mini-batch
+            unsigned batchSize;
+            /// Stepsize of the Adam optimisation
+            double stepsize;
+        };
+        
         /// Supported variats to preprocess the inputs
         enum class InputTransformation
         {
@@ -61,6 +76,13 @@ class Config
             PCA        ///< Principal component analysis
         };
         
+        /// Supported MCMC samplers
+        enum class Sampler
+        {
+            HMC,   ///< Hybrid Monte Carlo with the trajectories given in "mcmc-parameters"
+            NUTS   ///< No-U-Turn sampler with the stepsize adapted during the burn-in
+        };
+        
         /// Supported variats for the reweighting
         enum class Reweighting
         {
@@ -78,8 +100,13 @@ class Config
          * Constructor. Takes the name of the configuration file and a reference to logger object.
          * The latter is not constant as the logger's verbosity level is adjusted according to the
          * configuration. All the parsing and interpretation is performed in constructor.
+         * 
+         * If the file defines scan axes (a list "scan" of groups with a path "parameter" and an
+         * array or list "values"), the settings of the given point of the scan replace those in
+         * the file and the index of the point is appended to the task name. The points enumerate
+         * all the combinations of the values, with the last axis changing fastest.
          */
-        Config(string const &fileName, Logger &log_);
+        Config(string const &fileName, Logger &log_, unsigned scanPoint = 0);
         
         /// Destructor
         ~Config() = default;
@@ -90,7 +117,24 @@ class Config
         /// Assignment operator (not allowed to be used)
         Config const & operator=(Config const &) = delete;
     
+    public:
+        /**
+         * \brief Returns the number of points in the scan defined in the configuration file.
+         * 
+         * Returns one if there is no scan. The file is not checked: if it cannot be read or the
+         * scan is malformed, one is returned as well and the problem is reported when the
+         * configuration is read with the constructor.
+         */
+        static unsigned CountScanPoints(string const &fileName);
+    
     private:
+        /**
+         * \brief Replaces the settings scanned over with their values at the given point.
+         * 
+         * Returns a description of the values set, or an empty string if there is no scan.
+         */
+        string ApplyScanPoint(unsigned point);
+        
         /**
          * \brief Finds the setting given its path.
          * 
@@ -267,12 +311,21 @@ class Config
         /// Returns the vector of transformations of input variables
         vector<InputTransformation> const & GetTransformations() const;
         
+        /// Returns the factor to reduce the training set by with a coreset (one if disabled)
+        double GetCoresetFactor() const;
+        
+        /// Returns the largest relative change in the log-likelihood allowed for the coreset
+        double GetCoresetTolerance() const;
+        
         /// Returns the path to FBM routines
         string const & GetFBMPath() const;
         
         /// Checks whether the temporary .net and .root files should be kept
         bool GetKeepTempFiles() const;
         
+        /// Returns the directory to cache the preprocessed training sets (empty if disabled)
+        string const & GetCacheDir() const;
+        
         /// Returns the path to network's binary file name
         string const & GetBNNFileName() const;
         
@@ -291,6 +344,33 @@ class Config
         /// Returns MCMC parameters for BNN sampling: for the first and for the rest iterations.
         std::pair<string const &, string const &> GetBNNMCMCParameters() const;
         
+        /// Returns the MCMC sampler used for all the iterations but the first one
+        Sampler GetBNNSampler() const;
+        
+        /// Returns the parameters of net-opt to optimise the initial network (empty if disabled)
+        string const & GetBNNWarmStartParameters() const;
+        
+        /// Returns the schedule of inverse temperatures for parallel tempering (empty if disabled)
+        string const & GetBNNTemperingSchedule() const;
+        
+        /// Returns the number of iterations between proposals of swaps in parallel tempering
+        unsigned GetBNNTemperingSwapInterval() const;
+        
+        /// Returns the command to run net-mc as several MPI processes (empty if disabled)
+        string const & GetMPICommand() const;
+        
+        /// Checks if the threads of FBM programs should be bound to cores
+        bool GetPinThreads() const;
+        
+        /// Returns the tolerance for the thinning of the ensemble (zero if it is disabled)
+        double GetBNNThinningTolerance() const;
+        
+        /// Returns the number of events held out from the training set to thin the ensemble
+        unsigned GetBNNThinningEvents() const;
+        
+        /// Returns the parameters of the distillation of the ensemble into one network
+        Distillation const & GetDistillation() const;
+        
         /// Returns the total number of iterations used for BNN sampling (uncluding the burn-in)
         unsigned GetBNNMCMCIterations() const;
         
@@ -306,6 +386,7 @@ class Config
         string taskName;  ///< Name of the task (used to construct some file names, etc.)
         string FBMPath;  ///< Path to FBM executables
         bool keepTempFiles;  ///< Indicates whether the temporary files should be kept
+        string cacheDir;  ///< Directory with cached training sets (empty if caching is disabled)
         vector<string> variables;  ///< The input variables to be read from files
         vector<Sample> samples;  ///< The input samples
         string networkName;  ///< Name of the binary file to store the BNN
@@ -316,8 +397,19 @@ class Config
         string networkGenerationParameters;  ///< Parameters used to generate the initial NNs
         string MCMCParametersFirstIt;  ///< MCMC parameters for the first iteration
         string MCMCParameters;  ///< MCMC parameters for all the rest iterations
+        Sampler sampler;  ///< MCMC sampler for all the rest iterations
+        string warmStartParameters;  ///< Parameters of net-opt (empty if no warm start)
+        string temperingSchedule;  ///< Arguments of mc-temp-sched (empty if no parallel tempering)
+        unsigned temperingSwapInterval;  ///< Number of iterations between proposals of swaps
+        string MPICommand;  ///< Command to launch MPI processes for net-mc (empty if disabled)
+        bool pinThreads;  ///< Indicates whether the threads of FBM programs are bound to cores
+        double thinningTolerance;  ///< Tolerance for the thinning (zero if disabled)
+        unsigned thinningEvents;  ///< Number of held-out events to thin the ensemble
+        Distillation distillation;  ///< Parameters of the distillation into one network
         unsigned numberIterations;  ///< Total number of MCMC iterations (burn-in included)
         unsigned burnInIterations;  ///< Number of MCMC iterations to skip (burn-in)
         string networkCPPFileName;  ///< Name of the output file to store C++ code of BNN
         vector<InputTransformation> inputTransformations;  ///< Transformation for input vars
+        double coresetFactor;  ///< Factor to reduce the training set by (one if disabled)
+        double coresetTolerance;  ///< Allowed relative change in the log-likelihood for the coreset
 };
@@ -0,0 +1,75 @@
+/**
+ * \author Andrey Popov
+ * 
+ * The module distills the ensemble of neural networks into a single network.
+ */
+
+#pragma once
+
+#include "Logger.hpp"
+#include "Config.hpp"
+#include "InputProcessor.hpp"
+#include "NeuralNetwork.hpp"
+
+#include <vector>
+
+
+/**
+ * \brief The class fits a single neural network to the averaged output of the ensemble.
+ * 
+ * The network (the student) has one hidden layer, which may be wider than the one of the networks
+ * in the ensemble. It is fitted with mini-batch Adam to minimise the weighted cross entropy with
+ * respect to the averaged output of the ensemble, which serves as a soft target. The events are
+ * taken from the training set and the events held out from it; a tenth of them is not used in the
+ * fit but only to measure how well the student reproduces the ensemble. The student starts from
+ * the last network of the ensemble, the additional neurons are initialised at random.
+ */
+class Distiller
+{
+    public:
+        /**
+         * \brief Constructor.
+         * 
+         * Constructor. All the actions are executed within its body.
+         */
+        Distiller(logger::Logger &log_, Config const &config_,
+         InputProcessor const &inputProcessor_, std::vector<NeuralNetwork> const &nets_);
+        
+        /// Copy constructor (not allowed to be used)
+        Distiller(Distiller const &) = delete;
+        
+        /// Assignment operator (not allowed to be used)
+        Distiller const & operator=(Distiller const &) = delete;
+    
+    private:
+        /// Chooses the events and evaluates the averaged output of the ensemble for them
+        void PrepareEvents();
+        
+        /// Fits the student network
+        void Train();
+        
+        /// Calculates the output of the student with the given parameters for the given event
+        double ApplyStudent(std::vector<double> const &params, double const *eventVars,
+         std::vector<double> &hidden) const;
+    
+    public:
+        /// Returns the student network
+        NeuralNetwork const & GetStudent() const;
+        
+        /// Returns the weighted RMS deviation of the student from the ensemble on the test events
+        double GetDeviation() const;
+    
+    private:
+        Logger &log;  ///< Logger instance
+        Config const &config;  ///< Config instance
+        InputProcessor const &inputProcessor;  ///< Input processor instance
+        std::vector<NeuralNetwork> const &nets;  ///< Ensemble of the neural networks
+        unsigned const dim;  ///< Number of input variables
+        unsigned const nNeurons;  ///< Number of neurons in the hidden layer of the student
+        std::vector<double> vars;  ///< Input variables of the events, one event after another
+        std::vector<double> weights;  ///< Weights of the events
+        std::vector<double> targets;  ///< Averaged outputs of the ensemble for the events
+        unsigned long nFitEvents;  ///< Number of events used in the fit (the rest are for tests)
+        NeuralNetwork student;  ///< The student network
+        double deviation;  ///< RMS deviation of the student from the ensemble on the test events
+};
@@ -18,9 +18,14 @@
 class FBMWrapper
 {
     public:
-        /// Constructor
+        /**
+         * \brief Constructor. Performs the training
+         * 
+         * The number of threads of each FBM program can be limited, which is needed when several
+         * trainings run at the same time. Zero means that the number is not limited.
+         */
         FBMWrapper(logger::Logger &log_, Config const &config_,
-         InputProcessor const &inputProcessor_);
+         InputProcessor const &inputProcessor_, unsigned nThreads_ = 0);
         
         /// Destructor
         ~FBMWrapper();
@@ -34,6 +39,8 @@ class FBMWrapper
     private:
         /// Runs FBM utilities to perform the training
         void TrainBNN() const;
+        /// Executes a shell command measuring the resources it takes. Exits in case of an error
+        void Execute(std::string const &command, std::string const &phaseName) const;
         /// Displays an error message and exits
         void ErrorWrongOutput(std::string const &command) const;
     
@@ -55,4 +62,5 @@ class FBMWrapper
         std::string const &FBMPath;  ///< Local reference to the path to FBM routines
         std::string const &BNNFileName;  ///< Local reference to the name of binary BNN file
         std::vector<unsigned> NNArchitecture;  ///< Number of nodes in each layer of the NN
+        unsigned nThreads;  ///< Number of threads of each FBM program (zero if not limited)
 };
@@ -10,6 +10,8 @@
 #include "Logger.hpp"
 #include "Config.hpp"
 #include "TransformBase.hpp"
+#include "TransformStandard.hpp"
+#include "TransformPCA.hpp"
 
 #include <Rtypes.h>
 #include <TTreeFormula.h>
@@ -41,12 +43,13 @@ class InputProcessor
             
             /// Default constructor
             Event():
-                type(-1), weight(-1.), vars(nullptr)
+                type(-1), weight(-1.), vars(nullptr), sample(0), entry(0)
             {}
             
             /// Constructor with parameters
-            Event(UInt_t type_, Double_t weight_, vector<Double_t> const &vars_):
-                type(type_), weight(weight_)
+            Event(UInt_t type_, Double_t weight_, vector<Double_t> const &vars_, UInt_t sample_,
+             ULong64_t entry_):
+                type(type_), weight(weight_), sample(sample_), entry(entry_)
             {
                 //nVars = vars_.size();
                 vars = new Double_t[nVars];
@@ -56,8 +59,9 @@ class InputProcessor
             }
             
             /// Constructor from TTreeFormula's
-            Event(UInt_t type_, Double_t weight_, vector<TTreeFormula *> const &vars_):
-                type(type_), weight(weight_)
+            Event(UInt_t type_, Double_t weight_, vector<TTreeFormula *> const &vars_,
+             UInt_t sample_, ULong64_t entry_):
+                type(type_), weight(weight_), sample(sample_), entry(entry_)
             {
                 //nVars = vars_.size();
                 vars = new Double_t[nVars];
@@ -78,6 +82,8 @@ class InputProcessor
             UInt_t type;      ///< Classification type (currently signal or background)
             Double_t weight;  ///< Weight of the event
             Double_t *vars;   ///< Input variables
+            UInt_t sample;    ///< Index of the source sample in the configuration
+            ULong64_t entry;  ///< Index of the event in the source tree
         };
     
     public:
@@ -85,9 +91,11 @@ class InputProcessor
          * \brief Constructor.
          * 
          * Constructor. It takes the Logger and Config objects as arguements. All the actions
-         * performed by the class are called from here.
+         * performed by the class are called from here. The number of threads used in the
+         * preprocessing can be limited, which is needed when the cores are shared with other
+         * trainings. Zero means that the number is not limited.
          */
-        InputProcessor(Logger &log_, Config const &config_);
+        InputProcessor(Logger &log_, Config const &config_, unsigned nThreads_ = 0);
         
         
         /// Destructor
@@ -103,13 +111,85 @@ class InputProcessor
         /// Chooses the events to be used for training. Writes their ID in a text file
         void BuildTrainingSet();
         
+        /// Creates the transformations requested in the configuration (they are not built)
+        void CreateTransformations();
+        
         /// Builds and applies the transformation to the input variables
         void TransformInputs();
         
+        /**
+         * \brief Replaces the training set with a smaller weighted coreset.
+         * 
+         * Events of the same type with identical input variables are merged first, summing up
+         * their weights. Then the events of each class are drawn with probabilities proportional to
+         * their sensitivities (a mixture of the absolute weight and the weighted squared distance
+         * to the mean of the class), and the weights of the drawn events are corrected so that
+         * sums over the training set are estimated without bias. The number of events is reduced
+         * by the configured factor. If the log-likelihood of a logistic model with any of several
+         * random validation parameters changes by more than the tolerance, the coreset is made
+         * larger.
+         */
+        void CompressTrainingSet();
+        
+        /**
+         * \brief Accumulates the covariance of the input variables in parallel
+         * 
+         * The training set is split into chunks of a fixed number of events, which are handled by
+         * a pool of threads and merged in the order of the chunks, so that the result does not
+         * depend on the number of threads.
+         */
+        CovarianceAccumulator AccumulateCovariance() const;
+        
+        /**
+         * \brief Describes everything that affects the preprocessed training set.
+         * 
+         * These are the input samples (including sizes and modification times of the files), the
+         * variables, the reweighting and the preprocessing.
+         */
+        static string DescribeTrainingSet(Config const &config);
+        
+        /**
+         * \brief Calculates the key to identify the preprocessed training set in the cache.
+         * 
+         * The key is a hash of the description of the training set. It does not depend on the task
+         * name, so the cache file is shared by all the tasks that use the same training set.
+         */
+        string ComputeCacheKey() const;
+        
+        /**
+         * \brief Reads the preprocessed training set and the transformations from the cache.
+         * 
+         * Returns false if caching is disabled or the cache file is missing or not usable (which
+         * includes sizes inconsistent with the length of the file). In the latter case the
+         * training set must be built from scratch.
+         */
+        bool ReadCache();
+        
+        /// Writes the preprocessed training set and the transformations to the cache
+        void WriteCache() const;
+        
+        /**
+         * \brief Moves some randomly chosen events from the training set to the held-out set.
+         * 
+         * The held-out events are used to thin the ensemble of neural networks. They have already
+         * been transformed. The weights of the remaining training events are not rescaled. The
+         * held-out events are removed from the list of events tried for training so that they can
+         * be used in the exam set, unless the same source event is still in the training set.
+         */
+        void HoldOutEvents();
+        
         /// Writes ROOT file containing the tree for training
         void WriteTrainFile() const;
     
     public:
+        /**
+         * \brief Returns a key that identifies the training set produced for the configuration.
+         * 
+         * Configurations with equal keys lead to identical training sets (including the events
+         * held out to thin the ensemble), and one object of the class can serve all of them.
+         */
+        static string GetTrainingSetKey(Config const &config);
+        
         /// Returns the number of input variables
         unsigned GetDim() const;
         
@@ -118,11 +198,42 @@ class InputProcessor
         
         /// Returns the list of the transformations
         list<TransformBase *> const & GetTransformations() const;
+        
+        /**
+         * \brief Writes the list of the events tried for training for another task
+         * 
+         * When the object serves several trainings, the list is only written for the task of the
+         * configuration given to the constructor. The method copies it to the file named after
+         * the given task and reports the file name with the given logger.
+         */
+        void WriteTrainEventsFile(string const &taskName, Logger &taskLog) const;
+        
+        /**
+         * \brief Copies randomly chosen events from the training set.
+         * 
+         * The transformed input variables (one event after another) and the weights of the given
+         * number of events chosen at random are written to the vectors. All the events are copied
+         * if the training set is smaller. The order of the events in the training set is preserved.
+         */
+        void SampleTrainingSet(unsigned long nEvents, vector<Double_t> &vars,
+         vector<Double_t> &weights) const;
+        
+        /// Returns the transformed input variables of the held-out events, one event after another
+        vector<Double_t> const & GetHeldOutVars() const;
+        
+        /// Returns the weights of the held-out events
+        vector<Double_t> const & GetHeldOutWeights() const;
     
     private:
         Logger &log;  ///< Logger instance
         Config const &config;  ///< Config instance
+        unsigned const nThreads;  ///< Maximal number of threads (zero if not limited)
         list<Event> trainingSet;  ///< Training set
+        vector<Double_t> heldOutVars;  ///< Input variables of the events held out from training
+        vector<Double_t> heldOutWeights;  ///< Weights of the events held out from training
         list<TransformBase *> transforms;  ///< Transformations of input variables
         string const trainingFileName;  ///< Name of the ROOT file used as input for FBM
+        string const trainEventsFileName;  ///< Name of the text file with events tried for training
+        string cacheFileName;  ///< Name of the cache file (empty if caching is disabled)
+        vector<MomentAccumulator> ingestMoments;  ///< Moments of inputs accumulated while reading
 };
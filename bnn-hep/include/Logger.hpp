@@ -11,6 +11,15 @@
 #include <string>
 #include <stdexcept>
 #include <map>
+#include <vector>
+#include <deque>
+#include <chrono>
+#include <ctime>
+#include <sstream>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 
 
 namespace logger {
@@ -31,6 +40,14 @@ struct MessageType__;
  * all the classes with this operator overloaded for std::ostream can be printed out. The needed
  * manipulators to describe the type and verbosity of the following message and the end of message
  * are provided.
+ * 
+ * The logger can be used from several threads at once. Each thread composes its messages in its
+ * own buffer, and a complete message is handed over at the end of message to a background thread,
+ * which writes it out. Thus messages from different threads are never mixed, and the threads do
+ * not wait for the output. Error messages are an exception: they are written out, together with
+ * all the messages queued before them, before the end-of-message manipulator returns, since the
+ * program usually terminates right after them. Progress messages are rate-limited: a thread's
+ * progress message is dropped if the previous one from the same thread came too recently.
  */
 class Logger
 {
@@ -42,7 +59,42 @@ class Logger
             Info,
             Warning,
             Error,
-            CriticalError
+            CriticalError,
+            Progress
+        };
+        
+        /**
+         * \brief Measures the resources spent in a phase of the processing
+         * 
+         * The measurement starts when the object is constructed and stops when it is destroyed.
+         * The wall time, the CPU time (including the one spent by the child processes, e.g. FBM
+         * routines) and the peak resident set sizes of the process and of its children are
+         * reported by the logger as an information message with verbosity 2 and are memorized
+         * for the summary. The timers can be nested, in which case the names of the phases are
+         * prefixed with the names of the enclosing ones. The nesting is tracked separately in each
+         * thread. The CPU time and the resident set sizes are those of the whole process, and
+         * only the wall time is reported if it is requested with Logger::SetWallTimeOnly.
+         */
+        class PhaseTimer
+        {
+            public:
+                /// Constructor. Starts the measurement
+                PhaseTimer(Logger &log_, std::string const &name);
+                
+                /// Destructor. Stops the measurement and reports the result
+                ~PhaseTimer();
+                
+                /// Copy constructor (not allowed to be used)
+                PhaseTimer(PhaseTimer const &) = delete;
+                
+                /// Assignment operator (not allowed to be used)
+                PhaseTimer const & operator=(PhaseTimer const &) = delete;
+            
+            private:
+                Logger &log;  ///< Logger instance
+                unsigned index;  ///< Index of the corresponding record in the logger
+                std::chrono::steady_clock::time_point startWall;  ///< Wall time at the start
+                double startCPU;  ///< CPU time (in seconds) at the start
         };
         
     public:
@@ -73,7 +125,7 @@ class Logger
          */
         Logger(unsigned stdVerbLevel_, unsigned fileVerbLevel_, std::string const &fileName);
         
-        /// Destructor
+        /// Destructor. Writes out the remaining messages and stops the writer thread
         ~Logger();
     
         /// The copy constructor is not allowed to be used
@@ -115,25 +167,27 @@ class Logger
         template<typename T>
         Logger& operator<<(T const &msg)
         {
+            MessageState &state = GetState();
+            
             // Check if the message type is defined
-            if (curMessageClass == MessageClass::Undefined)
+            if (state.messageClass == MessageClass::Undefined)
                 throw std::logic_error("The type of a message for logging was not specified");
             
-            if (curVerbosity < stdVerbLevel)
-            {
-                if (curMessageClass == MessageClass::Error or
-                 curMessageClass == MessageClass::CriticalError)
-                    std::cerr << msg;
-                else
-                    std::cout << msg;
-            }
-            
-            if (curVerbosity < fileVerbLevel and file)
-                *file << msg;
+            // The message is only formatted if it is printed anywhere
+            if (state.toStd or state.toFile)
+                state.text << msg;
             
             return *this;
         }
         
+        /**
+         * \brief Waits until all the messages ended so far are written out
+         * 
+         * Should be called before another process is started that writes to the same streams so
+         * that the outputs are not interleaved.
+         */
+        void Flush();
+        
         /**
          * \brief Requests the timestamps
          * 
@@ -147,31 +201,130 @@ class Logger
         /// Modifies verbosity for file
         void SetFileVerbosity(unsigned fileVerbLevel_);
         
+        /**
+         * \brief Sets the minimal interval between progress messages of a thread
+         * 
+         * A progress message that comes from a thread earlier than the given number of seconds
+         * after the previous one from the same thread is dropped. The default interval is 1 s.
+         */
+        void SetProgressInterval(double seconds);
+        
+        /**
+         * \brief Restricts the measurements of the phases to the wall time
+         * 
+         * The CPU time and the peak resident set sizes are measured for the whole process. When
+         * several tasks with their own loggers run in the same process at the same time, they do
+         * not describe the phases of any single task, and the switch should be set for the
+         * loggers of the tasks. The phases are then reported with the wall time only, and the
+         * other fields in the summary are left empty.
+         */
+        void SetWallTimeOnly(bool on = true);
+        
+        /**
+         * \brief Writes the resources spent in all the phases measured so far
+         * 
+         * The summary is written in CSV format, one line per phase, in the order in which the
+         * phases were started. The file is recreated.
+         */
+        void WritePhaseSummary(std::string const &fileName) const;
+        
     
     private:
+        /// Resources spent in a phase of the processing
+        struct PhaseRecord
+        {
+            std::string name;  ///< Name of the phase prefixed with the enclosing phases
+            unsigned depth;  ///< Nesting level
+            double wallTime;  ///< Wall time, s
+            double cpuTime;  ///< CPU time of the process and its children, s
+            long peakRSS;  ///< Peak resident set size of the process at the end of phase, kB
+            long childPeakRSS;  ///< Largest peak resident set size of a child process, kB
+        };
+        
+        /// The message being composed by a thread
+        struct MessageState
+        {
+            /// Default constructor
+            MessageState();
+            
+            MessageClass messageClass;  ///< Type of the current message
+            unsigned verbosity;  ///< Verbosity of the current message
+            bool toStd;  ///< Whether the current message goes to stdout/stderr
+            bool toFile;  ///< Whether the current message goes to the file
+            std::time_t time;  ///< Time at which the current message was started
+            std::ostringstream text;  ///< Text of the current message without the header
+            std::chrono::steady_clock::time_point lastProgress;  ///< Time of last progress message
+            std::vector<std::string> openPhases;  ///< Names of phases being measured in the thread
+        };
+        
+        /// A complete message waiting to be written out
+        struct Record
+        {
+            bool toStdErr;  ///< Whether the stdout/stderr text goes to stderr
+            std::string stdText;  ///< Text for stdout/stderr (empty if not printed there)
+            std::string fileText;  ///< Text for the file (empty if not printed there)
+        };
+        
+    private:
+        /// Returns the message state of the calling thread
+        MessageState &GetState();
+        
         /**
-         * \brief Prints the header for the message
+         * \brief Starts a new message
          * 
-         * The message header contains the text code describing the type of the message (info,
-         * error, etc.) and, optionally, the timestamp.
+         * Sets the type and verbosity of the message of the calling thread and decides where the
+         * message is printed.
          */
-        void PrintHeader();
+        void StartMessage(MessageType__ type);
+        
+        /// Body of the background thread that writes out the queued messages
+        void WriteMessages();
         
     private:
         /// Verbosity level for printing to stdout/stderror
-        unsigned stdVerbLevel;
+        std::atomic<unsigned> stdVerbLevel;
         /// Verbosity level for printing to file
-        unsigned fileVerbLevel;
+        std::atomic<unsigned> fileVerbLevel;
         /// The log file object
         std::ofstream *file;
-        /// The type of current message
-        MessageClass curMessageClass;
-        /// Verbosity of the current message
-        unsigned curVerbosity;
         /// Indicates whether the timestamps should be printed
-        bool printTimestamp;
+        std::atomic<bool> printTimestamp;
+        /// Minimal interval between progress messages of a thread
+        std::atomic<std::chrono::steady_clock::duration::rep> progressInterval;
+        /// Indicates whether only the wall time of the phases is reported
+        std::atomic<bool> wallTimeOnly;
         /// The text representation of the message classes
         std::map<MessageClass, std::string> textMessageTypes;
+        /// The phases measured so far
+        std::vector<PhaseRecord> phases;
+        /// Mutex to protect the phases
+        mutable std::mutex phasesMutex;
+        
+        /// Identifier to find the message states of this logger
+        unsigned long const id;
+        /// Messages waiting to be written out
+        std::deque<Record> queue;
+        /// Indicates whether the writer thread is writing a batch of messages
+        bool writing;
+        /// Indicates whether the writer thread should stop once the queue is empty
+        bool stopWriter;
+        /// Mutex to protect the queue and the flags above
+        std::mutex queueMutex;
+        /// Signals the writer thread that there are messages in the queue
+        std::condition_variable queueCondition;
+        /// Signals that the writer thread has written out all the queued messages
+        std::condition_variable idleCondition;
+        /// Thread that writes out the messages
+        std::thread writer;
+        
+        /// Counter to assign the identifiers
+        static std::atomic<unsigned long> nextId;
+        /// Message states of the calling thread, one per logger
+        static thread_local std::map<unsigned long, MessageState> states;
+        /// Identifier of the logger the calling thread has used last
+        static thread_local unsigned long lastId;
+        /// Message state of the calling thread for the logger it has used last
+        static thread_local MessageState *lastState;
 };
 
 
@@ -212,6 +365,18 @@ inline MessageType__ warning(unsigned verbosity = 0)
 }
 
 
+/**
+ * \brief Manipulator to produce the progress messages
+ * 
+ * They are treated as information messages but are dropped if they come too frequently from the
+ * same thread (see Logger::SetProgressInterval).
+ */
+inline MessageType__ progress(unsigned verbosity = 0)
+{
+    return MessageType__{Logger::MessageClass::Progress, verbosity};
+}
+
+
 /// Manipulator to produce the error messages. Verbosity is always set to zero
 inline MessageType__ error(unsigned)
 {
@@ -9,13 +9,14 @@
 #include <initializer_list>
 #include <vector>
 #include <ostream>
+#include <string>
 
 
 /**
  * \brief The class describes a neural network.
  * 
- * The class describes an artificial neural network. The architecture is a multilayer perceptron.
- * No method to apply the network is currently implemented.
+ * The class describes an artificial neural network. The architecture is a multilayer perceptron
+ * with tanh activation in the hidden layers.
  */
 class NeuralNetwork
 {
@@ -75,8 +76,8 @@ class NeuralNetwork
         double & GetWeight(unsigned layer, unsigned node, unsigned nodePrev);
         /// Access the biases (intended for modification)
         double & GetBias(unsigned layer, unsigned node);
-        /// Writes a C++ class to handle the neural network
-        void WriteClass(std::ostream &outStream) const;
+        /// Writes a C++ class with the given name to handle the neural network
+        void WriteClass(std::ostream &outStream, std::string const &className = "NN") const;
         /**
          * \brief Writes C++ code to initialized a neural network.
          * 
@@ -117,7 +118,7 @@ class NeuralNetwork
          * forward layer. The input layer does not have weights associated with it.
          */
          double ***weights;
-         /// Outputs of the nodes in some layer. Used to simplify the evaluation of the network
+         /// Outputs of the nodes in two consecutive layers. Used in the evaluation of the network
          mutable double *layerOutputs;
          /// Indicated whether the outputs should be translated to [0, 1] range
          bool isClassification;
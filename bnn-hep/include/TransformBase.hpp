@@ -10,6 +10,7 @@
 
 #include <Rtypes.h>
 
+#include <istream>
 #include <ostream>
 #include <string>
 
@@ -36,6 +37,32 @@ class TransformBase
         
         /// Generates C++ code reperesenting a class to perform the transformation
         virtual void WriteCode(std::ostream &outStream, std::string const &postfix) const = 0;
+        
+        /**
+         * \brief Generates C++ code for a class that performs the given preceding transformation
+         * and this one.
+         * 
+         * The generated class replaces the classes of the two transformations. Returns false and
+         * writes nothing if the transformations cannot be fused, which is the default.
+         */
+        virtual bool WriteFusedCode(std::ostream &outStream, std::string const &postfix,
+         TransformBase const &previous) const;
+        
+        /**
+         * \brief Writes the built transformation to a binary stream.
+         * 
+         * Only the parameters needed to apply the transformation are written, the state of the
+         * accumulators used to build it is not. The transformation must be already built.
+         */
+        void SaveState(std::ostream &outStream) const;
+        
+        /**
+         * \brief Restores the transformation from a binary stream.
+         * 
+         * Reads the parameters written with SaveState. The transformation is marked as built and no
+         * events can be added to it afterwards. Returns false if the stream ends prematurely.
+         */
+        bool LoadState(std::istream &inStream);
     
     protected:
         /// Virtual implementation of AddEvent functionality
@@ -46,6 +73,12 @@ class TransformBase
         
         /// Virtual implementation of ApplyTransformation functionality
         virtual void ApplyTransformationImp(Double_t *vars) = 0;
+        
+        /// Virtual implementation of SaveState functionality
+        virtual void SaveStateImp(std::ostream &outStream) const = 0;
+        
+        /// Virtual implementation of LoadState functionality
+        virtual bool LoadStateImp(std::istream &inStream) = 0;
     
     protected:
         logger::Logger &log;  ///< Logger instance
@@ -100,6 +100,12 @@ class TransformGauss: public TransformBase
         
         /// Transforms the given input
         void ApplyTransformationImp(Double_t *vars);
+        
+        /// Writes the parameters of the transformation
+        void SaveStateImp(std::ostream &outStream) const;
+        
+        /// Reads the parameters of the transformation
+        bool LoadStateImp(std::istream &inStream);
     
     private:
         /// Individual (independent) transformations for each variable
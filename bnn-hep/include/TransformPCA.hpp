@@ -8,20 +8,52 @@
 
 #include "TransformBase.hpp"
 
-//#include <TPrincipal.h>
+#include <vector>
+
+
+using std::vector;
 
 
 /**
- * \brief Performs principal component analysis (PCA).
+ * \brief Weighted means and covariance matrix of several variables.
  * 
- * Performs principal component analysis (PCA).
+ * The approach is the same as in MomentAccumulator: the moments are updated with Welford's
+ * algorithm, and accumulators filled with different events can be merged with a common rescaling
+ * of the weights.
+ */
+struct CovarianceAccumulator
+{
+    /// Constructor
+    CovarianceAccumulator(unsigned dim_ = 0);
+    
+    /// Adds an event
+    void Add(Double_t w, Double_t const *x);
+    
+    /// Adds all the events of the other accumulator with their weights multiplied by the scale
+    void Merge(CovarianceAccumulator const &other, Double_t scale = 1.);
+    
+    /// Returns the weighted covariance of the given variables
+    Double_t GetCovariance(unsigned i, unsigned j) const;
+    
+    unsigned dim;  ///< Number of variables
+    Double_t sumW;  ///< Sum of weights
+    vector<Double_t> mean;  ///< Weighted means
+    vector<Double_t> comoment;  ///< Weighted co-moments (the upper triangle of a dim x dim matrix)
+    vector<Double_t> delta;  ///< Buffer for deviations from the mean
+};
+
+
+/**
+ * \brief Performs principal component analysis (PCA).
  * 
- * ROOT implementation of PCA through TPrincipal class does not handle weighted events. One can
- * reimplement this class adding weights in the calculation of the covariance matrix or implement
- * decorrelation of the input variables (à la TMVA) by hands. In the latter case ROOT class
- * TMatrixDSymEigen and TMVA class VariableDecorrTransform might be useful.
+ * The variables are projected onto the eigenvectors of their weighted covariance matrix (in the
+ * order of decreasing eigenvalues), and the projections are scaled to unit variance. The resulting
+ * variables are uncorrelated, which helps the Markov chain to explore the posterior. ROOT
+ * implementation through TPrincipal class is not used since it does not handle weighted events.
  * 
- * The transformation is switched off at the moment.
+ * Since the transformation is affine, it is applied in the generated code together with a
+ * preceding standardization, whose parameters are absorbed in the matrix. A preceding
+ * gaussianisation is performed within the same functor right before the affine step.
  */
 class TransformPCA: public TransformBase
 {
@@ -29,9 +61,6 @@ class TransformPCA: public TransformBase
         /// Constructor
         TransformPCA(logger::Logger &log_, unsigned dim_);
         
-        /// Destructor
-        ~TransformPCA() noexcept;
-        
         /// Copy constructor (not allowed to be used)
         TransformPCA(TransformPCA const &) = delete;
         
@@ -41,6 +70,23 @@ class TransformPCA: public TransformBase
     public:
         /// Generates C++ code reperesenting a class to perform the transformation
         void WriteCode(std::ostream &outStream, std::string const &postfix) const;
+        
+        /**
+         * \brief Generates C++ code for the transformation fused with the preceding one.
+         * 
+         * Supports TransformStandard and TransformGauss as the preceding transformation.
+         */
+        bool WriteFusedCode(std::ostream &outStream, std::string const &postfix,
+         TransformBase const &previous) const;
+        
+        /**
+         * \brief Merges moments accumulated outside of the class.
+         * 
+         * Has the same effect as adding with AddEvent all the events the moments were accumulated
+         * over, with their weights multiplied by the scale. Must be called before the
+         * transformation is built.
+         */
+        void MergeMoments(CovarianceAccumulator const &partial, Double_t scale = 1.);
     
     private:
         /// Presents an event to update the information needed to build the transformation
@@ -51,4 +97,26 @@ class TransformPCA: public TransformBase
         
         /// Transforms the given input
         void ApplyTransformationImp(Double_t *vars);
+        
+        /// Writes the parameters of the transformation
+        void SaveStateImp(std::ostream &outStream) const;
+        
+        /// Reads the parameters of the transformation
+        bool LoadStateImp(std::istream &inStream);
+        
+        /**
+         * \brief Writes a class that computes matrix * (vars - shift).
+         * 
+         * If marginalClass is not empty, an object of this class is applied to the variables
+         * first.
+         */
+        void WriteAffineCode(std::ostream &outStream, std::string const &postfix,
+         vector<Double_t> const &shift_, vector<Double_t> const &matrix_,
+         std::string const &marginalClass) const;
+    
+    private:
+        CovarianceAccumulator accum;  ///< Moments of the variables
+        vector<Double_t> shift;  ///< Means of the variables
+        vector<Double_t> matrix;  ///< Rows are scaled eigenvectors (row-major dim x dim matrix)
+        vector<Double_t> buffer;  ///< Buffer for the centred variables
 };
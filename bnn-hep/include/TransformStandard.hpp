@@ -10,45 +10,52 @@
 
 #include <vector>
 
-#include <boost/accumulators/accumulators.hpp>
-#include <boost/accumulators/statistics/stats.hpp>
-#include <boost/accumulators/statistics/weighted_mean.hpp>
-#include <boost/accumulators/statistics/weighted_variance.hpp>
-// http://www.boost.org/doc/libs/1_50_0/doc/html/accumulators/user_s_guide.html
-
 
 using std::vector;
-using namespace boost::accumulators;
 
 
-typedef accumulator_set<Double_t,
- stats<tag::weighted_mean(immediate), tag::weighted_variance(immediate)>, Double_t>
- MeanVarAccumulator_t;
+/**
+ * \brief Weighted mean and variance of a single variable.
+ * 
+ * The moments are updated with Welford's algorithm. Accumulators filled with different events can
+ * be merged (Chan et al.), and the weights of all the events in the merged accumulator can be
+ * rescaled by a common factor at the same time.
+ */
+struct MomentAccumulator
+{
+    /// Default constructor
+    MomentAccumulator():
+        sumW(0.), mean(0.), m2(0.)
+    {}
+    
+    /// Adds an event
+    void Add(Double_t w, Double_t x)
+    {
+        sumW += w;
+        Double_t const delta = x - mean;
+        mean += delta * w / sumW;
+        m2 += w * delta * (x - mean);
+    }
+    
+    /// Adds all the events of the other accumulator with their weights multiplied by the scale
+    void Merge(MomentAccumulator const &other, Double_t scale = 1.);
+    
+    /// Returns the weighted variance
+    Double_t GetVariance() const;
+    
+    Double_t sumW;  ///< Sum of weights
+    Double_t mean;  ///< Weighted mean
+    Double_t m2;    ///< Weighted sum of squared deviations from the mean
+};
 
 
 /// Standardize the input vaiables (makes them zero mean and unit variance)
 class TransformStandard: public TransformBase
 {
-    private:
-        /// Transformation for a single variable
-        struct SingleVarTransform
-        {
-            Double_t mean, sigma;  ///< Mean and variance over the given variable
-            MeanVarAccumulator_t *accum;   ///< Boost accumulator
-            
-            /// Default constructor
-            SingleVarTransform():
-                mean(0.), sigma(0.), accum(nullptr)
-            {}
-        };
-        
     public:
         /// Constuctor
         TransformStandard(logger::Logger &log_, unsigned dim_);
         
-        /// Descructor
-        ~TransformStandard() noexcept;
-        
         /// Copy constructor (not allowed to be used)
         TransformStandard(TransformStandard const &) = delete;
         
@@ -58,6 +65,21 @@ class TransformStandard: public TransformBase
     public:
         /// Generates C++ code reperesenting a class to perform the transformation
         void WriteCode(std::ostream &outStream, std::string const &postfix) const;
+        
+        /**
+         * \brief Merges moments accumulated outside of the class.
+         * 
+         * Has the same effect as adding with AddEvent all the events the moments were accumulated
+         * over, with their weights multiplied by the scale. There must be one accumulator per
+         * variable. Must be called before the transformation is built.
+         */
+        void MergeMoments(vector<MomentAccumulator> const &partial, Double_t scale = 1.);
+        
+        /// Returns the means of the variables (the transformation must be built)
+        vector<Double_t> const & GetMeans() const;
+        
+        /// Returns the standard deviations of the variables (the transformation must be built)
+        vector<Double_t> const & GetSigmas() const;
     
     private:
         /// Presents an event to update the information needed to build the transformation
@@ -68,8 +90,15 @@ class TransformStandard: public TransformBase
         
         /// Transforms the given input
         void ApplyTransformationImp(Double_t *vars);
+        
+        /// Writes the parameters of the transformation
+        void SaveStateImp(std::ostream &outStream) const;
+        
+        /// Reads the parameters of the transformation
+        bool LoadStateImp(std::istream &inStream);
     
     private:
-        /// Individual (independent) transformations for each variable
-        vector<SingleVarTransform> singleTrans;
+        vector<MomentAccumulator> moments;  ///< Moments of the variables (until the build)
+        vector<Double_t> mean;  ///< Means of the variables
+        vector<Double_t> sigma;  ///< Standard deviations of the variables
 };
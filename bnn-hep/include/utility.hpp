@@ -10,8 +10,8 @@
 #include <string>
 
 
-/// Global random generator
-extern TRandom3 randGen;
+/// Random generator. Each thread has its own one, seeded independently
+extern thread_local TRandom3 randGen;
 
 
 /// Generates random names
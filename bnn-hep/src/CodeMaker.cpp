@@ -1,7 +1,13 @@
 #include "CodeMaker.hpp"
+#include "Distiller.hpp"
 
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <limits>
 #include <sstream>
 #include <ctime>
+#include <mutex>
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
 
@@ -10,12 +16,20 @@ using namespace logger;
 using std::ofstream;
 
 
+// Protects the header with the base class, which is shared by the trainings run at the same time
+std::mutex baseClassFileMutex;
+
+
 CodeMaker::CodeMaker(Logger &log_, Config const &config_, InputProcessor const &inputProcessor_,
  FBMWrapper const &fbm_):
     log(log_), config(config_), inputProcessor(inputProcessor_), fbm(fbm_),
-    file(config.GetCPPFileName().c_str())
+    file(config.GetCPPFileName().c_str()), isDistilled(false), studentDeviation(0.)
 {
+    Logger::PhaseTimer timer(log, "CodeMaker");
+    
     // Create a header file with an abstract base class
+    std::unique_lock<std::mutex> baseClassLock(baseClassFileMutex);
+    
     if (not boost::filesystem::exists("BinaryDiscriminator.hpp"))
     {
         ofstream baseClassFile("BinaryDiscriminator.hpp");
@@ -34,14 +48,38 @@ CodeMaker::CodeMaker(Logger &log_, Config const &config_, InputProcessor const &
         baseClassFile.close();
     }
     
+    baseClassLock.unlock();
+    
     
     // Build the neural networks from the BNN
-    nets.reserve(config.GetBNNMCMCIterations() - config.GetBNNMCMCBurnIn());
+    {
+        Logger::PhaseTimer extractionTimer(log, "network extraction");
+        nets.reserve(config.GetBNNMCMCIterations() - config.GetBNNMCMCBurnIn());
+        
+        for (unsigned i = config.GetBNNMCMCBurnIn() + 1; i <= config.GetBNNMCMCIterations(); ++i)
+            nets.emplace_back(fbm.ReadNN(i));
+        // The NN at index 0 corresponds to the generated one and therefore is never considered even
+        //as a part of the burn-in
+    }
     
-    for (unsigned i = config.GetBNNMCMCBurnIn() + 1; i <= config.GetBNNMCMCIterations(); ++i)
-        nets.emplace_back(fbm.ReadNN(i));
-    // The NN at index 0 corresponds to the generated one and therefore is never considered even as
-    //a part of the burn-in
+    nNetsTotal = nets.size();
+    
+    // The student network is fitted to the full ensemble, before it is thinned
+    if (config.GetDistillation().epochs > 0)
+    {
+        Distiller distiller(log, config, inputProcessor, nets);
+        student = distiller.GetStudent();
+        studentDeviation = distiller.GetDeviation();
+        isDistilled = true;
+    }
+    
+    if (config.GetBNNThinningTolerance() > 0.)
+    {
+        Logger::PhaseTimer thinningTimer(log, "ensemble thinning");
+        ThinEnsemble();
+    }
+    
+    Logger::PhaseTimer generationTimer(log, "code generation");
     
     
     // Get the current time (used in the preamble)
@@ -64,7 +102,17 @@ CodeMaker::CodeMaker(Logger &log_, Config const &config_, InputProcessor const &
     for (unsigned iVar = 0; iVar < vars.size(); ++iVar)
         file << " *  var #" << iVar << ": " << vars.at(iVar) << '\n';
     
-    file << " * \n * From the code below, the user is expected to only use the class BNN.\n";
+    if (nets.size() < nNetsTotal)
+        file << " * \n * The ensemble is thinned to " << nets.size() << " out of " << nNetsTotal <<
+         " networks.\n";
+    
+    if (isDistilled)
+        file << " * \n * The class BNNStudent applies a single network fitted to reproduce the " <<
+         "averaged\n * output of the full ensemble. Its RMS deviation from the ensemble on test " <<
+         "events is " << studentDeviation << ".\n";
+    
+    file << " * \n * From the code below, the user is expected to only use the class BNN" <<
+     (isDistilled ? " or BNNStudent" : "") << ".\n";
     
     file << " ******************************************************************************/\n" <<
      "\n\n";
@@ -128,17 +176,29 @@ CodeMaker::CodeMaker(Logger &log_, Config const &config_, InputProcessor const &
      "}\n";
     
     
-    // Write the classes to handle the transformations of the input variables
+    // Write the classes to handle the transformations of the input variables. A transformation
+    //might be fused with the one that follows it, in which case a single class is written for the
+    //both of them
     file << '\n';
+    auto const &transforms = inputProcessor.GetTransformations();
     unsigned transformIndex = 0;
     std::ostringstream ost;
     
-    for (auto const &t: inputProcessor.GetTransformations())
+    for (auto it = transforms.cbegin(); it != transforms.cend(); ++it, ++transformIndex)
     {
         ost << transformIndex;
-        t->WriteCode(file, ost.str());
+        transformClasses.push_back(transformIndex);
+        auto next = std::next(it);
+        
+        if (next != transforms.cend() and (*next)->WriteFusedCode(file, ost.str(), **it))
+        {
+            it = next;
+            ++transformIndex;
+        }
+        else
+            (*it)->WriteCode(file, ost.str());
+        
         ost.str("");
-        ++transformIndex;
     }
     
     
@@ -148,6 +208,13 @@ CodeMaker::CodeMaker(Logger &log_, Config const &config_, InputProcessor const &
     // Write the BNN class
     WriteBNNClass();
     
+    // Write the class for the student network
+    if (isDistilled)
+    {
+        student.WriteClass(file, "StudentNN");
+        WriteStudentClass();
+    }
+    
     
     // Close the namespace and the include guard
     file << "}\n\n#endif\n";
@@ -164,6 +231,136 @@ CodeMaker::~CodeMaker()
 }
 
 
+void CodeMaker::ThinEnsemble()
+{
+    vector<Double_t> const &vars = inputProcessor.GetHeldOutVars();
+    vector<Double_t> const &weights = inputProcessor.GetHeldOutWeights();
+    unsigned const dim = inputProcessor.GetDim();
+    unsigned long const nEvents = weights.size();
+    unsigned const nNets = nets.size();
+    
+    if (nEvents == 0 or nNets < 2)
+        return;
+    
+    double sumWeights = 0.;
+    
+    for (auto const &w: weights)
+        sumWeights += w;
+    
+    
+    // Evaluate all the networks on the held-out events and average their outputs
+    vector<double> outputs(nNets * nEvents);
+    vector<double> fullAverage(nEvents, 0.);
+    
+    for (unsigned n = 0; n < nNets; ++n)
+        for (unsigned long e = 0; e < nEvents; ++e)
+        {
+            outputs[n * nEvents + e] = *nets[n].Apply(&vars[e * dim]);
+            fullAverage[e] += outputs[n * nEvents + e] / nNets;
+        }
+    
+    
+    // Calculates the RMS deviation from the full ensemble of the average of the given sums of
+    //outputs over nSum networks, possibly with the outputs of an additional network included
+    auto deviation = [&](vector<double> const &sums, unsigned nSum, double const *extra)
+    {
+        double dev2 = 0.;
+        unsigned const n = nSum + (extra ? 1 : 0);
+        
+        for (unsigned long e = 0; e < nEvents; ++e)
+        {
+            double const d = (sums[e] + (extra ? extra[e] : 0.)) / n - fullAverage[e];
+            dev2 += weights[e] * d * d;
+        }
+        
+        return std::sqrt(dev2 / sumWeights);
+    };
+    
+    double const tolerance = config.GetBNNThinningTolerance();
+    vector<double> sums(nEvents);
+    
+    
+    // Take every k-th network, with k decreasing, until the tolerance is met. Since the full
+    //ensemble is eventually reached, it is always the case
+    vector<unsigned> strided;
+    double stridedDeviation = 0.;
+    
+    for (unsigned m = 1; m <= nNets; ++m)
+    {
+        strided.clear();
+        std::fill(sums.begin(), sums.end(), 0.);
+        
+        for (unsigned i = 0; i < m; ++i)
+        {
+            unsigned const n = (2 * i + 1) * nNets / (2 * m);
+            strided.push_back(n);
+            
+            for (unsigned long e = 0; e < nEvents; ++e)
+                sums[e] += outputs[n * nEvents + e];
+        }
+        
+        stridedDeviation = deviation(sums, m, nullptr);
+        
+        if (stridedDeviation <= tolerance)
+            break;
+    }
+    
+    
+    // Add networks greedily. Stop when the tolerance is met or the subset is not going to be
+    //smaller than the strided one
+    vector<unsigned> greedy;
+    vector<bool> isUsed(nNets, false);
+    double greedyDeviation = std::numeric_limits<double>::infinity();
+    std::fill(sums.begin(), sums.end(), 0.);
+    
+    while (greedyDeviation > tolerance and greedy.size() + 1 < strided.size())
+    {
+        unsigned best = 0;
+        double bestDeviation = std::numeric_limits<double>::infinity();
+        
+        for (unsigned n = 0; n < nNets; ++n)
+        {
+            if (isUsed[n])
+                continue;
+            
+            double const d = deviation(sums, greedy.size(), &outputs[n * nEvents]);
+            
+            if (d < bestDeviation)
+            {
+                best = n;
+                bestDeviation = d;
+            }
+        }
+        
+        greedy.push_back(best);
+        isUsed[best] = true;
+        greedyDeviation = bestDeviation;
+        
+        for (unsigned long e = 0; e < nEvents; ++e)
+            sums[e] += outputs[best * nEvents + e];
+    }
+    
+    
+    // Keep the selected networks in the order of iterations
+    bool const useGreedy = (greedyDeviation <= tolerance);
+    vector<unsigned> selected(useGreedy ? greedy : strided);
+    std::sort(selected.begin(), selected.end());
+    
+    vector<NeuralNetwork> thinnedNets;
+    thinnedNets.reserve(selected.size());
+    
+    for (auto const &n: selected)
+        thinnedNets.emplace_back(std::move(nets[n]));
+    
+    nets.swap(thinnedNets);
+    
+    log << info(1) << "The ensemble is thinned from " << nNets << " to " << nets.size() <<
+     " networks (" << (useGreedy ? "greedy selection" : "every k-th network") <<
+     "). The RMS deviation of the averaged output on " << nEvents << " held-out events is " <<
+     (useGreedy ? greedyDeviation : stridedDeviation) << "." << eom;
+}
+
+
 void CodeMaker::WriteBNNClass()
 {
     // Write the short class description
@@ -179,7 +376,7 @@ void CodeMaker::WriteBNNClass()
     
     for (unsigned iVar = 1; iVar < inputProcessor.GetDim(); ++iVar)
         file << ", Double_t var" << iVar;
-     
+    
     file << ") const;\n" <<
      "\t\n\tprivate:\n" <<
      "\t\tDouble_t Apply(Double_t const *vars) const;\n" <<
@@ -188,9 +385,7 @@ void CodeMaker::WriteBNNClass()
      "\t\tUInt_t netBegin, netEnd;\n";
     
     // Transformation functors
-    unsigned nTrans = inputProcessor.GetTransformations().size();
-    
-    for (unsigned i = 0; i < nTrans; ++i)
+    for (unsigned const i: transformClasses)
         file <<
          "\t\tTransform" << i << " trans" << i << ";\n";
     
@@ -255,7 +450,7 @@ void CodeMaker::WriteBNNClass()
      "\tDouble_t transVars[" << inputProcessor.GetDim() << "];\n" <<
      "\tstd::copy(vars, vars + " << inputProcessor.GetDim() << ", transVars);\n\t\n";
     
-    for (unsigned i = 0; i < nTrans; ++i)
+    for (unsigned const i: transformClasses)
         file <<
          "\ttrans" << i << "(transVars);\n";
     
@@ -266,3 +461,82 @@ void CodeMaker::WriteBNNClass()
      "\treturn res / (netEnd - netBegin);\n" <<
      "}\n\n\n";
 }
+
+
+void CodeMaker::WriteStudentClass()
+{
+    unsigned const dim = inputProcessor.GetDim();
+    
+    // The measured approximation error is available to the user
+    file <<
+     "Double_t const studentDeviation = " << studentDeviation << ";\n\n\n";
+    
+    // Write the short class description
+    file <<
+     "class BNNStudent: public BinaryDiscriminator\n" <<
+     "{\n" <<
+     "\tpublic:\n" <<
+     "\t\tBNNStudent();\n\t\n" <<
+     "\tpublic:\n" <<
+     "\t\tDouble_t operator()(Double_t const *vars) const;\n" <<
+     "\t\tDouble_t operator()(Double_t var0";
+    
+    for (unsigned iVar = 1; iVar < dim; ++iVar)
+        file << ", Double_t var" << iVar;
+    
+    file << ") const;\n" <<
+     "\t\n\tprivate:\n" <<
+     "\t\tStudentNN net;\n";
+    
+    for (unsigned const i: transformClasses)
+        file <<
+         "\t\tTransform" << i << " trans" << i << ";\n";
+    
+    file <<
+     "};\n\n\n";
+    
+    
+    // Define the constructor
+    file <<
+     "BNNStudent::BNNStudent()\n" <<
+     "{\n";
+    
+    student.WriteInitialization(file, "\t", "net.", "student");
+    
+    file <<
+     "}\n\n\n";
+    
+    
+    // Now methods
+    file <<
+     "Double_t BNNStudent::operator()(Double_t const *vars) const\n" <<
+     "{\n" <<
+     "\tDouble_t transVars[" << dim << "];\n" <<
+     "\tstd::copy(vars, vars + " << dim << ", transVars);\n\t\n";
+    
+    for (unsigned const i: transformClasses)
+        file <<
+         "\ttrans" << i << "(transVars);\n";
+    
+    file <<
+     "\t\n\treturn *net.Apply(transVars);\n" <<
+     "}\n\n\n";
+    
+    file <<
+     "Double_t BNNStudent::operator()(Double_t var0";
+    
+    for (unsigned iVar = 1; iVar < dim; ++iVar)
+        file << ", Double_t var" << iVar;
+    
+    file << ") const\n" <<
+     "{\n" <<
+     "\tDouble_t vars[" << dim << "];\n\t\n";
+    
+    for (unsigned iVar = 0; iVar < dim; ++iVar)
+        file <<
+         "\tvars[" << iVar << "] = var" << iVar << ";\n";
+    
+    file <<
+     "\treturn (*this)(vars);\n" <<
+     "}\n\n\n";
+}
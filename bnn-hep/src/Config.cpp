@@ -3,6 +3,7 @@
 
 #include <cstdlib>
 #include <algorithm>
+#include <sstream>
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
 
@@ -10,9 +11,11 @@
 using std::exit;
 
 
-Config::Config(string const &fileName, Logger &log_):
+Config::Config(string const &fileName, Logger &log_, unsigned scanPoint /*= 0*/):
     log(log_)
 {
+    Logger::PhaseTimer timer(log, "Config");
+    
     // Read the configuration file
     try
     {
@@ -30,18 +33,29 @@ Config::Config(string const &fileName, Logger &log_):
         exit(1);
     }
     
+    // The scanned settings are replaced before anything is read so that any of them can be scanned
+    string const scanDescription = ApplyScanPoint(scanPoint);
+    
     
     // Adjust the logger's verbosity level
     unsigned const verbosity = ReadParameterDef("general.verbosity", -1);
     log.SetStdVerbosity(verbosity);
     log.SetFileVerbosity(verbosity);
     
+    if (scanDescription.length() > 0)
+        log << info(1) << "Scan point #" << scanPoint << ": " << scanDescription << "." << eom;
+    
     
     
     // Read the group 'general' (though not much is left)
     size_t strIndex = fileName.find_last_of('/');
     taskName = ReadParameterDef("general.task-name", fileName.substr(strIndex + 1,
      fileName.find_last_of('.') - strIndex - 1));
+    
+    // Each point of a scan is a separate task
+    if (scanDescription.length() > 0)
+        taskName += "_" + std::to_string(scanPoint);
+    
     FBMPath = ReadParameterDef("general.fbm-path", string(""));
     
     if (FBMPath.length() > 0 and not boost::iends_with(FBMPath.c_str(), "/"))
@@ -49,6 +63,17 @@ Config::Config(string const &fileName, Logger &log_):
     
     keepTempFiles = ReadParameterDef("general.keep-temp-files", false);
     
+    // The preprocessed training sets are cached only if the directory is given
+    cacheDir = ReadParameterDef("general.cache-dir", string(""));
+    
+    if (cacheDir.length() > 0)
+    {
+        if (not boost::iends_with(cacheDir.c_str(), "/"))
+            cacheDir += '/';
+        
+        boost::filesystem::create_directories(cacheDir);
+    }
+    
     
     
     // Read the section with the input samples
@@ -154,6 +179,23 @@ Config::Config(string const &fileName, Logger &log_):
         //inputTransformations.push_back(InputTransformation::PCA);
     }
     
+    // The training set can be replaced with a smaller weighted coreset built after the
+    //preprocessing. The number of events is reduced by the given factor unless the log-likelihood
+    //of validation models changes by more than the tolerance. It is disabled by default
+    coresetFactor = ReadParameterDef("input-samples.coreset-factor", 1.);
+    coresetTolerance = ReadParameterDef("input-samples.coreset-tolerance", 0.01);
+    
+    if (coresetFactor < 1. or coresetTolerance <= 0.)
+    {
+        log << error << "Parameters of the coreset in section \"input-samples\" are out of " <<
+         "range." << eom;
+        exit(1);
+    }
+    
+    if (coresetFactor > 1.)
+        log << info(2) << "The training set is compressed by a factor of " << coresetFactor <<
+         " with the tolerance " << coresetTolerance << "." << eom;
+    
     
     
     // Read the section on the BNN training
@@ -196,6 +238,199 @@ Config::Config(string const &fileName, Logger &log_):
     burnInIterations = ReadParameterDef("bnn-parameters.burn-in", unsigned(0));
     numberIterations = ReadParameter("bnn-parameters.ensemble-size", unsigned()) + burnInIterations;
     
+    // The sampler for all the iterations but the first one. NUTS needs no hand-tuned trajectory
+    //length, and its stepsize is adapted during the burn-in
+    string const samplerText = ReadParameterDef("bnn-parameters.sampler", string("hmc"));
+    
+    if (samplerText.compare("hmc") == 0)
+        sampler = Sampler::HMC;
+    else if (samplerText.compare("nuts") == 0)
+        sampler = Sampler::NUTS;
+    else
+    {
+        log << error << "An unexpected value \"" << samplerText <<
+         "\" is specified for \"bnn-parameters.sampler\" parameter." << eom;
+        exit(1);
+    }
+    
+    if (sampler == Sampler::NUTS)
+    {
+        if (cfg.exists("bnn-parameters.mcmc-parameters"))
+            log << warning << "Setting \"bnn-parameters.mcmc-parameters\" is ignored since NUTS " <<
+             "sampler is requested." << eom;
+        
+        unsigned const nutsRepeat = ReadParameterDef("bnn-parameters.nuts-repeat", unsigned(10));
+        unsigned const nutsMaxDepth = ReadParameterDef("bnn-parameters.nuts-max-depth",
+         unsigned(10));
+        double const nutsTarget = ReadParameterDef("bnn-parameters.nuts-target-acceptance", 0.8);
+        
+        if (nutsRepeat == 0 or nutsMaxDepth == 0 or nutsTarget <= 0. or nutsTarget >= 1.)
+        {
+            log << error << "Parameters of NUTS sampler in section \"bnn-parameters\" are out " <<
+             "of range." << eom;
+            exit(1);
+        }
+        
+        // The first iteration is performed with its own parameters, therefore the stepsize is
+        //adapted during the remaining burn-in iterations only
+        unsigned const adaptCount =
+         (burnInIterations > 1) ? (burnInIterations - 1) * nutsRepeat : 0;
+        
+        if (adaptCount == 0)
+            log << warning << "The burn-in is too short to adapt the stepsize of NUTS sampler." <<
+             eom;
+        
+        std::ostringstream nutsParams;
+        nutsParams << "repeat " << nutsRepeat << " sample-sigmas heatbath nuts -a " <<
+         adaptCount << ":" << nutsTarget << " " << nutsMaxDepth;
+        MCMCParameters = nutsParams.str();
+        
+        log << info(2) << "NUTS sampler is used with MCMC parameters \"" << MCMCParameters <<
+         "\"." << eom;
+    }
+    
+    // The masses (i.e. the stepsizes of the parameters) can be adapted to the posterior. The
+    //variances of the parameters are estimated over the first half of the burn-in that follows the
+    //first iteration, and the masses are fixed afterwards. The operation is put in front of the
+    //rest so that it is performed once per iteration
+    if (ReadParameterDef("bnn-parameters.adapt-mass", false))
+    {
+        unsigned const massCount = (burnInIterations > 1) ? (burnInIterations - 1) / 2 : 0;
+        
+        if (massCount < 2)
+            log << warning << "The burn-in is too short to adapt the masses. The adaptation is " <<
+             "not performed." << eom;
+        else
+        {
+            std::ostringstream massParams;
+            massParams << "adapt-mass " << massCount << " " << MCMCParameters;
+            MCMCParameters = massParams.str();
+            
+            log << info(2) << "The masses are adapted with MCMC parameters \"" <<
+             MCMCParameters << "\"." << eom;
+        }
+    }
+    
+    // The initial network can be optimised with net-opt before the sampling so that a shorter
+    //burn-in is needed. It is disabled by default
+    unsigned const warmStartEpochs = ReadParameterDef("bnn-parameters.warm-start-epochs",
+     unsigned(0));
+    
+    if (warmStartEpochs > 0)
+    {
+        unsigned const batchSize = ReadParameterDef("bnn-parameters.warm-start-batch-size",
+         unsigned(256));
+        string const method = ReadParameterDef("bnn-parameters.warm-start-method",
+         string("adam"));
+        double const stepsize = ReadParameterDef("bnn-parameters.warm-start-stepsize", 0.001);
+        
+        if (method != "adam" and method != "sgd")
+        {
+            log << error << "An unexpected value \"" << method << "\" is specified for " <<
+             "\"bnn-parameters.warm-start-method\" parameter." << eom;
+            exit(1);
+        }
+        
+        if (batchSize == 0 or stepsize <= 0.)
+        {
+            log << error << "Parameters of the warm start in section \"bnn-parameters\" are " <<
+             "out of range." << eom;
+            exit(1);
+        }
+        
+        std::ostringstream warmStartParams;
+        warmStartParams << warmStartEpochs << " " << batchSize << " / " << method << " " <<
+         stepsize;
+        warmStartParameters = warmStartParams.str();
+        
+        log << info(2) << "The initial network is optimised with parameters \"" <<
+         warmStartParameters << "\"." << eom;
+    }
+    
+    // The sampling can be done with parallel tempering. It is enabled by giving the inverse
+    //temperatures of the additional replicas in the format of mc-temp-sched (e.g. "0.1:4"), the
+    //inverse temperature of one is added automatically. Only the replica at the inverse
+    //temperature of one is used to construct the ensemble
+    temperingSchedule = ReadParameterDef("bnn-parameters.tempering-schedule", string(""));
+    temperingSwapInterval = ReadParameterDef("bnn-parameters.tempering-swap-interval",
+     unsigned(1));
+    
+    if (temperingSwapInterval == 0)
+    {
+        log << error << "Parameter \"bnn-parameters.tempering-swap-interval\" must be " <<
+         "positive." << eom;
+        exit(1);
+    }
+    
+    if (not temperingSchedule.empty())
+        log << info(2) << "Parallel tempering is used with the schedule \"" << temperingSchedule <<
+         "\" and swaps proposed every " << temperingSwapInterval << " iterations." << eom;
+    
+    // The sampling with net-mc can be split over several MPI processes, each of which holds a
+    //shard of the training set. The command to launch the processes is given (e.g. "mpirun -np 4"),
+    //and FBM must be compiled with MPI support. It is disabled by default
+    MPICommand = ReadParameterDef("bnn-parameters.mpi-command", string(""));
+    
+    if (not MPICommand.empty())
+    {
+        if (not temperingSchedule.empty())
+        {
+            log << warning << "MPI processes are not used with parallel tempering. Parameter " <<
+             "\"bnn-parameters.mpi-command\" is ignored." << eom;
+            MPICommand.clear();
+        }
+        else
+            log << info(2) << "The sampling is run with the command \"" << MPICommand << "\"." <<
+             eom;
+    }
+    
+    // The OpenMP threads of FBM can be bound to cores, spread over the NUMA nodes, so that each
+    //thread keeps using the part of the training set placed in the memory of its own node
+    pinThreads = ReadParameterDef("bnn-parameters.pin-threads", false);
+    
+    // The ensemble can be thinned so that the generated code evaluates fewer networks. The smallest
+    //subset of networks is chosen whose averaged output deviates from the one of the full ensemble
+    //by no more than the given tolerance (RMS over events held out from the training set). It is
+    //disabled by default
+    thinningTolerance = ReadParameterDef("bnn-parameters.thinning-tolerance", 0.);
+    thinningEvents = ReadParameterDef("bnn-parameters.thinning-events", unsigned(5000));
+    
+    if (thinningTolerance < 0. or (thinningTolerance > 0. and thinningEvents == 0))
+    {
+        log << error << "Parameters of the thinning of the ensemble in section " <<
+         "\"bnn-parameters\" are out of range." << eom;
+        exit(1);
+    }
+    
+    if (thinningTolerance > 0.)
+        log << info(2) << "The ensemble is thinned with the tolerance " << thinningTolerance <<
+         " evaluated on " << thinningEvents << " held-out events." << eom;
+    
+    // The ensemble can be distilled into a single network (the student) that is fitted to
+    //reproduce the averaged output of the ensemble. The student is written to the generated code in
+    //addition to the ensemble. It is disabled by default
+    distillation.epochs = ReadParameterDef("bnn-parameters.distillation-epochs", unsigned(0));
+    distillation.numberNeurons = ReadParameterDef("bnn-parameters.distillation-neurons",
+     2 * numberNeurons);
+    distillation.maxEvents = ReadParameterDef("bnn-parameters.distillation-events", 100000UL);
+    distillation.batchSize = ReadParameterDef("bnn-parameters.distillation-batch-size",
+     unsigned(256));
+    distillation.stepsize = ReadParameterDef("bnn-parameters.distillation-stepsize", 0.001);
+    
+    if (distillation.epochs > 0)
+    {
+        if (distillation.numberNeurons == 0 or distillation.maxEvents < 10 or
+         distillation.batchSize == 0 or distillation.stepsize <= 0.)
+        {
+            log << error << "Parameters of the distillation in section \"bnn-parameters\" are " <<
+             "out of range." << eom;
+            exit(1);
+        }
+        
+        log << info(2) << "The ensemble is distilled into a network with " <<
+         distillation.numberNeurons << " neurons in " << distillation.epochs << " epochs." << eom;
+    }
+    
     
     
     // Read the section on the output C++ code for BNN
@@ -211,6 +446,144 @@ Config::Config(string const &fileName, Logger &log_):
 }
 
 
+unsigned Config::CountScanPoints(string const &fileName)
+{
+    libconfig::Config scanCfg;
+    
+    try
+    {
+        scanCfg.readFile(fileName.c_str());
+        
+        if (not scanCfg.exists("scan"))
+            return 1;
+        
+        Setting const &axes = scanCfg.lookup("scan");
+        unsigned nPoints = 1;
+        
+        for (int i = 0; i < axes.getLength(); ++i)
+            nPoints *= axes[i]["values"].getLength();
+        
+        return (nPoints > 0) ? nPoints : 1;
+    }
+    catch (libconfig::ConfigException)
+    {
+        return 1;
+    }
+}
+
+
+string Config::ApplyScanPoint(unsigned point)
+{
+    if (not cfg.exists("scan"))
+        return "";
+    
+    Setting const &axes = cfg.lookup("scan");
+    
+    if (not axes.isList() or axes.getLength() == 0)
+    {
+        log << critical << "Setting \"scan\" must be a non-empty list of groups." << eom;
+        exit(1);
+    }
+    
+    
+    // Decode the index of the point starting from the last axis, which changes fastest
+    vector<string> assignments(axes.getLength());
+    
+    for (int i = axes.getLength() - 1; i >= 0; --i)
+    {
+        Setting const &axis = axes[i];
+        
+        if (not axis.isGroup() or not axis.exists("values") or
+         not (axis["values"].isArray() or axis["values"].isList()) or
+         axis["values"].getLength() == 0)
+        {
+            log << critical << "Setting \"" << axis.getPath() << "\" must be a group with a " <<
+             "parameter path and a non-empty array of values." << eom;
+            exit(1);
+        }
+        
+        string const path = ReadChildParameter(axis, "parameter", string());
+        Setting const &values = axis["values"];
+        Setting const &value = values[int(point % values.getLength())];
+        point /= values.getLength();
+        
+        if (not value.isScalar())
+        {
+            log << critical << "The values in setting \"" << values.getPath() << "\" must be " <<
+             "scalars." << eom;
+            exit(1);
+        }
+        
+        
+        // Replace the setting. The enclosing group must exist
+        size_t const dotIndex = path.find_last_of('.');
+        string const parentPath = (dotIndex == string::npos) ? "" : path.substr(0, dotIndex);
+        string const name = path.substr(dotIndex + 1);  // npos + 1 is zero
+        
+        if (parentPath.length() > 0 and not cfg.exists(parentPath))
+        {
+            log << critical << "Group \"" << parentPath << "\" of scanned setting \"" << path <<
+             "\" is not found in the configuration." << eom;
+            exit(1);
+        }
+        
+        Setting &parent = (parentPath.length() > 0) ? cfg.lookup(parentPath) : cfg.getRoot();
+        std::ostringstream assignment;
+        assignment << path << " = ";
+        
+        try
+        {
+            if (parent.exists(name))
+                parent.remove(name);
+            
+            Setting &target = parent.add(name, value.getType());
+            
+            switch (value.getType())
+            {
+                case Setting::Type::TypeInt:
+                    target = int(value);
+                    assignment << int(value);
+                    break;
+                
+                case Setting::Type::TypeInt64:
+                    target = (long long)(value);
+                    assignment << (long long)(value);
+                    break;
+                
+                case Setting::Type::TypeFloat:
+                    target = double(value);
+                    assignment << double(value);
+                    break;
+                
+                case Setting::Type::TypeBoolean:
+                    target = bool(value);
+                    assignment << (bool(value) ? "true" : "false");
+                    break;
+                
+                default:
+                    target = static_cast<char const *>(value);
+                    assignment << "\"" << static_cast<char const *>(value) << "\"";
+            }
+        }
+        catch (libconfig::SettingException)
+        {
+            log << critical << "Setting \"" << path << "\" cannot be scanned over." << eom;
+            exit(1);
+        }
+        
+        assignments[i] = assignment.str();
+    }
+    
+    
+    string description;
+    
+    for (auto const &a: assignments)
+        description += ((description.length() > 0) ? ", " : "") + a;
+    
+    return description;
+}
+
+
 Setting const & Config::LookupSetting(string const &path) throw(SettingNotFoundException)
 {
     return ExpandSetting(cfg.lookup(path));
@@ -431,6 +804,18 @@ vector<Config::InputTransformation> const & Config::GetTransformations() const
 }
 
 
+double Config::GetCoresetFactor() const
+{
+    return coresetFactor;
+}
+
+
+double Config::GetCoresetTolerance() const
+{
+    return coresetTolerance;
+}
+
+
 string const & Config::GetFBMPath() const
 {
     return FBMPath;
@@ -443,6 +828,12 @@ bool Config::GetKeepTempFiles() const
 }
 
 
+string const & Config::GetCacheDir() const
+{
+    return cacheDir;
+}
+
+
 string const & Config::GetBNNFileName() const
 {
     return networkName;
@@ -479,6 +870,60 @@ std::pair<string const &, string const &> Config::GetBNNMCMCParameters() const
 }
 
 
+Config::Sampler Config::GetBNNSampler() const
+{
+    return sampler;
+}
+
+
+string const & Config::GetBNNWarmStartParameters() const
+{
+    return warmStartParameters;
+}
+
+
+string const & Config::GetBNNTemperingSchedule() const
+{
+    return temperingSchedule;
+}
+
+
+unsigned Config::GetBNNTemperingSwapInterval() const
+{
+    return temperingSwapInterval;
+}
+
+
+string const & Config::GetMPICommand() const
+{
+    return MPICommand;
+}
+
+
+bool Config::GetPinThreads() const
+{
+    return pinThreads;
+}
+
+
+double Config::GetBNNThinningTolerance() const
+{
+    return thinningTolerance;
+}
+
+
+unsigned Config::GetBNNThinningEvents() const
+{
+    return thinningEvents;
+}
+
+
+Config::Distillation const & Config::GetDistillation() const
+{
+    return distillation;
+}
+
+
 unsigned Config::GetBNNMCMCIterations() const
 {
     return numberIterations;
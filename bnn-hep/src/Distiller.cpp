@@ -0,0 +1,236 @@
+#include "Distiller.hpp"
+#include "utility.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+
+using namespace logger;
+using std::vector;
+
+
+// The parameters of the student are kept in a single vector in the order: weights of the hidden
+//layer (by neuron), biases of the hidden layer, weights of the output neuron, its bias
+
+
+Distiller::Distiller(Logger &log_, Config const &config_, InputProcessor const &inputProcessor_,
+ vector<NeuralNetwork> const &nets_):
+    log(log_), config(config_), inputProcessor(inputProcessor_), nets(nets_),
+    dim(inputProcessor.GetDim()), nNeurons(config.GetDistillation().numberNeurons),
+    student(vector<unsigned>({dim, nNeurons, 1})), deviation(0.)
+{
+    Logger::PhaseTimer timer(log, "distillation");
+    
+    PrepareEvents();
+    Train();
+    
+    log << info(1) << "The ensemble is distilled into a network with " << nNeurons <<
+     " neurons. The RMS deviation of its output on " << weights.size() - nFitEvents <<
+     " test events is " << deviation << "." << eom;
+}
+
+
+void Distiller::PrepareEvents()
+{
+    Logger::PhaseTimer timer(log, "distillation events");
+    
+    // Take the events held out from the training set (if any) and complement them with events
+    //from the training set
+    vars = inputProcessor.GetHeldOutVars();
+    weights = inputProcessor.GetHeldOutWeights();
+    
+    unsigned long const maxEvents = config.GetDistillation().maxEvents;
+    
+    if (weights.size() < maxEvents)
+        inputProcessor.SampleTrainingSet(maxEvents - weights.size(), vars, weights);
+    
+    
+    // Shuffle the events so that both the fit and the test events are representative
+    unsigned long const nEvents = weights.size();
+    vector<unsigned long> order(nEvents);
+    
+    for (unsigned long i = 0; i < nEvents; ++i)
+        order[i] = i;
+    
+    std::random_shuffle(order.begin(), order.end(), RandomInt);
+    
+    vector<double> shuffledVars(vars.size());
+    vector<double> shuffledWeights(nEvents);
+    
+    for (unsigned long i = 0; i < nEvents; ++i)
+    {
+        std::copy(&vars[order[i] * dim], &vars[order[i] * dim] + dim, &shuffledVars[i * dim]);
+        shuffledWeights[i] = weights[order[i]];
+    }
+    
+    vars.swap(shuffledVars);
+    weights.swap(shuffledWeights);
+    nFitEvents = nEvents - nEvents / 10;
+    
+    
+    // The targets are the averaged outputs of the ensemble
+    targets.assign(nEvents, 0.);
+    
+    for (auto const &net: nets)
+        for (unsigned long e = 0; e < nEvents; ++e)
+            targets[e] += *net.Apply(&vars[e * dim]);
+    
+    for (auto &t: targets)
+        t /= nets.size();
+}
+
+
+double Distiller::ApplyStudent(vector<double> const &params, double const *eventVars,
+ vector<double> &hidden) const
+{
+    double const *w = params.data();
+    double const *b = w + nNeurons * dim;
+    double const *v = b + nNeurons;
+    double output = v[nNeurons];
+    
+    for (unsigned j = 0; j < nNeurons; ++j)
+    {
+        double sum = b[j];
+        
+        for (unsigned k = 0; k < dim; ++k)
+            sum += w[j * dim + k] * eventVars[k];
+        
+        hidden[j] = std::tanh(sum);
+        output += v[j] * hidden[j];
+    }
+    
+    return 1. / (1. + std::exp(-output));
+}
+
+
+void Distiller::Train()
+{
+    Config::Distillation const &par = config.GetDistillation();
+    unsigned const nParams = nNeurons * dim + 2 * nNeurons + 1;
+    vector<double> params(nParams, 0.);
+    
+    double *w = params.data();
+    double *b = w + nNeurons * dim;
+    double *v = b + nNeurons;
+    
+    
+    // Start from the last network of the ensemble. The additional neurons get small random weights
+    //in the hidden layer and zero weights in the output layer, so they do not change the output
+    //at the start
+    NeuralNetwork last(nets.back());
+    unsigned const nNeuronsEnsemble = config.GetBNNNumberNeurons();
+    
+    for (unsigned j = 0; j < nNeurons; ++j)
+    {
+        if (j < nNeuronsEnsemble)
+        {
+            for (unsigned k = 0; k < dim; ++k)
+                w[j * dim + k] = last.GetWeight(1, j, k);
+            
+            b[j] = last.GetBias(1, j);
+            v[j] = last.GetWeight(2, 0, j);
+        }
+        else
+            for (unsigned k = 0; k < dim; ++k)
+                w[j * dim + k] = randGen.Gaus(0., 0.1 / std::sqrt(double(dim)));
+    }
+    
+    v[nNeurons] = last.GetBias(2, 0);
+    
+    
+    // Fit the parameters with mini-batch Adam
+    double const beta1 = 0.9, beta2 = 0.999;
+    double b1t = 1., b2t = 1.;
+    vector<double> grad(nParams), m(nParams, 0.), s(nParams, 0.), hidden(nNeurons);
+    vector<unsigned long> order(nFitEvents);
+    
+    for (unsigned long i = 0; i < nFitEvents; ++i)
+        order[i] = i;
+    
+    for (unsigned epoch = 0; epoch < par.epochs; ++epoch)
+    {
+        std::random_shuffle(order.begin(), order.end(), RandomInt);
+        
+        for (unsigned long start = 0; start < nFitEvents; start += par.batchSize)
+        {
+            unsigned long const end = std::min(start + par.batchSize, nFitEvents);
+            std::fill(grad.begin(), grad.end(), 0.);
+            double sumWeights = 0.;
+            
+            // Gradient of the weighted cross entropy summed over the mini-batch
+            for (unsigned long i = start; i < end; ++i)
+            {
+                unsigned long const e = order[i];
+                double const *eventVars = &vars[e * dim];
+                double const delta = weights[e] *
+                 (ApplyStudent(params, eventVars, hidden) - targets[e]);
+                
+                double *gw = grad.data();
+                double *gb = gw + nNeurons * dim;
+                double *gv = gb + nNeurons;
+                
+                for (unsigned j = 0; j < nNeurons; ++j)
+                {
+                    gv[j] += delta * hidden[j];
+                    double const dh = delta * v[j] * (1. - hidden[j] * hidden[j]);
+                    gb[j] += dh;
+                    
+                    for (unsigned k = 0; k < dim; ++k)
+                        gw[j * dim + k] += dh * eventVars[k];
+                }
+                
+                gv[nNeurons] += delta;
+                sumWeights += weights[e];
+            }
+            
+            // Update the parameters
+            b1t *= beta1;
+            b2t *= beta2;
+            
+            for (unsigned p = 0; p < nParams; ++p)
+            {
+                double const g = grad[p] / sumWeights;
+                m[p] = beta1 * m[p] + (1. - beta1) * g;
+                s[p] = beta2 * s[p] + (1. - beta2) * g * g;
+                params[p] -= par.stepsize * m[p] / (1. - b1t) /
+                 (std::sqrt(s[p] / (1. - b2t)) + 1e-8);
+            }
+        }
+    }
+    
+    
+    // Copy the parameters to the student network
+    for (unsigned j = 0; j < nNeurons; ++j)
+    {
+        student.SetWeights(1, j, &w[j * dim]);
+        student.GetBias(1, j) = b[j];
+        student.GetWeight(2, 0, j) = v[j];
+    }
+    
+    student.GetBias(2, 0) = v[nNeurons];
+    
+    
+    // Measure the deviation from the ensemble on the test events
+    double sumDev2 = 0., sumWeights = 0.;
+    
+    for (unsigned long e = nFitEvents; e < weights.size(); ++e)
+    {
+        double const d = *student.Apply(&vars[e * dim]) - targets[e];
+        sumDev2 += weights[e] * d * d;
+        sumWeights += weights[e];
+    }
+    
+    deviation = (sumWeights > 0.) ? std::sqrt(sumDev2 / sumWeights) : 0.;
+}
+
+
+NeuralNetwork const & Distiller::GetStudent() const
+{
+    return student;
+}
+
+
+double Distiller::GetDeviation() const
+{
+    return deviation;
+}
@@ -11,9 +11,10 @@ using namespace logger;
 using namespace std;
 
 
-FBMWrapper::FBMWrapper(Logger &log_, Config const &config_, InputProcessor const &inputProcessor_):
+FBMWrapper::FBMWrapper(Logger &log_, Config const &config_, InputProcessor const &inputProcessor_,
+ unsigned nThreads_ /*= 0*/):
     log(log_), config(config_), inputProcessor(inputProcessor_),
-    FBMPath(config.GetFBMPath()), BNNFileName(config.GetBNNFileName())
+    FBMPath(config.GetFBMPath()), BNNFileName(config.GetBNNFileName()), nThreads(nThreads_)
 {
     log << info(1) << "Training started. FBM binary file: \"" << config.GetBNNFileName() << "\"." <<
      eom;
@@ -25,7 +26,10 @@ FBMWrapper::FBMWrapper(Logger &log_, Config const &config_, InputProcessor const
     NNArchitecture.push_back(1);
     
     // Perform training
-    TrainBNN();
+    {
+        Logger::PhaseTimer timer(log, "FBMWrapper");
+        TrainBNN();
+    }
     
     log << info(1) << "Training is completed." << eom;
 }
@@ -37,6 +41,18 @@ FBMWrapper::~FBMWrapper()
     {
         remove(BNNFileName.c_str());
         log << info(2) << "Temporary file \"" << BNNFileName << "\" removed." << eom;
+        
+        // Log files of the replicas in parallel tempering are named by appending ".pt0",
+        //".pt1", etc. to the name of the BNN file
+        for (unsigned i = 0; ; ++i)
+        {
+            string const replicaFileName = BNNFileName + ".pt" + to_string(i);
+            
+            if (remove(replicaFileName.c_str()) != 0)
+                break;
+            
+            log << info(2) << "Temporary file \"" << replicaFileName << "\" removed." << eom;
+        }
     }
 }
 
@@ -46,41 +62,38 @@ void FBMWrapper::TrainBNN() const
     ostringstream command;  // stream to keep system commands
     string const &trainFileName = inputProcessor.GetTrainFileName();
     
-    int exitCode;
+    // The programs that loop over the training set in parallel can have their threads bound to
+    //cores, spread over the NUMA nodes. The number of threads is limited when trainings share the
+    //cores in the batch mode, and then the threads are not bound since the trainings running at
+    //the same time would be bound to the same cores
+    string threadPrefix;
+    
+    if (nThreads > 0)
+    {
+        threadPrefix = "OMP_NUM_THREADS=" + to_string(nThreads) + " ";
+        
+        if (config.GetPinThreads())
+            log << warning << "The threads of FBM programs are not bound to cores since their " <<
+             "number is limited." << eom;
+    }
+    else if (config.GetPinThreads())
+        threadPrefix = "OMP_PROC_BIND=spread OMP_PLACES=cores ";
     
     
     // Define the network
     command << FBMPath << "net-spec " << BNNFileName << " " << inputProcessor.GetDim() << " " <<
      config.GetBNNNumberNeurons() << " 1 / " << config.GetBNNHyperparameters();
-    exitCode = system(command.str().c_str());
-    
-    if (exitCode != 0)
-    {
-        log << critical << "\"" << command.str() << "\" terminated with an error." << eom;
-        exit(1);
-    }
+    Execute(command.str(), "net-spec");
     
     // Reset the random seed
     command.str("");
     command << FBMPath << "rand-seed " << BNNFileName << " " << RandomInt(32767);
-    exitCode = system(command.str().c_str());
-    
-    if (exitCode != 0)
-    {
-        log << critical << "\"" << command.str() << "\" terminated with an error." << eom;
-        exit(1);
-    }
+    Execute(command.str(), "rand-seed");
     
     // Define the model
     command.str("");
     command << FBMPath << "model-spec " << BNNFileName << " binary";
-    exitCode = system(command.str().c_str());
-    
-    if (exitCode != 0)
-    {
-        log << critical << "\"" << command.str() << "\" terminated with an error." << eom;
-        exit(1);
-    }
+    Execute(command.str(), "model-spec");
     
     // Define the training data
     command.str("");
@@ -101,48 +114,72 @@ void FBMWrapper::TrainBNN() const
     command << " &> /dev/null";
     
     // No transformation of the variables is specified in data-spec, i.e. they are tacken as is
-    exitCode = system(command.str().c_str());
+    Execute(command.str(), "data-spec");
     
-    if (exitCode != 0)
+    // The schedule for parallel tempering must be given before any network is generated
+    if (not config.GetBNNTemperingSchedule().empty())
     {
-        log << critical << "\"" << command.str() << "\" terminated with an error." << eom;
-        exit(1);
+        command.str("");
+        command << FBMPath << "mc-temp-sched " << BNNFileName << " " <<
+         config.GetBNNTemperingSchedule();
+        Execute(command.str(), "mc-temp-sched");
     }
     
     // Generate the initial neural network
     command.str("");
     command << FBMPath << "net-gen " << BNNFileName << " " << config.GetBNNGenerationParameters();
-    exitCode = system(command.str().c_str());
+    Execute(command.str(), "net-gen");
     
-    if (exitCode != 0)
+    // Optimise the initial network so that the sampling starts close to the mode of the
+    //posterior and a shorter burn-in is needed
+    if (not config.GetBNNWarmStartParameters().empty())
     {
-        log << critical << "\"" << command.str() << "\" terminated with an error." << eom;
-        exit(1);
+        command.str("");
+        command << threadPrefix << FBMPath << "net-opt " << BNNFileName << " " <<
+         config.GetBNNWarmStartParameters();
+        Execute(command.str(), "warm start");
     }
     
     auto MCMCParams = config.GetBNNMCMCParameters();
     
+    // net-mc may be run as several MPI processes, each holding a shard of the training set
+    string const MPIPrefix = (config.GetMPICommand().empty()) ? "" :
+     config.GetMPICommand() + " ";
+    
     // Treat the first training iteration in a special way
     command.str("");
     command << FBMPath << "mc-spec " << BNNFileName << " " << MCMCParams.first << "; ";
-    command << FBMPath << "net-mc " << BNNFileName << " 1";
-    exitCode = system(command.str().c_str());
-    
-    if (exitCode != 0)
-    {
-        log << critical << "\"" << command.str() << "\" terminated with an error." << eom;
-        exit(1);
-    }
+    command << threadPrefix << MPIPrefix << FBMPath << "net-mc " << BNNFileName << " 1";
+    Execute(command.str(), "first iteration");
     
     // Perform the training
     command.str("");
     command << FBMPath << "mc-spec " << BNNFileName << " " << MCMCParams.second << "; ";
-    command << FBMPath << "net-mc " << BNNFileName << " " << config.GetBNNMCMCIterations();
-    exitCode = system(command.str().c_str());
+    
+    if (config.GetBNNTemperingSchedule().empty())
+        command << threadPrefix << MPIPrefix << FBMPath << "net-mc " << BNNFileName << " " <<
+         config.GetBNNMCMCIterations();
+    else
+        // Replicas at all the temperatures are run in parallel, the one at the inverse
+        //temperature of one stays in the BNN file
+        command << threadPrefix << FBMPath << "net-pt " << BNNFileName << " " <<
+         config.GetBNNMCMCIterations() << " " << config.GetBNNTemperingSwapInterval();
+    
+    Execute(command.str(), "sampling");
+}
+
+
+void FBMWrapper::Execute(string const &command, string const &phaseName) const
+{
+    Logger::PhaseTimer timer(log, phaseName);
+    
+    // The messages still queued in the logger must not be interleaved with the output of FBM
+    log.Flush();
+    int const exitCode = system(command.c_str());
     
     if (exitCode != 0)
     {
-        log << critical << "\"" << command.str() << "\" terminated with an error." << eom;
+        log << critical << "\"" << command << "\" terminated with an error." << eom;
         exit(1);
     }
 }
@@ -9,25 +9,91 @@
 #include <TTree.h>
 #include <TFriendElement.h>
 
+#include <boost/filesystem.hpp>
+
 #include <algorithm>
+#include <iterator>
 #include <map>
+#include <set>
 #include <sstream>
+#include <fstream>
+#include <iomanip>
 #include <cstdio>
+#include <cstdint>
+#include <cmath>
+#include <thread>
+#include <atomic>
+#include <limits>
 
 
 using namespace std;
 
 
+// Identifies the format of the cache files. Must be changed whenever the format or the
+//preprocessing itself is changed
+char const cacheMagic[8] = {'B', 'N', 'N', 'C', 'A', 'C', 'H', '2'};
+
+
+// Calculates 64-bit FNV-1a hash of the string. Unlike std::hash, the result does not depend on
+//the standard library implementation
+uint64_t hashFNV(string const &text)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    
+    for (unsigned char const c: text)
+    {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    
+    return hash;
+}
+
+
+// Describes the state of a file on disk to include it in the cache key
+string describeFile(string const &fileName)
+{
+    boost::system::error_code ec;
+    ostringstream ost;
+    ost << fileName << ":" << boost::filesystem::file_size(fileName, ec) << ":" <<
+     boost::filesystem::last_write_time(fileName, ec);
+    
+    return ost.str();
+}
+
+
 unsigned InputProcessor::Event::nVars = 0;
 
 
-InputProcessor::InputProcessor(Logger &log_, Config const &config_):
-    log(log_), config(config_),
-    trainingFileName(config.GetTaskName() + "_trainFile_" + GetRandomName() + ".root")
+InputProcessor::InputProcessor(Logger &log_, Config const &config_,
+ unsigned nThreads_ /*= 0*/):
+    log(log_), config(config_), nThreads(nThreads_),
+    trainingFileName(config.GetTaskName() + "_trainFile_" + GetRandomName() + ".root"),
+    trainEventsFileName(config.GetTaskName() + "_trainEvents.txt")
 {
-    // All the processing is actually done here
-    BuildTrainingSet();
-    TransformInputs();
+    Logger::PhaseTimer timer(log, "InputProcessor");
+    
+    if (config.GetCacheDir().length() > 0)
+        cacheFileName = config.GetCacheDir() + ComputeCacheKey() + ".cache";
+    
+    // All the processing is actually done here. The ingestion and preprocessing are skipped if
+    //the result is found in the cache
+    if (not ReadCache())
+    {
+        BuildTrainingSet();
+        TransformInputs();
+        
+        if (config.GetCoresetFactor() > 1.)
+            CompressTrainingSet();
+        
+        WriteCache();
+    }
+    
+    // The events to thin the ensemble are taken out after the cache is written so that the cache
+    //does not depend on the thinning
+    if (config.GetBNNThinningTolerance() > 0.)
+        HoldOutEvents();
+    
     WriteTrainFile();
 }
 
@@ -57,9 +123,30 @@ void InputProcessor::BuildTrainingSet()
     map<string, vector<unsigned long>> trainEventsIndices;
     
     
-    // Loop over all the input samples
-    for (Config::Sample const &sample : config.GetSamples())
+    // If the first transformation is the standardization, the moments of the input variables are
+    //accumulated while the events are read, which saves a pass over the training set. They are
+    //kept separately for the two classes because the classes are reweighted differently
+    auto const &transformCodes = config.GetTransformations();
+    bool const accumulateMoments = (not transformCodes.empty() and
+     transformCodes.front() == Config::InputTransformation::Standard);
+    vector<MomentAccumulator> classMoments[2];
+    
+    if (accumulateMoments)
+    {
+        classMoments[0].resize(Event::nVars);
+        classMoments[1].resize(Event::nVars);
+    }
+    
+    
+    // Loop over all the input samples. The events remember their sample and their index in the
+    //source tree
+    auto const &samples = config.GetSamples();
+    
+    for (unsigned iSample = 0; iSample < samples.size(); ++iSample)
     {
+        Config::Sample const &sample = samples[iSample];
+        Logger::PhaseTimer sampleTimer(log, "sample " + sample.fileName);
+        
         // Open the file and construct the source tree
         TFile srcFile(sample.fileName.c_str());
         
@@ -139,7 +226,7 @@ void InputProcessor::BuildTrainingSet()
                 Double_t const weightValue = weight->EvalInstance();
                 
                 if (weightValue != 0.)
-                    localTrainingSet.emplace_back(sample.type, weightValue, vars);
+                    localTrainingSet.emplace_back(sample.type, weightValue, vars, iSample, ev);
             }
             
             nEventsTriedForTraining = eventsForTraining.size();
@@ -217,7 +304,8 @@ void InputProcessor::BuildTrainingSet()
                 Double_t const weightValue = weight->EvalInstance();
                 
                 if (weightValue != 0.)
-                    localTrainingSet.emplace_back(sample.type, weightValue, vars);
+                    localTrainingSet.emplace_back(sample.type, weightValue, vars, iSample,
+                     eventsToRead.at(nEntriesRead));
                 
                 ++nEntriesRead;
                 
@@ -247,11 +335,21 @@ void InputProcessor::BuildTrainingSet()
         
         
         // Not all the events in the sample will be used for training. Hence the weights should be
-        //corrected
+        //corrected. The moments of the sample are accumulated in the same loop and then merged
+        //into the ones of its class
         double const weightCorrFactor = double(nEntries) / nEventsTriedForTraining;
+        vector<MomentAccumulator> sampleMoments(accumulateMoments ? Event::nVars : 0);
         
         for (Event &event : localTrainingSet)
+        {
             event.weight *= weightCorrFactor;
+            
+            for (unsigned i = 0; i < sampleMoments.size(); ++i)
+                sampleMoments[i].Add(event.weight, event.vars[i]);
+        }
+        
+        for (unsigned i = 0; i < sampleMoments.size(); ++i)
+            classMoments[sample.type][i].Merge(sampleMoments[i]);
         
         
         // Sort the vector of indices of events tried for training
@@ -266,8 +364,7 @@ void InputProcessor::BuildTrainingSet()
     
     // Now write indices of events tried for training to a text file. First, create an object to
     //manage the writing
-    TrainEventList writeTrainEvents(config.GetTaskName() + "_trainEvents.txt",
-     TrainEventList::Mode::Write);
+    TrainEventList writeTrainEvents(trainEventsFileName, TrainEventList::Mode::Write);
     
     // Loop over the map with vectors of indices of events tried for training and write them to the
     //file
@@ -293,32 +390,37 @@ void InputProcessor::BuildTrainingSet()
     }
     
     // Loop again and rescale the weights
+    double corrFactors[2] = {1., 1.};
+    
     switch (config.GetReweightingType())
     {
         case Config::Reweighting::OneToOne:
-        {
-            double const corrFactors[2] =
-             {0.5 * nEvents / sumWeights[0], 0.5 * nEvents / sumWeights[1]};
-            
-            for (Event &event : trainingSet)
-                event.weight *= corrFactors[event.type];
-        }
-        break;
+            corrFactors[0] = 0.5 * nEvents / sumWeights[0];
+            corrFactors[1] = 0.5 * nEvents / sumWeights[1];
+            break;
         
         case Config::Reweighting::Common:
-        {
-            double const corrFactor = nEvents / (sumWeights[0] + sumWeights[1]);
-            
-            for (Event &event : trainingSet)
-                event.weight *= corrFactor;
-        }
-        break;
+            corrFactors[0] = corrFactors[1] = nEvents / (sumWeights[0] + sumWeights[1]);
+            break;
         
         default:
             // This should never happen
             break;
     }
-            
+    
+    for (Event &event : trainingSet)
+        event.weight *= corrFactors[event.type];
+    
+    
+    // The moments of the classes are rescaled in the same way and combined
+    if (accumulateMoments)
+    {
+        ingestMoments.assign(Event::nVars, MomentAccumulator());
+        
+        for (unsigned type = 0; type < 2; ++type)
+            for (unsigned i = 0; i < Event::nVars; ++i)
+                ingestMoments[i].Merge(classMoments[type][i], corrFactors[type]);
+    }
     
     
     log << info(2) << "The events for training set (" << trainingSet.size() << " in total) are " <<
@@ -328,9 +430,8 @@ void InputProcessor::BuildTrainingSet()
 }
 
 
-void InputProcessor::TransformInputs()
+void InputProcessor::CreateTransformations()
 {
-    // Create the transformations
     for (auto const &code : config.GetTransformations())
         switch (code)
         {
@@ -350,21 +451,50 @@ void InputProcessor::TransformInputs()
                 // This should never be executed
                 break;
         }
+}
+
+
+void InputProcessor::TransformInputs()
+{
+    // Create the transformations
+    CreateTransformations();
     
     
     //TODO: Check the list for pathologies, i.e. applying PCA without gaussianisation.
     
     
     // Loop over all the transformations
+    unsigned transformIndex = 0;
+    
     for (auto &transform : transforms)
     {
-        // Loop over the training set to build the transformation
-        for (auto const &event : trainingSet)
-            transform->AddEvent(event.weight, event.vars);
+        std::ostringstream phaseName;
+        phaseName << "transformation " << transformIndex++;
         
-        transform->BuildTransformation();
+        // Loop over the training set to build the transformation. The standardization applied
+        //first uses the moments accumulated while the training set was read instead
+        {
+            Logger::PhaseTimer buildTimer(log, phaseName.str() + " build");
+            
+            TransformPCA *pca = dynamic_cast<TransformPCA *>(transform);
+            
+            if (transform == transforms.front() and not ingestMoments.empty())
+            {
+                dynamic_cast<TransformStandard *>(transform)->MergeMoments(ingestMoments);
+                ingestMoments.clear();
+            }
+            else if (pca != nullptr)
+                pca->MergeMoments(AccumulateCovariance());
+            else
+                for (auto const &event : trainingSet)
+                    transform->AddEvent(event.weight, event.vars);
+            
+            transform->BuildTransformation();
+        }
         
         // Loop over the training set again and apply the transformation
+        Logger::PhaseTimer applyTimer(log, phaseName.str() + " apply");
+        
         for (auto &event : trainingSet)
             transform->ApplyTransformation(event.vars);
     }
@@ -373,8 +503,665 @@ void InputProcessor::TransformInputs()
 }
 
 
+void InputProcessor::CompressTrainingSet()
+{
+    Logger::PhaseTimer timer(log, "coreset");
+    unsigned long const nOriginal = trainingSet.size();
+    unsigned const nVars = Event::nVars;
+    
+    
+    // Identical events are adjacent once the training set is sorted by the type and the variables
+    trainingSet.sort([nVars](Event const &a, Event const &b)
+    {
+        if (a.type != b.type)
+            return (a.type < b.type);
+        
+        return lexicographical_compare(a.vars, a.vars + nVars, b.vars, b.vars + nVars);
+    });
+    
+    for (auto event = trainingSet.begin(); event != trainingSet.end(); )
+    {
+        auto next = std::next(event);
+        
+        if (next != trainingSet.end() and next->type == event->type and
+         equal(event->vars, event->vars + nVars, next->vars))
+        {
+            event->weight += next->weight;
+            trainingSet.erase(next);
+        }
+        else
+            event = next;
+    }
+    
+    unsigned long const nMerged = trainingSet.size();
+    unsigned long nDraws = ceil(nOriginal / config.GetCoresetFactor());
+    log << info(2) << nOriginal - nMerged << " events are merged with identical ones." << eom;
+    
+    if (nDraws >= nMerged)
+    {
+        log << info(1) << "The training set is compressed from " << nOriginal << " to " <<
+         nMerged << " events by merging identical events." << eom;
+        return;
+    }
+    
+    
+    // Compute the sensitivities of the events within their classes. Half of the probability is
+    //distributed according to the absolute weights and the other half according to the weighted
+    //squared distances to the mean of the class
+    vector<Event *> events;
+    events.reserve(nMerged);
+    
+    for (auto &event: trainingSet)
+        events.push_back(&event);
+    
+    vector<double> prob(nMerged);
+    unsigned long classBegin[3] = {0, 0, nMerged};  // the events are sorted by the type
+    
+    while (classBegin[1] < nMerged and events[classBegin[1]]->type == 0)
+        ++classBegin[1];
+    
+    for (unsigned type = 0; type < 2; ++type)
+    {
+        vector<double> mean(nVars, 0.);
+        double sumAbsW = 0., sumD = 0.;
+        
+        for (unsigned long i = classBegin[type]; i < classBegin[type + 1]; ++i)
+        {
+            sumAbsW += fabs(events[i]->weight);
+            
+            for (unsigned v = 0; v < nVars; ++v)
+                mean[v] += fabs(events[i]->weight) * events[i]->vars[v];
+        }
+        
+        for (unsigned v = 0; v < nVars; ++v)
+            mean[v] /= sumAbsW;
+        
+        for (unsigned long i = classBegin[type]; i < classBegin[type + 1]; ++i)
+        {
+            double d2 = 0.;
+            
+            for (unsigned v = 0; v < nVars; ++v)
+                d2 += (events[i]->vars[v] - mean[v]) * (events[i]->vars[v] - mean[v]);
+            
+            prob[i] = fabs(events[i]->weight) * d2;
+            sumD += prob[i];
+        }
+        
+        for (unsigned long i = classBegin[type]; i < classBegin[type + 1]; ++i)
+            prob[i] = 0.5 * fabs(events[i]->weight) / sumAbsW +
+             ((sumD > 0.) ? 0.5 * prob[i] / sumD : 0.5 * fabs(events[i]->weight) / sumAbsW);
+    }
+    
+    
+    // The validation models are logistic regressions with random parameters. The inputs are
+    //already preprocessed, so parameters of unit scale give outputs of order one
+    unsigned const nModels = 8;
+    vector<double> theta(nModels * (nVars + 1));
+    
+    for (auto &t: theta)
+        t = randGen.Gaus(0., 1. / sqrt(nVars + 1.));
+    
+    auto logLikelihood = [&](vector<double> const &weights, vector<double> &result)
+    {
+        result.assign(nModels, 0.);
+        
+        for (unsigned long i = 0; i < nMerged; ++i)
+        {
+            if (weights[i] == 0.)
+                continue;
+            
+            for (unsigned m = 0; m < nModels; ++m)
+            {
+                double const *t = &theta[m * (nVars + 1)];
+                double a = t[nVars];
+                
+                for (unsigned v = 0; v < nVars; ++v)
+                    a += t[v] * events[i]->vars[v];
+                
+                // log(sigmoid(+-a)) computed without overflow
+                double const z = (events[i]->type == 1) ? a : -a;
+                result[m] += weights[i] * ((z > 0.) ? -log1p(exp(-z)) : z - log1p(exp(z)));
+            }
+        }
+    };
+    
+    vector<double> fullWeights(nMerged), refLL, coreLL;
+    
+    for (unsigned long i = 0; i < nMerged; ++i)
+        fullWeights[i] = events[i]->weight;
+    
+    logLikelihood(fullWeights, refLL);
+    
+    
+    // Draw the events with systematic resampling, separately in each class, and correct the
+    //weights. The weights of each class are then rescaled to keep their sum, unless the sum of the
+    //drawn weights is degenerate or of the wrong sign, which can happen with negative weights. If
+    //the log-likelihood of the validation models changes too much, the size of the coreset is
+    //doubled
+    vector<double> coreWeights(nMerged);
+    double maxDeviation = 0.;
+    
+    for (; nDraws < nMerged; nDraws *= 2)
+    {
+        fill(coreWeights.begin(), coreWeights.end(), 0.);
+        
+        for (unsigned type = 0; type < 2; ++type)
+        {
+            unsigned long const nClass = classBegin[type + 1] - classBegin[type];
+            unsigned long const nClassDraws = max(nDraws * nClass / nMerged, 1ul);
+            double const step = 1. / nClassDraws;
+            double u = randGen.Rndm() * step, cumProb = 0.;
+            double sumW = 0., sumAbsW = 0., sumCoreW = 0.;
+            
+            for (unsigned long i = classBegin[type]; i < classBegin[type + 1]; ++i)
+            {
+                cumProb += prob[i];
+                
+                for (; u < cumProb; u += step)
+                    coreWeights[i] += events[i]->weight / (nClassDraws * prob[i]);
+                
+                sumW += events[i]->weight;
+                sumAbsW += fabs(events[i]->weight);
+                sumCoreW += coreWeights[i];
+            }
+            
+            if (sumW * sumCoreW > 0. and fabs(sumW) > 1e-6 * sumAbsW and
+             fabs(sumCoreW) > 1e-6 * sumAbsW)
+                for (unsigned long i = classBegin[type]; i < classBegin[type + 1]; ++i)
+                    coreWeights[i] *= sumW / sumCoreW;
+        }
+        
+        logLikelihood(coreWeights, coreLL);
+        maxDeviation = 0.;
+        
+        for (unsigned m = 0; m < nModels; ++m)
+            maxDeviation = max(maxDeviation, fabs(coreLL[m] - refLL[m]) /
+             max(fabs(refLL[m]), numeric_limits<double>::min()));
+        
+        if (maxDeviation <= config.GetCoresetTolerance())
+            break;
+    }
+    
+    if (nDraws >= nMerged)
+    {
+        log << warning << "The training set cannot be compressed further than by merging " <<
+         "identical events within the tolerance on the log-likelihood." << eom;
+        return;
+    }
+    
+    
+    // Keep only the drawn events
+    unsigned long index = 0;
+    
+    for (auto event = trainingSet.begin(); event != trainingSet.end(); ++index)
+    {
+        if (coreWeights[index] == 0.)
+            event = trainingSet.erase(event);
+        else
+        {
+            event->weight = coreWeights[index];
+            ++event;
+        }
+    }
+    
+    log << info(1) << "The training set is compressed from " << nOriginal << " to " <<
+     trainingSet.size() << " events. The largest relative change in the log-likelihood of the " <<
+     "validation models is " << maxDeviation << "." << eom;
+}
+
+
+CovarianceAccumulator InputProcessor::AccumulateCovariance() const
+{
+    // Split the training set into contiguous chunks of a fixed size, so that the order of the
+    //merges below does not depend on the machine
+    unsigned long const chunkSize = 65536;
+    vector<list<Event>::const_iterator> boundaries;
+    unsigned long index = 0;
+    
+    for (auto it = trainingSet.cbegin(); it != trainingSet.cend(); ++it, ++index)
+        if (index % chunkSize == 0)
+            boundaries.push_back(it);
+    
+    boundaries.push_back(trainingSet.cend());
+    
+    
+    // The chunks are processed by a pool of threads limited by the number of cores available.
+    //Each worker takes the next chunk that has not been started yet
+    unsigned const nChunks = boundaries.size() - 1;
+    unsigned const nCores = (nThreads > 0) ? nThreads : max(thread::hardware_concurrency(), 1u);
+    unsigned const nWorkers = min(nCores, nChunks);
+    vector<CovarianceAccumulator> partial(nChunks, CovarianceAccumulator(Event::nVars));
+    atomic<unsigned> nextChunk(0);
+    vector<thread> workers;
+    
+    for (unsigned w = 0; w < nWorkers; ++w)
+        workers.emplace_back([&boundaries, &partial, &nextChunk, nChunks]()
+        {
+            for (unsigned c = nextChunk++; c < nChunks; c = nextChunk++)
+                for (auto it = boundaries[c]; it != boundaries[c + 1]; ++it)
+                    partial[c].Add(it->weight, it->vars);
+        });
+    
+    for (auto &w: workers)
+        w.join();
+    
+    
+    // The partial results are merged in the order of the chunks
+    CovarianceAccumulator result(Event::nVars);
+    
+    for (auto const &p: partial)
+        result.Merge(p);
+    
+    return result;
+}
+
+
+string InputProcessor::DescribeTrainingSet(Config const &config)
+{
+    ostringstream description;
+    description.write(cacheMagic, sizeof(cacheMagic));
+    description << "\nvariables:";
+    
+    for (auto const &var: config.GetVariables())
+        description << " " << var << ";";
+    
+    for (Config::Sample const &sample: config.GetSamples())
+    {
+        description << "\nsample: " << sample.type << "; " << describeFile(sample.fileName) <<
+         ";";
+        
+        for (auto const &tree: sample.trees)
+            description << " " << tree << ";";
+        
+        description << " " << sample.trainWeight << "; " << sample.maxTrainEvents << "; " <<
+         setprecision(10) << sample.maxFractionTrainEvents << ";";
+        
+        if (sample.trainEventsFileName.length() > 0)
+            description << " " << describeFile(sample.trainEventsFileName) << ";";
+    }
+    
+    description << "\nreweighting: " << int(config.GetReweightingType()) << "\npreprocessing:";
+    
+    for (auto const &code: config.GetTransformations())
+        description << " " << int(code);
+    
+    if (config.GetCoresetFactor() > 1.)
+        description << "\ncoreset: " << setprecision(10) << config.GetCoresetFactor() << "; " <<
+         config.GetCoresetTolerance();
+    
+    return description.str();
+}
+
+
+string InputProcessor::ComputeCacheKey() const
+{
+    // Convert the hash to a hexadecimal string. The task name is not included so that the tasks of
+    //a scan, which differ in the task names, share the cache file
+    ostringstream key;
+    key << hex << setw(16) << setfill('0') << hashFNV(DescribeTrainingSet(config));
+    
+    return key.str();
+}
+
+
+string InputProcessor::GetTrainingSetKey(Config const &config)
+{
+    // The held-out events are taken out of the training set after the cache is written, so they
+    //are not included in the description used for the cache
+    ostringstream key;
+    key << DescribeTrainingSet(config);
+    
+    if (config.GetBNNThinningTolerance() > 0.)
+        key << "\nthinning: " << setprecision(10) << config.GetBNNThinningTolerance() << "; " <<
+         config.GetBNNThinningEvents();
+    
+    return key.str();
+}
+
+
+bool InputProcessor::ReadCache()
+{
+    if (cacheFileName.length() == 0)
+        return false;
+    
+    Logger::PhaseTimer timer(log, "read cache");
+    ifstream cacheFile(cacheFileName, ios::binary);
+    
+    if (not cacheFile.good())
+    {
+        log << info(2) << "The training set is not found in the cache. It will be built from " <<
+         "scratch." << eom;
+        return false;
+    }
+    
+    
+    // The sizes read from the file are checked against the number of bytes left in it so that a
+    //corrupted file does not lead to huge allocations
+    cacheFile.seekg(0, ios::end);
+    streamoff const fileSize = cacheFile.tellg();
+    cacheFile.seekg(0, ios::beg);
+    
+    auto const bytesLeft = [&cacheFile, fileSize]() -> ULong64_t
+    {
+        streamoff const position = cacheFile.tellg();
+        return (position < 0 or position > fileSize) ? 0 : fileSize - position;
+    };
+    
+    
+    // Check the header
+    char magic[sizeof(cacheMagic)];
+    UInt_t nVars;
+    ULong64_t nEvents;
+    
+    cacheFile.read(magic, sizeof(magic));
+    cacheFile.read(reinterpret_cast<char *>(&nVars), sizeof(nVars));
+    cacheFile.read(reinterpret_cast<char *>(&nEvents), sizeof(nEvents));
+    
+    if (not cacheFile.good() or not equal(magic, magic + sizeof(magic), cacheMagic) or
+     nVars != config.GetVariables().size())
+    {
+        log << warning << "Cache file \"" << cacheFileName << "\" has an unexpected format and " <<
+         "is ignored." << eom;
+        return false;
+    }
+    
+    if (nEvents > bytesLeft() /
+     (2 * sizeof(UInt_t) + sizeof(ULong64_t) + sizeof(Double_t) * (nVars + 1)))
+    {
+        log << warning << "Cache file \"" << cacheFileName << "\" is corrupted and is ignored." <<
+         eom;
+        return false;
+    }
+    
+    
+    // Read the columns: the types, the source samples and entries, the weights, and then each of
+    //the variables
+    vector<UInt_t> types(nEvents), sampleIndices(nEvents);
+    vector<ULong64_t> entries(nEvents);
+    vector<Double_t> weights(nEvents);
+    vector<Double_t> columns(nVars * nEvents);
+    
+    cacheFile.read(reinterpret_cast<char *>(types.data()), sizeof(UInt_t) * nEvents);
+    cacheFile.read(reinterpret_cast<char *>(sampleIndices.data()), sizeof(UInt_t) * nEvents);
+    cacheFile.read(reinterpret_cast<char *>(entries.data()), sizeof(ULong64_t) * nEvents);
+    cacheFile.read(reinterpret_cast<char *>(weights.data()), sizeof(Double_t) * nEvents);
+    cacheFile.read(reinterpret_cast<char *>(columns.data()), sizeof(Double_t) * nVars * nEvents);
+    
+    
+    // Restore the transformations
+    UInt_t nTransforms;
+    cacheFile.read(reinterpret_cast<char *>(&nTransforms), sizeof(nTransforms));
+    
+    bool good = (cacheFile.good() and nTransforms == config.GetTransformations().size());
+    Event::nVars = nVars;
+    
+    if (good)
+    {
+        CreateTransformations();
+        
+        for (auto &transform: transforms)
+            if (not transform->LoadState(cacheFile))
+            {
+                good = false;
+                break;
+            }
+    }
+    
+    
+    // Read the list of events tried for training
+    ULong64_t listLength = 0;
+    cacheFile.read(reinterpret_cast<char *>(&listLength), sizeof(listLength));
+    
+    if (listLength > bytesLeft())
+        good = false;
+    
+    string trainEventsList(good ? listLength : 0, '\0');
+    
+    if (good)
+        cacheFile.read(&trainEventsList[0], listLength);
+    
+    if (not good or not cacheFile.good())
+    {
+        log << warning << "Cache file \"" << cacheFileName << "\" is corrupted and is ignored." <<
+         eom;
+        
+        for (auto const &t: transforms)
+            delete t;
+        
+        transforms.clear();
+        return false;
+    }
+    
+    
+    // Everything is read. Fill the training set
+    vector<Double_t> vars(nVars);
+    
+    for (unsigned long i = 0; i < nEvents; ++i)
+    {
+        for (unsigned iVar = 0; iVar < nVars; ++iVar)
+            vars[iVar] = columns[iVar * nEvents + i];
+        
+        trainingSet.emplace_back(types[i], weights[i], vars, sampleIndices[i], entries[i]);
+    }
+    
+    
+    // The list of events tried for training is needed by the user to build the exam set
+    ofstream trainEventsFile(trainEventsFileName);
+    trainEventsFile << trainEventsList;
+    
+    
+    log << info(1) << "The preprocessed training set (" << trainingSet.size() << " events) is " <<
+     "read from cache file \"" << cacheFileName << "\"." << eom;
+    log << info(0) << "The indices of the events tried for training are written in file \"" <<
+     trainEventsFileName << "\"." << eom;
+    
+    return true;
+}
+
+
+void InputProcessor::WriteCache() const
+{
+    if (cacheFileName.length() == 0)
+        return;
+    
+    Logger::PhaseTimer timer(log, "write cache");
+    
+    
+    // Several jobs of a scan might write the same cache file simultaneously. Write to a unique
+    //temporary file and then rename it since the renaming is atomic
+    string const tmpFileName(cacheFileName + "." + GetRandomName(false, 6) + ".tmp");
+    ofstream cacheFile(tmpFileName, ios::binary);
+    
+    UInt_t const nVars = Event::nVars;
+    ULong64_t const nEvents = trainingSet.size();
+    
+    cacheFile.write(cacheMagic, sizeof(cacheMagic));
+    cacheFile.write(reinterpret_cast<char const *>(&nVars), sizeof(nVars));
+    cacheFile.write(reinterpret_cast<char const *>(&nEvents), sizeof(nEvents));
+    
+    
+    // Write the training set in columns
+    vector<UInt_t> types, sampleIndices;
+    vector<ULong64_t> entries;
+    vector<Double_t> column;
+    types.reserve(nEvents);
+    sampleIndices.reserve(nEvents);
+    entries.reserve(nEvents);
+    column.reserve(nEvents);
+    
+    for (auto const &event: trainingSet)
+    {
+        types.push_back(event.type);
+        sampleIndices.push_back(event.sample);
+        entries.push_back(event.entry);
+    }
+    
+    cacheFile.write(reinterpret_cast<char const *>(types.data()), sizeof(UInt_t) * nEvents);
+    cacheFile.write(reinterpret_cast<char const *>(sampleIndices.data()), sizeof(UInt_t) * nEvents);
+    cacheFile.write(reinterpret_cast<char const *>(entries.data()), sizeof(ULong64_t) * nEvents);
+    
+    for (auto const &event: trainingSet)
+        column.push_back(event.weight);
+    
+    cacheFile.write(reinterpret_cast<char const *>(column.data()), sizeof(Double_t) * nEvents);
+    
+    for (unsigned iVar = 0; iVar < nVars; ++iVar)
+    {
+        column.clear();
+        
+        for (auto const &event: trainingSet)
+            column.push_back(event.vars[iVar]);
+        
+        cacheFile.write(reinterpret_cast<char const *>(column.data()), sizeof(Double_t) * nEvents);
+    }
+    
+    
+    // Write the transformations
+    UInt_t const nTransforms = transforms.size();
+    cacheFile.write(reinterpret_cast<char const *>(&nTransforms), sizeof(nTransforms));
+    
+    for (auto const &transform: transforms)
+        transform->SaveState(cacheFile);
+    
+    
+    // Copy the list of events tried for training
+    ifstream trainEventsFile(trainEventsFileName);
+    ostringstream trainEventsList;
+    trainEventsList << trainEventsFile.rdbuf();
+    
+    string const listText(trainEventsList.str());
+    ULong64_t const listLength = listText.length();
+    cacheFile.write(reinterpret_cast<char const *>(&listLength), sizeof(listLength));
+    cacheFile.write(listText.data(), listLength);
+    
+    
+    cacheFile.close();
+    
+    if (not cacheFile.good() or std::rename(tmpFileName.c_str(), cacheFileName.c_str()) != 0)
+    {
+        log << warning << "Failed to write cache file \"" << cacheFileName << "\"." << eom;
+        std::remove(tmpFileName.c_str());
+        return;
+    }
+    
+    log << info(2) << "The preprocessed training set is written in cache file \"" <<
+     cacheFileName << "\"." << eom;
+}
+
+
+void InputProcessor::HoldOutEvents()
+{
+    unsigned long nHeldOut = config.GetBNNThinningEvents();
+    
+    // Do not take too many events from the training set
+    if (nHeldOut > trainingSet.size() / 5)
+    {
+        nHeldOut = trainingSet.size() / 5;
+        log << warning << "The training set is too small; only " << nHeldOut << " events are " <<
+         "held out to thin the ensemble." << eom;
+    }
+    
+    
+    // Choose the events at random
+    vector<unsigned long> indices(trainingSet.size());
+    
+    for (unsigned long i = 0; i < indices.size(); ++i)
+        indices[i] = i;
+    
+    std::random_shuffle(indices.begin(), indices.end(), RandomInt);
+    
+    vector<bool> isHeldOut(trainingSet.size(), false);
+    
+    for (unsigned long i = 0; i < nHeldOut; ++i)
+        isHeldOut[indices[i]] = true;
+    
+    
+    // Move the chosen events from the training set, remembering where they come from
+    heldOutVars.reserve(nHeldOut * Event::nVars);
+    heldOutWeights.reserve(nHeldOut);
+    vector<pair<UInt_t, ULong64_t>> heldOutSources;
+    heldOutSources.reserve(nHeldOut);
+    unsigned long index = 0;
+    
+    for (auto event = trainingSet.begin(); event != trainingSet.end(); ++index)
+    {
+        if (isHeldOut[index])
+        {
+            heldOutVars.insert(heldOutVars.end(), event->vars, event->vars + Event::nVars);
+            heldOutWeights.push_back(event->weight);
+            heldOutSources.emplace_back(event->sample, event->entry);
+            event = trainingSet.erase(event);
+        }
+        else
+            ++event;
+    }
+    
+    log << info(2) << heldOutWeights.size() << " events are held out from the training set to " <<
+     "thin the ensemble." << eom;
+    
+    
+    // The held-out events are not used for training, so they are removed from the list of events
+    //tried for training and go back to the exam set. An event is kept in the list if the same
+    //source event is still in the training set (e.g. it passes both the signal and the background
+    //selections)
+    auto const &samples = config.GetSamples();
+    map<string, set<unsigned long>> heldOutEntries;
+    
+    for (auto const &source: heldOutSources)
+        heldOutEntries[samples.at(source.first).fileName].insert(source.second);
+    
+    for (auto const &event: trainingSet)
+    {
+        auto const res = heldOutEntries.find(samples.at(event.sample).fileName);
+        
+        if (res != heldOutEntries.end())
+            res->second.erase(event.entry);
+    }
+    
+    map<string, vector<unsigned long>> trainEventsIndices;
+    unsigned long nReturned = 0;
+    
+    {
+        TrainEventList readTrainEvents(trainEventsFileName, TrainEventList::Mode::Read);
+        
+        for (auto const &sample: samples)
+        {
+            if (trainEventsIndices.count(sample.fileName) > 0 or
+             not readTrainEvents.ReadList(sample.fileName))
+                continue;
+            
+            auto const &heldOut = heldOutEntries[sample.fileName];
+            auto &trainListCurFile = trainEventsIndices[sample.fileName];
+            
+            for (auto const &ev: readTrainEvents.GetReadEvents())
+                if (heldOut.count(ev) == 0)
+                    trainListCurFile.push_back(ev);
+            
+            // The list for a file must not be empty
+            if (trainListCurFile.empty())
+                trainListCurFile = readTrainEvents.GetReadEvents();
+            
+            nReturned += readTrainEvents.GetReadEvents().size() - trainListCurFile.size();
+        }
+    }
+    
+    TrainEventList writeTrainEvents(trainEventsFileName, TrainEventList::Mode::Write);
+    
+    for (auto const &val : trainEventsIndices)
+        writeTrainEvents.WriteList(val.first, val.second.begin(), val.second.end());
+    
+    log << info(2) << nReturned << " held-out events are removed from the list of events tried " <<
+     "for training and can be used in the exam set." << eom;
+    
+    if (nReturned < nHeldOut)
+        log << info(1) << nHeldOut - nReturned << " held-out events remain in the list of " <<
+         "events tried for training and are used neither for training nor in the exam set." << eom;
+}
+
+
 void InputProcessor::WriteTrainFile() const
 {
+    Logger::PhaseTimer timer(log, "write training file");
     TFile outFile(trainingFileName.c_str(), "recreate");
     TTree *outTree = new TTree("Vars", "Tree containing the training set");
     
@@ -428,3 +1215,74 @@ list<TransformBase *> const & InputProcessor::GetTransformations() const
 {
     return transforms;
 }
+
+
+void InputProcessor::WriteTrainEventsFile(string const &taskName, Logger &taskLog) const
+{
+    string const fileName(taskName + "_trainEvents.txt");
+    
+    // The file for the task of this object has been written already
+    if (fileName != trainEventsFileName)
+    {
+        ifstream srcFile(trainEventsFileName);
+        ofstream dstFile(fileName);
+        dstFile << srcFile.rdbuf();
+        dstFile.close();
+        
+        if (not srcFile.good() or not dstFile.good())
+        {
+            taskLog << error << "Failed to copy the list of the events tried for training from " <<
+             "file \"" << trainEventsFileName << "\" to file \"" << fileName << "\"." << eom;
+            exit(1);
+        }
+    }
+    
+    taskLog << info(0) << "The indices of the events tried for training are written in file \"" <<
+     fileName << "\"." << eom;
+}
+
+
+void InputProcessor::SampleTrainingSet(unsigned long nEvents, vector<Double_t> &vars,
+ vector<Double_t> &weights) const
+{
+    // Choose the events at random
+    vector<bool> isChosen(trainingSet.size(), (nEvents >= trainingSet.size()));
+    
+    if (nEvents < trainingSet.size())
+    {
+        vector<unsigned long> indices(trainingSet.size());
+        
+        for (unsigned long i = 0; i < indices.size(); ++i)
+            indices[i] = i;
+        
+        std::random_shuffle(indices.begin(), indices.end(), RandomInt);
+        
+        for (unsigned long i = 0; i < nEvents; ++i)
+            isChosen[indices[i]] = true;
+    }
+    
+    
+    // Copy them
+    unsigned long index = 0;
+    
+    for (auto const &event: trainingSet)
+    {
+        if (isChosen[index++])
+        {
+            vars.insert(vars.end(), event.vars, event.vars + Event::nVars);
+            weights.push_back(event.weight);
+        }
+    }
+}
+
+
+vector<Double_t> const & InputProcessor::GetHeldOutVars() const
+{
+    return heldOutVars;
+}
+
+
+vector<Double_t> const & InputProcessor::GetHeldOutWeights() const
+{
+    return heldOutWeights;
+}
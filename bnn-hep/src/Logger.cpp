@@ -1,24 +1,64 @@
 #include "Logger.hpp"
 
 #include <ctime>
+#include <sys/resource.h>
 
 
 using namespace logger;
 
 
+// Returns the CPU time (user and system) spent by the process and its terminated children, s
+double GetCPUTime()
+{
+    rusage selfUsage, childrenUsage;
+    getrusage(RUSAGE_SELF, &selfUsage);
+    getrusage(RUSAGE_CHILDREN, &childrenUsage);
+    
+    double time = 0.;
+    
+    for (rusage const *u: {&selfUsage, &childrenUsage})
+        time += u->ru_utime.tv_sec + u->ru_stime.tv_sec +
+         1e-6 * (u->ru_utime.tv_usec + u->ru_stime.tv_usec);
+    
+    return time;
+}
+
+
+std::atomic<unsigned long> Logger::nextId(0);
+thread_local std::map<unsigned long, Logger::MessageState> Logger::states;
+thread_local unsigned long Logger::lastId = -1;
+thread_local Logger::MessageState *Logger::lastState = nullptr;
+
+
+Logger::MessageState::MessageState():
+    messageClass(MessageClass::Undefined),
+    verbosity(0),
+    toStd(false),
+    toFile(false),
+    time(0),
+    lastProgress()
+{}
+
+
 Logger::Logger(unsigned stdVerbLevel_):
     stdVerbLevel(stdVerbLevel_),
     fileVerbLevel(0),
     file(nullptr),
-    curMessageClass(MessageClass::Undefined),
-    curVerbosity(0),
-    printTimestamp(false)
+    printTimestamp(false),
+    progressInterval(std::chrono::steady_clock::duration(std::chrono::seconds(1)).count()),
+    wallTimeOnly(false),
+    id(nextId++),
+    writing(false),
+    stopWriter(false)
 {
     textMessageTypes[MessageClass::Info] = "INFO";
     textMessageTypes[MessageClass::Warning] = "WARNING";
     textMessageTypes[MessageClass::Error] = "ERROR";
     textMessageTypes[MessageClass::CriticalError] = "CRITICAL ERROR";
+    textMessageTypes[MessageClass::Progress] = "PROGRESS";
     textMessageTypes[MessageClass::Undefined] = "UNDEFINED";
+    
+    writer = std::thread(&Logger::WriteMessages, this);
 }
 
 
@@ -26,51 +66,107 @@ Logger::Logger(unsigned stdVerbLevel_, unsigned fileVerbLevel_, std::string cons
     stdVerbLevel(stdVerbLevel_),
     fileVerbLevel(fileVerbLevel_),
     file(new std::ofstream(fileName)),
-    curMessageClass(MessageClass::Undefined),
-    curVerbosity(0),
-    printTimestamp(false)
+    printTimestamp(false),
+    progressInterval(std::chrono::steady_clock::duration(std::chrono::seconds(1)).count()),
+    wallTimeOnly(false),
+    id(nextId++),
+    writing(false),
+    stopWriter(false)
 {
     textMessageTypes[MessageClass::Info] = "INFO";
     textMessageTypes[MessageClass::Warning] = "WARNING";
     textMessageTypes[MessageClass::Error] = "ERROR";
     textMessageTypes[MessageClass::CriticalError] = "CRITICAL ERROR";
+    textMessageTypes[MessageClass::Progress] = "PROGRESS";
     textMessageTypes[MessageClass::Undefined] = "UNDEFINED";
-
+    
+    writer = std::thread(&Logger::WriteMessages, this);
 }
 // Looks like constructor delegation is not supported in GCC 4.6 =(
 
 
 Logger::~Logger()
 {
+    // The writer thread empties the queue before it stops
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        stopWriter = true;
+    }
+    
+    queueCondition.notify_one();
+    writer.join();
+    
     if (file)
         file->close();
     
     delete file;
+    
+    // Only the state of the calling thread can be released here. The states in the other threads
+    //are not reused since each logger has an own identifier
+    states.erase(id);
+    
+    if (lastId == id)
+    {
+        lastId = -1;
+        lastState = nullptr;
+    }
 }
 
 
 Logger& Logger::operator<<(EndOfMessage__ (*)())
 {
-    // Write the new line symbols
-    if (curVerbosity < stdVerbLevel)
-    {
-        if (curMessageClass == MessageClass::Error or
-         curMessageClass == MessageClass::CriticalError)
-            std::cerr << '\n';
-        else
-            std::cout << '\n';
-    }
+    MessageState &state = GetState();
     
-    if (curVerbosity < fileVerbLevel and file)
+    if (state.toStd or state.toFile)
     {
-        *file << '\n';
-        file->flush();
+        Record record;
+        record.toStdErr = (state.messageClass == MessageClass::Error or
+         state.messageClass == MessageClass::CriticalError);
+        std::string const &type = textMessageTypes.at(state.messageClass);
+        std::string const text = state.text.str();
+        
+        if (state.toStd)
+            record.stdText = type + ": " + text + '\n';
+        
+        if (state.toFile)
+        {
+            record.fileText = "[" + type + "]";
+            
+            // Add the timestamp. The format is the one of std::asctime, which is not thread-safe
+            if (printTimestamp)
+            {
+                std::tm timeinfo;
+                char buffer[64];
+                localtime_r(&state.time, &timeinfo);
+                std::strftime(buffer, sizeof(buffer), "\t%a %b %e %H:%M:%S %Y\n", &timeinfo);
+                record.fileText += buffer;
+            }
+            else
+                record.fileText += ' ';
+            
+            record.fileText += text + '\n';
+        }
+        
+        bool const isError = record.toStdErr;
+        
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            queue.push_back(std::move(record));
+        }
+        
+        queueCondition.notify_one();
+        
+        // The program usually terminates right after an error, so it must not stay in the queue
+        if (isError)
+            Flush();
     }
     
     
     // Set the message type and verbosity to the default values
-    curMessageClass = MessageClass::Undefined;
-    curVerbosity = 0;
+    state.messageClass = MessageClass::Undefined;
+    state.verbosity = 0;
+    state.toStd = state.toFile = false;
+    state.text.str("");
     
     
     return *this;
@@ -79,12 +175,7 @@ Logger& Logger::operator<<(EndOfMessage__ (*)())
 
 Logger& Logger::operator<<(MessageType__ type)
 {
-    // Set the properties of the current message
-    curMessageClass = type.type;
-    curVerbosity = type.verbosity;
-    
-    PrintHeader();
-    
+    StartMessage(type);
     return *this;
 }
 
@@ -92,17 +183,18 @@ Logger& Logger::operator<<(MessageType__ type)
 Logger& Logger::operator<<(MessageType__ (*fp)(unsigned))
 {
     // Evaluate the manipulator (which is implemented as a function) at the default verbosity
-    MessageType__ type = fp(0);
-    
-    curMessageClass = type.type;
-    curVerbosity = type.verbosity;
-    
-    PrintHeader();
-    
+    StartMessage(fp(0));
     return *this;
 }
 
 
+void Logger::Flush()
+{
+    std::unique_lock<std::mutex> lock(queueMutex);
+    idleCondition.wait(lock, [this]{return queue.empty() and not writing;});
+}
+
+
 void Logger::PrintTimestamp(bool on /*= true*/)
 {
     printTimestamp = on;
@@ -121,38 +213,182 @@ void Logger::SetFileVerbosity(unsigned fileVerbLevel_)
 }
 
 
-void Logger::PrintHeader()
+void Logger::SetProgressInterval(double seconds)
+{
+    progressInterval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+     std::chrono::duration<double>(seconds)).count();
+}
+
+
+void Logger::SetWallTimeOnly(bool on)
+{
+    wallTimeOnly = on;
+}
+
+
+Logger::MessageState &Logger::GetState()
 {
-    if (curMessageClass == MessageClass::Undefined)
+    // Usually a thread works with a single logger, so the map is rarely looked up
+    if (lastId != id)
+    {
+        lastState = &states[id];
+        lastId = id;
+    }
+    
+    return *lastState;
+}
+
+
+void Logger::StartMessage(MessageType__ type)
+{
+    if (type.type == MessageClass::Undefined)
         throw std::logic_error("The type of a message for logging was not specified");
     
+    MessageState &state = GetState();
+    state.messageClass = type.type;
+    state.verbosity = type.verbosity;
+    state.toStd = (type.verbosity < stdVerbLevel);
+    state.toFile = (type.verbosity < fileVerbLevel and file);
     
-    // Print the type
-    if (curVerbosity < stdVerbLevel)
+    // A progress message that follows the previous one too closely is dropped, and the following
+    //parts of it are not even formatted
+    if (type.type == MessageClass::Progress and (state.toStd or state.toFile))
     {
-        if (curMessageClass == MessageClass::Error or
-         curMessageClass == MessageClass::CriticalError)
-            std::cerr << textMessageTypes[curMessageClass] << ": ";
+        auto const now = std::chrono::steady_clock::now();
+        
+        if (state.lastProgress != std::chrono::steady_clock::time_point() and
+         now - state.lastProgress < std::chrono::steady_clock::duration(progressInterval.load()))
+            state.toStd = state.toFile = false;
         else
-            std::cout << textMessageTypes[curMessageClass] << ": ";
+            state.lastProgress = now;
     }
     
-    if (curVerbosity < fileVerbLevel and file)
+    if (state.toFile and printTimestamp)
+        state.time = std::time(nullptr);
+}
+
+
+void Logger::WriteMessages()
+{
+    std::unique_lock<std::mutex> lock(queueMutex);
+    
+    while (true)
     {
-        *file << "[" << textMessageTypes[curMessageClass] << "]";
+        queueCondition.wait(lock, [this]{return stopWriter or not queue.empty();});
+        
+        if (queue.empty())
+            break;
         
-        // Print the timestamp
-        if (printTimestamp)
+        // Take all the queued messages and write them out without holding the lock, so that the
+        //threads ending messages are not blocked meanwhile. The streams are flushed once per batch
+        std::deque<Record> batch;
+        batch.swap(queue);
+        writing = true;
+        lock.unlock();
+        
+        bool usedStdOut = false;
+        
+        for (auto const &r: batch)
         {
-            std::time_t rawtime;
-            struct std::tm *timeinfo;
-            
-            std::time(&rawtime);
-            timeinfo = std::localtime(&rawtime);
+            if (not r.stdText.empty())
+            {
+                if (r.toStdErr)
+                    std::cerr << r.stdText;
+                else
+                {
+                    std::cout << r.stdText;
+                    usedStdOut = true;
+                }
+            }
             
-            *file << '\t' << std::asctime(timeinfo);  // it adds a newline
+            if (not r.fileText.empty())
+                *file << r.fileText;
         }
+        
+        if (usedStdOut)
+            std::cout.flush();
+        
+        if (file)
+            file->flush();
+        
+        lock.lock();
+        writing = false;
+        idleCondition.notify_all();
+    }
+}
+
+
+void Logger::WritePhaseSummary(std::string const &fileName) const
+{
+    std::lock_guard<std::mutex> lock(phasesMutex);
+    std::ofstream summary(fileName);
+    summary << "phase,depth,wall_s,cpu_s,peak_rss_kB,children_peak_rss_kB\n";
+    
+    for (auto const &p: phases)
+    {
+        summary << "\"" << p.name << "\"," << p.depth << "," << p.wallTime << ",";
+        
+        // The fields for the whole process are left empty when they are not meaningful
+        if (wallTimeOnly)
+            summary << ",,\n";
         else
-            *file << ' ';
+            summary << p.cpuTime << "," << p.peakRSS << "," << p.childPeakRSS << '\n';
     }
 }
+
+
+Logger::PhaseTimer::PhaseTimer(Logger &log_, std::string const &name):
+    log(log_)
+{
+    // The name is qualified with the names of the enclosing phases in the same thread
+    std::vector<std::string> &openPhases = log.GetState().openPhases;
+    std::string fullName;
+    
+    for (auto const &p: openPhases)
+        fullName += p + "/";
+    
+    fullName += name;
+    
+    {
+        std::lock_guard<std::mutex> lock(log.phasesMutex);
+        index = log.phases.size();
+        log.phases.push_back(PhaseRecord{fullName, unsigned(openPhases.size()), 0., 0., 0, 0});
+    }
+    
+    openPhases.push_back(name);
+    
+    startCPU = GetCPUTime();
+    startWall = std::chrono::steady_clock::now();
+}
+
+
+Logger::PhaseTimer::~PhaseTimer()
+{
+    auto const endWall = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(log.phasesMutex);
+    PhaseRecord &record = log.phases.at(index);
+    
+    record.wallTime = std::chrono::duration<double>(endWall - startWall).count();
+    record.cpuTime = GetCPUTime() - startCPU;
+    
+    // ru_maxrss is measured in kilobytes on Linux
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    record.peakRSS = usage.ru_maxrss;
+    getrusage(RUSAGE_CHILDREN, &usage);
+    record.childPeakRSS = usage.ru_maxrss;
+    
+    // The record is copied since the vector can be reallocated by other threads
+    PhaseRecord const result = record;
+    lock.unlock();
+    
+    log.GetState().openPhases.pop_back();
+    
+    if (log.wallTimeOnly)
+        log << info(2) << "Phase \"" << result.name << "\" took " << result.wallTime <<
+         " s (wall time)." << eom;
+    else
+        log << info(2) << "Phase \"" << result.name << "\" took " << result.wallTime <<
+         " s (CPU " << result.cpuTime << " s), peak RSS " << result.peakRSS / 1024 << " MB (" <<
+         result.childPeakRSS / 1024 << " MB in child processes)." << eom;
+}
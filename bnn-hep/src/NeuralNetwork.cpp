@@ -24,15 +24,16 @@ NeuralNetwork::NeuralNetwork(std::vector<unsigned> const &nNodes_):
 {}
 
 
-NeuralNetwork::NeuralNetwork(NeuralNetwork const &nn)
+NeuralNetwork::NeuralNetwork(NeuralNetwork const &nn):
+    nLayers(0), nNodes(nullptr), biases(nullptr), weights(nullptr),
+    layerOutputs(nullptr), isClassification(nn.isClassification)
 {
     SetArchitecture(nn.nLayers, nn.nNodes);
-    isClassification = nn.isClassification;
     
     // Copy the biases and weights
     for (unsigned l = 1; l < nLayers; ++l)
     {
-        std::copy(nn.biases[l - 1], nn.biases[l - 1] + nn.nLayers, biases[l - 1]);
+        std::copy(nn.biases[l - 1], nn.biases[l - 1] + nNodes[l], biases[l - 1]);
         
         for (unsigned n = 0; n < nNodes[l]; ++n)
             std::copy(nn.weights[l - 1][n], nn.weights[l - 1][n] + nn.nNodes[l - 1],
@@ -43,12 +44,13 @@ NeuralNetwork::NeuralNetwork(NeuralNetwork const &nn)
 
 NeuralNetwork::NeuralNetwork(NeuralNetwork &&nn):
     nLayers(nn.nLayers), nNodes(nn.nNodes), biases(nn.biases), weights(nn.weights),
-    layerOutputs(nullptr), isClassification(nn.isClassification)
+    layerOutputs(nn.layerOutputs), isClassification(nn.isClassification)
 {
     nn.nLayers = 0;
     nn.nNodes = nullptr;
     nn.biases = nullptr;
     nn.weights = nullptr;
+    nn.layerOutputs = nullptr;
 }
 
 
@@ -67,7 +69,7 @@ NeuralNetwork const & NeuralNetwork::operator=(NeuralNetwork const &nn)
     // Copy the biases and weights
     for (unsigned l = 1; l < nLayers; ++l)
     {
-        std::copy(nn.biases[l - 1], nn.biases[l - 1] + nn.nLayers, biases[l - 1]);
+        std::copy(nn.biases[l - 1], nn.biases[l - 1] + nNodes[l], biases[l - 1]);
         
         for (unsigned n = 0; n < nNodes[l]; ++n)
             std::copy(nn.weights[l - 1][n], nn.weights[l - 1][n] + nn.nNodes[l - 1],
@@ -111,7 +113,9 @@ void NeuralNetwork::SetArchitecture(unsigned nLayers_, unsigned const *nNodes_)
             maxNNodes = nNodes[l];
     }
     
-    layerOutputs = new double[maxNNodes];
+    // Two buffers are needed to evaluate the network: for the outputs of the previous and the
+    //current layers
+    layerOutputs = new double[2 * maxNNodes];
 }
 
 
@@ -176,9 +180,14 @@ void NeuralNetwork::SetWeights(unsigned layer, unsigned node, std::vector<double
 
 
 double const * NeuralNetwork::Apply(double const *vars) const
-// CAVEAT: This does not work correctly: layerOutput is spoiled while it is still needed!
 {
-    std::copy(vars, vars + nNodes[0], layerOutputs);
+    // The outputs of the previous and the current layers are kept in the two halves of
+    //layerOutputs, which are swapped after each layer
+    unsigned const maxNNodes = *std::max_element(nNodes, nNodes + nLayers);
+    double *in = layerOutputs;
+    double *out = layerOutputs + maxNNodes;
+    
+    std::copy(vars, vars + nNodes[0], in);
     
     // Evaluate the output layer-by-layer
     for (unsigned l = 1; l < nLayers; ++l)
@@ -188,21 +197,23 @@ double const * NeuralNetwork::Apply(double const *vars) const
             double sum = biases[l - 1][n];
             
             for (unsigned np = 0; np < nNodes[l - 1]; ++np)  // iterate over the previous layer
-                sum += layerOutputs[np] * weights[l - 1][n][np];
+                sum += in[np] * weights[l - 1][n][np];
             
             if (l == nLayers - 1)  // the activation function is not applied to be output layer
-                layerOutputs[n] = sum;
+                out[n] = sum;
             else
-                layerOutputs[n] = std::tanh(sum);
+                out[n] = std::tanh(sum);
         }
+        
+        std::swap(in, out);
     }
     
     // Transfrom the outputs
     if (isClassification)
         for (unsigned n = 0; n < nNodes[nLayers - 1]; ++n)
-            layerOutputs[n] = 1. / (1 + std::exp(-layerOutputs[n]));
+            in[n] = 1. / (1 + std::exp(-in[n]));
     
-    return layerOutputs;
+    return in;
 }
 
 
@@ -246,14 +257,14 @@ double & NeuralNetwork::GetBias(unsigned layer, unsigned node)
 }
 
 
-void NeuralNetwork::WriteClass(std::ostream &outStream) const
+void NeuralNetwork::WriteClass(std::ostream &outStream, std::string const &className) const
 {
     // Write the short class description
     outStream <<
-     "class NN\n" <<
+     "class " << className << "\n" <<
      "{\n" <<
      "\tpublic:\n" <<
-     "\t\tNN();\n" << "\t\n" <<
+     "\t\t" << className << "();\n" << "\t\n" <<
      "\tpublic:\n";
     
     for (unsigned l = 1; l < nLayers; ++l)
@@ -279,20 +290,21 @@ void NeuralNetwork::WriteClass(std::ostream &outStream) const
     
     
     // Define the methods
-    outStream << "NN::NN()\n{}\n\n\n";
+    outStream << className << "::" << className << "()\n{}\n\n\n";
     
     for (unsigned l = 1; l < nLayers; ++l)
     {
         outStream <<
-         "void NN::SetWeightsL" << l << "(Double_t const weights[" << nNodes[l] << "][" <<
-          nNodes[l - 1] << "])\n" <<
+         "void " << className << "::SetWeightsL" << l << "(Double_t const weights[" <<
+          nNodes[l] << "][" << nNodes[l - 1] << "])\n" <<
          "{\n" <<
          "\tfor (unsigned n = 0; n < " << nNodes[l] << "; ++n)\n" <<
          "\t\tfor (unsigned np = 0; np < " << nNodes[l- 1] << "; ++np)\n" <<
          "\t\t\tweightsL" << l << "[n][np] = weights[n][np];\n" <<
          "}\n\n\n";
         outStream <<
-         "void NN::SetBiasesL" << l << "(Double_t const biases[" << nNodes[l] << "])\n" <<
+         "void " << className << "::SetBiasesL" << l << "(Double_t const biases[" <<
+          nNodes[l] << "])\n" <<
          "{\n" <<
          "\tstd::copy(biases, biases + " << nNodes[l] << ", biasesL" << l << ");\n" <<
          "}\n\n\n";
@@ -300,7 +312,7 @@ void NeuralNetwork::WriteClass(std::ostream &outStream) const
     
     // The Apply() method is the most complex one
     outStream <<
-     "Double_t const * NN::Apply(Double_t const *vars) const\n" <<
+     "Double_t const * " << className << "::Apply(Double_t const *vars) const\n" <<
      "{\n" <<
      "\tstd::copy(vars, vars + " << nNodes[0] << ", bufferIn);\n\t\n";
     
@@ -36,3 +36,32 @@ void TransformBase::ApplyTransformation(Double_t *vars)
     
     ApplyTransformationImp(vars);
 }
+
+
+bool TransformBase::WriteFusedCode(std::ostream &/*outStream*/, std::string const &/*postfix*/,
+ TransformBase const &/*previous*/) const
+{
+    return false;
+}
+
+
+void TransformBase::SaveState(std::ostream &outStream) const
+{
+    if (not transformationBuilt)
+        throw std::logic_error("TransformBase::SaveState: The transformation is not built yet.");
+    
+    SaveStateImp(outStream);
+}
+
+
+bool TransformBase::LoadState(std::istream &inStream)
+{
+    if (transformationBuilt)
+        throw std::logic_error("TransformBase::LoadState: The trasformation is already built.");
+    
+    if (not LoadStateImp(inStream))
+        return false;
+    
+    transformationBuilt = true;
+    return true;
+}
@@ -247,3 +247,42 @@ void TransformGauss::ApplyTransformationImp(Double_t *vars)
         vars[iVar] = M_SQRT2 * TMath::ErfInverse(2. * cumulative - 1.);
     }
 }
+
+
+void TransformGauss::SaveStateImp(std::ostream &outStream) const
+{
+    for (auto const &t: singleTrans)
+    {
+        outStream.write(reinterpret_cast<char const *>(&t.cdfBins), sizeof(UInt_t));
+        outStream.write(reinterpret_cast<char const *>(t.x), sizeof(Double_t) * t.cdfBins);
+        outStream.write(reinterpret_cast<char const *>(t.cdf), sizeof(Double_t) * t.cdfBins);
+    }
+}
+
+
+bool TransformGauss::LoadStateImp(std::istream &inStream)
+{
+    for (auto &t: singleTrans)
+    {
+        inStream.read(reinterpret_cast<char *>(&t.cdfBins), sizeof(UInt_t));
+        
+        if (not inStream.good())
+            return false;
+        
+        delete [] t.x;
+        delete [] t.cdf;
+        t.x = new Double_t[t.cdfBins];
+        t.cdf = new Double_t[t.cdfBins];
+        
+        inStream.read(reinterpret_cast<char *>(t.x), sizeof(Double_t) * t.cdfBins);
+        inStream.read(reinterpret_cast<char *>(t.cdf), sizeof(Double_t) * t.cdfBins);
+        
+        // The accumulators are not needed since the transformation is restored
+        delete t.accum;
+        t.accum = nullptr;
+        delete t.range;
+        t.range = nullptr;
+    }
+    
+    return inStream.good();
+}
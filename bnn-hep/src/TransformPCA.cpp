@@ -1,32 +1,270 @@
 #include "TransformPCA.hpp"
+#include "TransformStandard.hpp"
+#include "TransformGauss.hpp"
+
+#include <TMatrixDSym.h>
+#include <TMatrixDSymEigen.h>
+
+#include <cmath>
+#include <stdexcept>
 
 
 using namespace logger;
 
 
-TransformPCA::TransformPCA(Logger &log_, unsigned dim_):
-    TransformBase(log, dim)
+CovarianceAccumulator::CovarianceAccumulator(unsigned dim_ /*= 0*/):
+    dim(dim_), sumW(0.), mean(dim), comoment(dim * dim), delta(dim)
+{}
+
+
+void CovarianceAccumulator::Add(Double_t w, Double_t const *x)
 {
-    log << error << "Principal component analysis is not implemented yet." << eom;
-    exit(1);
+    sumW += w;
+    
+    // With delta being the deviation from the old mean, the co-moments grow by
+    //w * (1 - w / sumW) * delta_i * delta_j
+    Double_t const r = w / sumW;
+    Double_t const c = w * (1. - r);
+    
+    for (unsigned i = 0; i < dim; ++i)
+    {
+        delta[i] = x[i] - mean[i];
+        mean[i] += r * delta[i];
+    }
+    
+    for (unsigned i = 0; i < dim; ++i)
+    {
+        Double_t const cd = c * delta[i];
+        Double_t *row = &comoment[i * dim];
+        
+        for (unsigned j = i; j < dim; ++j)
+            row[j] += cd * delta[j];
+    }
 }
 
 
-TransformPCA::~TransformPCA() noexcept
-{}
+void CovarianceAccumulator::Merge(CovarianceAccumulator const &other, Double_t scale)
+{
+    Double_t const otherSumW = other.sumW * scale;
+    
+    if (otherSumW == 0.)
+        return;
+    
+    Double_t const newSumW = sumW + otherSumW;
+    Double_t const c = sumW * otherSumW / newSumW;
+    
+    for (unsigned i = 0; i < dim; ++i)
+        delta[i] = other.mean[i] - mean[i];
+    
+    for (unsigned i = 0; i < dim; ++i)
+        for (unsigned j = i; j < dim; ++j)
+            comoment[i * dim + j] += other.comoment[i * dim + j] * scale + c * delta[i] * delta[j];
+    
+    for (unsigned i = 0; i < dim; ++i)
+        mean[i] += delta[i] * otherSumW / newSumW;
+    
+    sumW = newSumW;
+}
 
 
-void TransformPCA::WriteCode(std::ostream &/*outStream*/, std::string const &/*postfix*/) const
-{}
+Double_t CovarianceAccumulator::GetCovariance(unsigned i, unsigned j) const
+{
+    return (i <= j) ? comoment[i * dim + j] / sumW : comoment[j * dim + i] / sumW;
+}
 
 
-void TransformPCA::AddEventImp(Double_t /*weight*/, Double_t const */*vars*/)
+TransformPCA::TransformPCA(Logger &log_, unsigned dim_):
+    TransformBase(log_, dim_), accum(dim), shift(dim), matrix(dim * dim), buffer(dim)
 {}
 
 
+void TransformPCA::WriteCode(std::ostream &outStream, std::string const &postfix) const
+{
+    WriteAffineCode(outStream, postfix, shift, matrix, "");
+}
+
+
+bool TransformPCA::WriteFusedCode(std::ostream &outStream, std::string const &postfix,
+ TransformBase const &previous) const
+{
+    // The standardization is affine as well and is absorbed in the parameters:
+    //A * ((x - mu) / sigma - m) = (A / sigma) * (x - (mu + sigma * m))
+    TransformStandard const *standard = dynamic_cast<TransformStandard const *>(&previous);
+    
+    if (standard != nullptr)
+    {
+        vector<Double_t> const &mu = standard->GetMeans();
+        vector<Double_t> const &sigma = standard->GetSigmas();
+        vector<Double_t> fusedShift(dim), fusedMatrix(dim * dim);
+        
+        for (unsigned j = 0; j < dim; ++j)
+            fusedShift[j] = mu[j] + sigma[j] * shift[j];
+        
+        for (unsigned i = 0; i < dim; ++i)
+            for (unsigned j = 0; j < dim; ++j)
+                fusedMatrix[i * dim + j] = matrix[i * dim + j] / sigma[j];
+        
+        WriteAffineCode(outStream, postfix, fusedShift, fusedMatrix, "");
+        return true;
+    }
+    
+    
+    // The gaussianisation is not linear. It is written as a separate class, which is applied
+    //within the same functor
+    if (dynamic_cast<TransformGauss const *>(&previous) != nullptr)
+    {
+        previous.WriteCode(outStream, postfix + "Marginal");
+        WriteAffineCode(outStream, postfix, shift, matrix, "Transform" + postfix + "Marginal");
+        return true;
+    }
+    
+    return false;
+}
+
+
+void TransformPCA::WriteAffineCode(std::ostream &outStream, std::string const &postfix,
+ vector<Double_t> const &shift_, vector<Double_t> const &matrix_,
+ std::string const &marginalClass) const
+{
+    // Short declaration of the class
+    outStream << "class Transform" << postfix << "\n{\n\tpublic:\n";
+    outStream << "\t\tTransform" << postfix << "();\n";
+    outStream << "\t\tvoid operator()(Double_t *vars) const;\n\n";
+    outStream << "\tprivate:\n";
+    
+    if (marginalClass.length() > 0)
+        outStream << "\t\t" << marginalClass << " marginal;\n";
+    
+    outStream << "\t\tDouble_t shift[" << dim << "], matrix[" << dim << "][" << dim <<
+     "];\n};\n\n";
+    
+    // Define the constructor
+    outStream << "Transform" << postfix << "::Transform" << postfix << "()\n{\n";
+    
+    for (unsigned i = 0; i < dim; ++i)
+        outStream << "\tshift[" << i << "] = " << shift_[i] << ";\n";
+    
+    for (unsigned i = 0; i < dim; ++i)
+    {
+        outStream << "\t";
+        
+        for (unsigned j = 0; j < dim; ++j)
+            outStream << "matrix[" << i << "][" << j << "] = " << matrix_[i * dim + j] << "; ";
+        
+        outStream << "\n";
+    }
+    
+    outStream << "}\n\n";
+    
+    // Define operator()
+    outStream << "void Transform" << postfix << "::operator()(Double_t *vars) const\n{\n";
+    
+    if (marginalClass.length() > 0)
+        outStream << "\tmarginal(vars);\n\t\n";
+    
+    outStream << "\tDouble_t x[" << dim << "];\n\t\n" <<
+     "\tfor (unsigned j = 0; j < " << dim << "; ++j)\n" <<
+     "\t\tx[j] = vars[j] - shift[j];\n\t\n";
+    outStream << "\tfor (unsigned i = 0; i < " << dim << "; ++i)\n\t{\n" <<
+     "\t\tvars[i] = 0.;\n\t\t\n" <<
+     "\t\tfor (unsigned j = 0; j < " << dim << "; ++j)\n" <<
+     "\t\t\tvars[i] += matrix[i][j] * x[j];\n\t}\n}\n\n\n";
+}
+
+
+void TransformPCA::MergeMoments(CovarianceAccumulator const &partial, Double_t scale)
+{
+    if (accum.dim != dim or partial.dim != dim)
+        throw std::logic_error("TransformPCA::MergeMoments: The transformation is already "
+         "built or the number of variables does not match.");
+    
+    accum.Merge(partial, scale);
+}
+
+
+void TransformPCA::AddEventImp(Double_t weight, Double_t const *vars)
+{
+    accum.Add(weight, vars);
+}
+
+
 void TransformPCA::BuildTransformationImp()
-{}
+{
+    // Decompose the covariance matrix. ROOT returns the eigenvalues in the decreasing order, and
+    //the eigenvectors are the columns of the matrix
+    TMatrixDSym covariance(dim);
+    
+    for (unsigned i = 0; i < dim; ++i)
+        for (unsigned j = 0; j < dim; ++j)
+            covariance(i, j) = accum.GetCovariance(i, j);
+    
+    TMatrixDSymEigen decomposition(covariance);
+    TVectorD const &eigenValues = decomposition.GetEigenValues();
+    TMatrixD const &eigenVectors = decomposition.GetEigenVectors();
+    
+    
+    // A vanishing eigenvalue means that the variables are linearly dependent
+    if (not (eigenValues(dim - 1) > 1e-12 * eigenValues(0)))
+    {
+        log << error << "The covariance matrix of the input variables is degenerate (the " <<
+         "smallest eigenvalue is " << eigenValues(dim - 1) << " while the largest one is " <<
+         eigenValues(0) << "). Some of the variables are linearly dependent and cannot be used " <<
+         "together for classification." << eom;
+        exit(1);
+    }
+    
+    
+    // Each row of the matrix is an eigenvector divided by the square root of its eigenvalue
+    for (unsigned i = 0; i < dim; ++i)
+    {
+        Double_t const scale = 1. / std::sqrt(eigenValues(i));
+        
+        for (unsigned j = 0; j < dim; ++j)
+            matrix[i * dim + j] = eigenVectors(j, i) * scale;
+    }
+    
+    shift = accum.mean;
+    
+    log << info(2) << "The leading principal component carries " <<
+     eigenValues(0) / covariance.GetTrace() * 100. << "% of the total variance." << eom;
+    
+    // We don't need the accumulator anymore
+    accum = CovarianceAccumulator();
+}
 
 
-void TransformPCA::ApplyTransformationImp(Double_t */*vars*/)
-{}
+void TransformPCA::ApplyTransformationImp(Double_t *vars)
+{
+    for (unsigned j = 0; j < dim; ++j)
+        buffer[j] = vars[j] - shift[j];
+    
+    for (unsigned i = 0; i < dim; ++i)
+    {
+        Double_t const *row = &matrix[i * dim];
+        Double_t sum = 0.;
+        
+        for (unsigned j = 0; j < dim; ++j)
+            sum += row[j] * buffer[j];
+        
+        vars[i] = sum;
+    }
+}
+
+
+void TransformPCA::SaveStateImp(std::ostream &outStream) const
+{
+    outStream.write(reinterpret_cast<char const *>(shift.data()), sizeof(Double_t) * dim);
+    outStream.write(reinterpret_cast<char const *>(matrix.data()), sizeof(Double_t) * dim * dim);
+}
+
+
+bool TransformPCA::LoadStateImp(std::istream &inStream)
+{
+    inStream.read(reinterpret_cast<char *>(shift.data()), sizeof(Double_t) * dim);
+    inStream.read(reinterpret_cast<char *>(matrix.data()), sizeof(Double_t) * dim * dim);
+    
+    // The accumulator is not needed since the transformation is restored
+    accum = CovarianceAccumulator();
+    
+    return inStream.good();
+}
@@ -1,30 +1,39 @@
 #include "TransformStandard.hpp"
 
 #include <cmath>
+#include <stdexcept>
 
 
 using namespace logger;
 
 
-TransformStandard::TransformStandard(Logger &log_, unsigned dim_):
-    TransformBase(log_, dim_), singleTrans(dim)
+void MomentAccumulator::Merge(MomentAccumulator const &other, Double_t scale)
 {
-    // Don't thing Boost already has the move constructor in, therefore use the pointers
-    for (auto &t : singleTrans)
-        t.accum = new MeanVarAccumulator_t;
+    Double_t const otherSumW = other.sumW * scale;
+    
+    if (otherSumW == 0.)
+        return;
+    
+    Double_t const newSumW = sumW + otherSumW;
+    Double_t const delta = other.mean - mean;
+    
+    mean += delta * otherSumW / newSumW;
+    m2 += other.m2 * scale + delta * delta * sumW * otherSumW / newSumW;
+    sumW = newSumW;
 }
 
 
-TransformStandard::~TransformStandard() noexcept
+Double_t MomentAccumulator::GetVariance() const
 {
-    for (auto &t : singleTrans)
-    {
-        delete t.accum;
-        t.accum = nullptr;
-    }
+    return m2 / sumW;
 }
 
 
+TransformStandard::TransformStandard(Logger &log_, unsigned dim_):
+    TransformBase(log_, dim_), moments(dim), mean(dim), sigma(dim)
+{}
+
+
 void TransformStandard::WriteCode(std::ostream &outStream, std::string const &postfix) const
 {
     // Short declaration of the class
@@ -37,8 +46,8 @@ void TransformStandard::WriteCode(std::ostream &outStream, std::string const &po
     outStream << "Transform" << postfix << "::Transform" << postfix << "()\n{\n";
     
     for (unsigned iVar = 0; iVar < dim; ++iVar)
-        outStream << "\tmean[" << iVar << "] = " << singleTrans[iVar].mean << "; " <<
-         "sigma[" << iVar << "] = " << singleTrans[iVar].sigma << ";\n";
+        outStream << "\tmean[" << iVar << "] = " << mean[iVar] << "; " <<
+         "sigma[" << iVar << "] = " << sigma[iVar] << ";\n";
     
     outStream << "}\n\n";
     
@@ -51,28 +60,50 @@ void TransformStandard::WriteCode(std::ostream &outStream, std::string const &po
 }
 
 
+void TransformStandard::MergeMoments(vector<MomentAccumulator> const &partial, Double_t scale)
+{
+    if (moments.size() != dim or partial.size() != dim)
+        throw std::logic_error("TransformStandard::MergeMoments: The transformation is already "
+         "built or the number of variables does not match.");
+    
+    for (unsigned iVar = 0; iVar < dim; ++iVar)
+        moments[iVar].Merge(partial[iVar], scale);
+}
+
+
+vector<Double_t> const & TransformStandard::GetMeans() const
+{
+    return mean;
+}
+
+
+vector<Double_t> const & TransformStandard::GetSigmas() const
+{
+    return sigma;
+}
+
+
 void TransformStandard::AddEventImp(Double_t w, Double_t const *vars)
 {
     for (unsigned iVar = 0; iVar < dim; ++iVar)
-        singleTrans.at(iVar).accum->operator()(vars[iVar], weight = w);
+        moments[iVar].Add(w, vars[iVar]);
 }
 
 
 void TransformStandard::BuildTransformationImp()
 {
-    for (auto &t : singleTrans)
+    for (unsigned iVar = 0; iVar < dim; ++iVar)
     {
-        t.mean = weighted_mean(*t.accum);
-        t.sigma = std::sqrt(weighted_variance(*t.accum));
-        
-        // We don't need the accumulator anymore
-        delete t.accum;
-        t.accum = nullptr;
+        mean[iVar] = moments[iVar].mean;
+        sigma[iVar] = std::sqrt(moments[iVar].GetVariance());
     }
     
+    // We don't need the moments anymore
+    moments.clear();
+    
     // Check for zero variances
     for (unsigned iVar = 0; iVar < dim; ++iVar)
-        if (singleTrans.at(iVar).sigma == 0.)
+        if (not (sigma[iVar] > 0.))
         {
             log << error << "Input variable #" << iVar << " has zero variance. " <<
              "It cannot be used for classification." << eom;
@@ -82,10 +113,36 @@ void TransformStandard::BuildTransformationImp()
 
 
 void TransformStandard::ApplyTransformationImp(Double_t *vars)
+{
+    // Plain arrays let the compiler vectorize the loop
+    Double_t const *m = mean.data();
+    Double_t const *s = sigma.data();
+    
+    for (unsigned iVar = 0; iVar < dim; ++iVar)
+        vars[iVar] = (vars[iVar] - m[iVar]) / s[iVar];
+}
+
+
+void TransformStandard::SaveStateImp(std::ostream &outStream) const
+{
+    for (unsigned iVar = 0; iVar < dim; ++iVar)
+    {
+        outStream.write(reinterpret_cast<char const *>(&mean[iVar]), sizeof(Double_t));
+        outStream.write(reinterpret_cast<char const *>(&sigma[iVar]), sizeof(Double_t));
+    }
+}
+
+
+bool TransformStandard::LoadStateImp(std::istream &inStream)
 {
     for (unsigned iVar = 0; iVar < dim; ++iVar)
     {
-        SingleVarTransform const &t = singleTrans.at(iVar);
-        vars[iVar] = (vars[iVar] - t.mean) / t.sigma;
+        inStream.read(reinterpret_cast<char *>(&mean[iVar]), sizeof(Double_t));
+        inStream.read(reinterpret_cast<char *>(&sigma[iVar]), sizeof(Double_t));
     }
+    
+    // The moments are not needed since the transformation is restored
+    moments.clear();
+    
+    return inStream.good();
 }
@@ -6,35 +6,230 @@
 
 #include <iostream>
 #include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <cstdlib>
 #include <boost/algorithm/string.hpp>
 
 
 using std::string;
+using std::vector;
+using std::unique_ptr;
 using namespace logger;
 
 
+// A training in the batch mode. Each one has its own log file
+struct Task
+{
+    string logFileName;  ///< Name of the log file
+    unique_ptr<Logger> log;  ///< Logger of the training
+    unique_ptr<Config> config;  ///< Configuration of the training
+};
+
+
+// Constructs the name of the log file from the name of the configuration file. The postfix is
+//inserted before the extension
+string GetLogFileName(string const &cfgFileName, string const &postfix = "")
+{
+    size_t strIndex = cfgFileName.find_last_of('/');
+    
+    return cfgFileName.substr(strIndex + 1, cfgFileName.find_last_of('.') - strIndex - 1) +
+     postfix + ".log";
+}
+
+
+// Saves the time and memory spent in each phase next to the log file
+void WritePhaseSummary(Logger &log, string const &logFileName)
+{
+    string const phaseSummaryFileName(logFileName.substr(0, logFileName.length() - 4) +
+     "_phases.csv");
+    log.WritePhaseSummary(phaseSummaryFileName);
+    log << info(2) << "The resources spent in each phase are written in file \"" <<
+     phaseSummaryFileName << "\"." << eom;
+}
+
+
+// Performs the training and writes the C++ file needed to apply the BNN. The training set is
+//shared with other trainings and is built as described in the batch log
+void RunTraining(Task &task, InputProcessor const &inputProcessor, unsigned nThreads,
+ string const &batchLogFileName)
+{
+    *task.log << info(1) << "The training set is shared with other trainings. It is built as " <<
+     "described in file \"" << batchLogFileName << "\"." << eom;
+    inputProcessor.WriteTrainEventsFile(task.config->GetTaskName(), *task.log);
+    
+    {
+        FBMWrapper fbm(*task.log, *task.config, inputProcessor, nThreads);
+        CodeMaker coder(*task.log, *task.config, inputProcessor, fbm);
+    }
+    
+    WritePhaseSummary(*task.log, task.logFileName);
+    *task.log << info(1) << "The task is completed successfully." << eom;
+}
+
+
+// Runs all the trainings described by the given configuration files, which may define scans. The
+//training set is built only once for each group of trainings that use identical training sets.
+//The trainings of a group run at the same time sharing the training set, and the cores are
+//divided among them
+int RunBatch(vector<string> const &cfgFileNames, unsigned nCores)
+{
+    string const logFileName(GetLogFileName(cfgFileNames.front(), "_batch"));
+    Logger log(-1, -1, logFileName);
+    log.PrintTimestamp();
+    
+    log << info(1) << "bnn-hep started in the batch mode." << eom;
+    
+    
+    // Read the configurations. Each point of a scan is a separate training
+    vector<Task> tasks;
+    
+    for (string const &cfgFileName: cfgFileNames)
+    {
+        unsigned const nPoints = Config::CountScanPoints(cfgFileName);
+        
+        for (unsigned point = 0; point < nPoints; ++point)
+        {
+            Task task;
+            task.logFileName = GetLogFileName(cfgFileName,
+             (nPoints > 1) ? "_" + std::to_string(point) : "");
+            task.log.reset(new Logger(-1, -1, task.logFileName));
+            task.log->PrintTimestamp();
+            
+            // The trainings run at the same time, so the CPU time and the memory measured for
+            //the whole process do not describe any single one of them
+            task.log->SetWallTimeOnly();
+            *task.log << info(1) << "bnn-hep started." << eom;
+            
+            task.config.reset(new Config(cfgFileName, *task.log, point));
+            tasks.push_back(std::move(task));
+        }
+    }
+    
+    
+    // The trainings running at the same time must not write the same files
+    std::set<string> usedNames;
+    
+    for (Task const &task: tasks)
+        for (string const &name: {task.config->GetTaskName(), task.config->GetBNNFileName(),
+         task.config->GetCPPFileName()})
+            if (not usedNames.insert(name).second)
+            {
+                log << error << "Name \"" << name << "\" is used by several trainings. The task " <<
+                 "names and the names of the output files must differ." << eom;
+                exit(1);
+            }
+    
+    
+    // Group the trainings by the training set, keeping the order of the configurations
+    vector<vector<Task *>> groups;
+    std::map<string, unsigned> groupIndices;
+    
+    for (Task &task: tasks)
+    {
+        auto const res = groupIndices.insert({InputProcessor::GetTrainingSetKey(*task.config),
+         groups.size()});
+        
+        if (res.second)
+            groups.emplace_back();
+        
+        groups.at(res.first->second).push_back(&task);
+    }
+    
+    log << info(1) << tasks.size() << " trainings in " << groups.size() << " groups with " <<
+     "different training sets are run using " << nCores << " cores." << eom;
+    
+    
+    // The groups are processed one after another since the dimensionality of the events is
+    //shared by all the objects of InputProcessor
+    for (unsigned iGroup = 0; iGroup < groups.size(); ++iGroup)
+    {
+        vector<Task *> const &group = groups[iGroup];
+        Logger::PhaseTimer timer(log, "group " + std::to_string(iGroup));
+        
+        // The training set is built with the configuration of the first training in the group
+        InputProcessor inputProcessor(log, *group.front()->config, nCores);
+        
+        unsigned const nConcurrent = std::min<unsigned>(group.size(), nCores);
+        unsigned const nThreads = std::max(1u, nCores / nConcurrent);
+        
+        log << info(1) << "Group #" << iGroup << ": " << group.size() << " trainings, " <<
+         nConcurrent << " at a time with " << nThreads << " threads each." << eom;
+        
+        // Each worker takes the next training that has not been started yet
+        std::atomic<unsigned> nextTask(0);
+        vector<std::thread> workers;
+        
+        for (unsigned iWorker = 0; iWorker < nConcurrent; ++iWorker)
+            workers.emplace_back([&group, &nextTask, &inputProcessor, nThreads, &logFileName]()
+            {
+                for (unsigned i = nextTask++; i < group.size(); i = nextTask++)
+                    RunTraining(*group[i], inputProcessor, nThreads, logFileName);
+            });
+        
+        for (auto &worker: workers)
+            worker.join();
+    }
+    
+    
+    WritePhaseSummary(log, logFileName);
+    log << info(1) << "All the trainings are completed successfully." << eom;
+    
+    return 0;
+}
+
+
 int main(int argc, char **argv)
 {
-    // Check the usage
-    if (argc != 2)
+    // Parse the command line. The number of cores limits the number of threads of FBM programs and
+    //of the preprocessing. In the batch mode the cores are divided among the trainings run at the
+    //same time
+    vector<string> cfgFileNames;
+    unsigned nCores = 0;
+    
+    for (int i = 1; i < argc; ++i)
+    {
+        string const arg(argv[i]);
+        
+        if (arg == "-j" and i + 1 < argc)
+            nCores = std::atoi(argv[++i]);
+        else
+            cfgFileNames.push_back(arg);
+    }
+    
+    if (cfgFileNames.empty())
     {
-        std::cerr << "Usage: bnn-hep configFile.\n";
+        std::cerr << "Usage: bnn-hep [-j cores] configFile [configFile ...].\n";
         return 1;
     }
     
+    for (string const &cfgFileName: cfgFileNames)
+        if (boost::iends_with(cfgFileName.c_str(), ".log"))
+        {
+            std::cerr << "Confusing configuration file name. The extension should not be " <<
+             "\"log\".\n";
+            return 1;
+        }
     
-    // Use the name of the configuration file to create the logger
-    string const cfgFileName(argv[1]);
     
-    if (boost::iends_with(cfgFileName.c_str(), ".log"))
+    // Several configuration files or a scan are processed in the batch mode
+    if (cfgFileNames.size() > 1 or Config::CountScanPoints(cfgFileNames.front()) > 1)
     {
-        std::cerr << "Confusing configuration file name. The extension should not be \"log\".\n";
-        return 1;
+        if (nCores == 0)
+            nCores = std::max(1u, std::thread::hardware_concurrency());
+        
+        return RunBatch(cfgFileNames, nCores);
     }
     
-    size_t strIndex = cfgFileName.find_last_of('/');
-    string const logFileName(cfgFileName.substr(strIndex + 1,
-     cfgFileName.find_last_of('.') - strIndex - 1) + ".log");
+    
+    // Use the name of the configuration file to create the logger
+    string const &cfgFileName(cfgFileNames.front());
+    string const logFileName(GetLogFileName(cfgFileName));
     
     
     // Create the logger
@@ -48,15 +243,19 @@ int main(int argc, char **argv)
     Config config(cfgFileName, log);
     
     // Process the input files
-    InputProcessor inputProcessor(log, config);
+    InputProcessor inputProcessor(log, config, nCores);
     
     // Perform the training
-    FBMWrapper fbm(log, config, inputProcessor);
+    FBMWrapper fbm(log, config, inputProcessor, nCores);
     
     // Write the C++ file needed to apply the BNN
     CodeMaker coder(log, config, inputProcessor, fbm);
     
     
+    // Save the time and memory spent in each phase next to the log file
+    WritePhaseSummary(log, logFileName);
+    
+    
     // Everything is done
     log << info(1) << "The task is completed successfully." << eom;
     
@@ -4,12 +4,25 @@
 #include <iomanip>
 #include <cmath>
 #include <ctime>
+#include <random>
+#include <mutex>
 
 
 using namespace std;
 
 
-TRandom3 randGen(0);
+// Returns a new non-deterministic seed for the random generator of a thread
+unsigned NewSeed()
+{
+    static random_device device;
+    static mutex deviceMutex;
+    
+    lock_guard<mutex> lock(deviceMutex);
+    return device();
+}
+
+
+thread_local TRandom3 randGen(NewSeed());
 
 
 string GetRandomName(bool useTime /*= true*/, unsigned postfixLength /*= 3*/)
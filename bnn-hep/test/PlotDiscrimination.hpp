@@ -23,19 +23,53 @@
 #include <TStyle.h>
 #include <TGaxis.h>
 #include <TLegend.h>
+#include <RVersion.h>
 
 #include <string>
 #include <vector>
 #include <list>
 #include <utility>
+#include <algorithm>
+
+// The files are read in parallel with ROOT 6 only since earlier versions are not thread-safe
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6, 0, 0)
+#define PLOT_DISCRIMINATION_THREADS
+#include <TROOT.h>
+#include <thread>
+#include <mutex>
+#endif
 
 
 typedef std::list<std::string> lstring;
 
 
-/// Class to produce the discrimination plots
+/**
+ * \brief Class to produce the discrimination plots.
+ * 
+ * Each file is read once. The events tried for training are recognised by walking along the sorted
+ * list of their indices together with the tree. With ROOT 6 the files are processed in parallel.
+ * The discriminator is not required to be thread-safe (the generated classes are not): the inputs
+ * are collected in batches, and a batch is evaluated by one thread at a time. The outputs are
+ * accumulated in plain per-file arrays, which are added to the histograms once all the files are
+ * processed.
+ */
 class PlotDiscrimination
 {
+    private:
+        /// Input and results of processing of a single file
+        struct FileJob
+        {
+            std::string fileName;  ///< Name of the ROOT file
+            std::string weightName;  ///< Name of the variable to weight the events
+            std::vector<unsigned long> trainEvents;  ///< Sorted events tried for training
+            unsigned long nTrainEvents;  ///< Number of events tried for training
+            long nEntriesNonZeroWeight;  ///< Number of events with non-zero weights
+            std::vector<double> trainSumW;  ///< Sums of weights per bin for the training set
+            std::vector<double> trainSumW2;  ///< Sums of squared weights for the training set
+            std::vector<double> examSumW;  ///< Sums of weights per bin for the exam set
+            std::vector<double> examSumW2;  ///< Sums of squared weights for the exam set
+        };
+    
     public:
         /// Constructor
         PlotDiscrimination(BinaryDiscriminator const &discr_, TrainEventList &trainList_);
@@ -70,12 +104,30 @@ class PlotDiscrimination
          * PDF, and ROOT script.
          */
         void Process(std::string const &title, std::string const &plotFileName);
+        
+        /**
+         * \brief Sets the number of threads to read the files.
+         * 
+         * Zero (default) means the number of hardware threads. Ignored with ROOT 5.
+         */
+        void SetNumberThreads(unsigned nThreads_);
     
     private:
         /// Reads the source files and fills the given histograms with the discriminator's output
         void FillHists(lstring const &fileNames, std::string const &weightName, TH1D &trainHist,
          TH1D &examHist);
         
+        /// Processes the jobs with the given indices until they are exhausted
+        void RunJobs(std::vector<FileJob> &jobs, unsigned *nextJob);
+        
+        /// Reads a single file and fills the arrays of the job
+        void ProcessFile(FileJob &job);
+        
+        /// Evaluates the discriminator for a batch of events and adds them to the job's arrays
+        void ScoreBatch(FileJob &job, std::vector<Double_t> const &batchInputs,
+         std::vector<Double_t> const &batchWeights, std::vector<bool> const &batchExam,
+         unsigned batchLength);
+        
         /// Draws the plots. Saves them with the given title and file name
         void Draw(std::string const &title, std::string const &plotFileName);
     
@@ -86,20 +138,24 @@ class PlotDiscrimination
         lstring bkgFileNames;  ///< Names of the ROOT files for the background
         std::string treeName;  ///< Name of the tree to read from the files
         BinaryDiscriminator const &discr;  ///< An instance of a binary discriminator
-        Double_t *inputs;  ///< Buffer to ship the inputs to the discriminator
         TrainEventList &trainList;  ///< Object to separate the training and the exam sets
+        unsigned nThreads;  ///< Number of threads to read the files (zero for automatic choice)
+        unsigned batchSize;  ///< Number of events evaluated by the discriminator at a time
         unsigned nBins;  ///< Number of bins in the histograms
         std::pair<double, double> range;  ///< Range for the histograms
         TH1D sgnTrainHist;  ///< Discriminator's output for the signal in the training set
         TH1D bkgTrainHist;  ///< Discriminator's output for the background in the training set
         TH1D sgnExamHist;  ///< Discriminator's output for the signal in the exam set
         TH1D bkgExamHist;  ///< Discriminator's output for the background in the exam set
+#ifdef PLOT_DISCRIMINATION_THREADS
+        std::mutex mutex;  ///< Serialises the calls to the discriminator and the job counter
+#endif
 };
 
 
 PlotDiscrimination::PlotDiscrimination(BinaryDiscriminator const &discr_,
  TrainEventList &trainList_):
-    discr(discr_), inputs(NULL), trainList(trainList_),
+    discr(discr_), trainList(trainList_), nThreads(0), batchSize(256),
     nBins(30), range(-0.05, 1.05),
     sgnTrainHist("sgnTrainHist", "sgnTrainHist", nBins, range.first, range.second),
     bkgTrainHist("bkgTrainHist", "bkgTrainHist", nBins, range.first, range.second),
@@ -124,9 +180,7 @@ PlotDiscrimination::PlotDiscrimination(BinaryDiscriminator const &discr_,
 
 
 PlotDiscrimination::~PlotDiscrimination()
-{
-    delete [] inputs;
-}
+{}
 
 
 void PlotDiscrimination::SetVariables(lstring const &varNames_, std::string const &weightName_)
@@ -134,10 +188,6 @@ void PlotDiscrimination::SetVariables(lstring const &varNames_, std::string cons
     varNames = varNames_;
     sgnWeightName = weightName_;
     bkgWeightName = weightName_;
-    
-    // Allocate the buffer for the inputs
-    delete [] inputs;
-    inputs = new Double_t[varNames.size()];
 }
 
 
@@ -147,10 +197,6 @@ void PlotDiscrimination::SetVariables(lstring const &varNames_, std::string cons
     varNames = varNames_;
     sgnWeightName = sgnWeightName_;
     bkgWeightName = bkgWeightName_;
-    
-    // Allocate the buffer for the inputs
-    delete [] inputs;
-    inputs = new Double_t[varNames.size()];
 }
 
 
@@ -174,81 +220,234 @@ void PlotDiscrimination::Process(std::string const &title, std::string const &pl
 }
 
 
+void PlotDiscrimination::SetNumberThreads(unsigned nThreads_)
+{
+    nThreads = nThreads_;
+}
+
+
 void PlotDiscrimination::FillHists(lstring const &fileNames, std::string const &weightName,
  TH1D &trainHist, TH1D &examHist)
 {
-    unsigned const nVars = varNames.size();
-    
+    // Prepare the jobs. The lists of events tried for training are read here since the reader is
+    //not thread-safe
+    std::vector<FileJob> jobs(fileNames.size());
+    unsigned iJob = 0;
     
-    // Loop over the files
     for (lstring::const_iterator fName = fileNames.begin(); fName != fileNames.end(); ++fName)
     {
-        trainList.ReadEventList(*fName);
-        
-        // Get the tree
-        TFile file(fName->c_str());
-        TTree *tree = dynamic_cast<TTree *>(file.Get(treeName.c_str()));
-        long const nEntries = tree->GetEntries();
-        
+        FileJob &job = jobs[iJob++];
+        job.fileName = *fName;
+        job.weightName = weightName;
         
-        // Prepare the formulas
-        std::vector<TTreeFormula *> formulas;
-        formulas.reserve(nVars);
-        TTreeFormula weightFormula("weight", weightName.c_str(), tree);
+        trainList.ReadEventList(*fName);
+        job.trainEvents = trainList.GetEvents();
+        job.nTrainEvents = trainList.GetNEvents();
+        job.nEntriesNonZeroWeight = 0;
         
-        for (lstring::const_iterator vName = varNames.begin(); vName != varNames.end(); ++vName)
-            formulas.push_back(new TTreeFormula(vName->c_str(), vName->c_str(), tree));
+        job.trainSumW.assign(nBins + 2, 0.);
+        job.trainSumW2.assign(nBins + 2, 0.);
+        job.examSumW.assign(nBins + 2, 0.);
+        job.examSumW2.assign(nBins + 2, 0.);
+    }
+    
+    
+    // Process the files
+    unsigned nextJob = 0;
+    
+#ifdef PLOT_DISCRIMINATION_THREADS
+    unsigned nWorkers = (nThreads > 0) ? nThreads : std::thread::hardware_concurrency();
+    nWorkers = std::max(1u, std::min(nWorkers, unsigned(jobs.size())));
+    
+    if (nWorkers > 1)
+    {
+        ROOT::EnableThreadSafety();
+        std::vector<std::thread> workers;
         
+        for (unsigned i = 0; i < nWorkers; ++i)
+            workers.push_back(std::thread(&PlotDiscrimination::RunJobs, this, std::ref(jobs),
+             &nextJob));
         
-        // Calculate a factor to rescale weights. It is needed to account for removal of the
-        //training set
-        long const nEntriesNonZeroWeight = 0;
+        for (unsigned i = 0; i < nWorkers; ++i)
+            workers[i].join();
+    }
+    else
+        RunJobs(jobs, &nextJob);
+#else
+    RunJobs(jobs, &nextJob);
+#endif
+    
+    
+    // Add the results to the histograms in the order of the files. The weights are rescaled to
+    //account for removal of the training set
+    TArrayD &trainErrors = *trainHist.GetSumw2();
+    TArrayD &examErrors = *examHist.GetSumw2();
+    
+    for (unsigned i = 0; i < jobs.size(); ++i)
+    {
+        FileJob const &job = jobs[i];
+        double const examWeightFactor =
+         1. - double(job.nTrainEvents) / job.nEntriesNonZeroWeight;
+        //^ Events in the training set have non-zero weights by construction
         
-        for (long ev = 0; ev < nEntries; ++ev)
+        for (unsigned bin = 0; bin < nBins + 2; ++bin)
         {
-            tree->LoadTree(ev);
+            if (job.nTrainEvents > 0)
+            {
+                double const factor = 1. / (1. - examWeightFactor);
+                trainHist.AddBinContent(bin, job.trainSumW[bin] * factor);
+                trainErrors[bin] += job.trainSumW2[bin] * factor * factor;
+            }
             
-            if (weightFormula.EvalInstance() != 0.)
-                ++nEntriesNonZeroWeight;
+            if (examWeightFactor > 0.)
+            {
+                double const factor = 1. / examWeightFactor;
+                examHist.AddBinContent(bin, job.examSumW[bin] * factor);
+                examErrors[bin] += job.examSumW2[bin] * factor * factor;
+            }
         }
+    }
+    
+    
+    // Normalize the histograms
+    trainHist.Scale(1. / trainHist.Integral());
+    examHist.Scale(1. / examHist.Integral());
+}
+
+
+void PlotDiscrimination::RunJobs(std::vector<FileJob> &jobs, unsigned *nextJob)
+{
+    while (true)
+    {
+        unsigned iJob;
         
-        double const examWeightFactor = 1. - double(trainList.GetNEvents()) / nEntriesNonZeroWeight;
-        //^ Events in the training set have non-zero weights by construction
-        
-        
-        // Fill histograms with BNN output
-        for (long ev = 0; ev < nEntries; ++ev)
         {
-            tree->LoadTree(ev);
-            
-            Double_t const weight = weightFormula.EvalInstance();
-            
-            if (weight == 0.)
-                continue;
-            
-            
-            for (unsigned i = 0; i < nVars; ++i)
-                inputs[i] = formulas[i]->EvalInstance();
-            
-            Double_t const value = discr(inputs);
-            
-            
-            if (trainList.CheckEventExam(ev))
-                examHist.Fill(value, weight / examWeightFactor);
-            else
-                trainHist.Fill(value, weight / (1. - examWeightFactor));
+#ifdef PLOT_DISCRIMINATION_THREADS
+            std::lock_guard<std::mutex> lock(mutex);
+#endif
+            iJob = (*nextJob)++;
         }
         
+        if (iJob >= jobs.size())
+            return;
+        
+        ProcessFile(jobs[iJob]);
+    }
+}
+
+
+void PlotDiscrimination::ProcessFile(FileJob &job)
+{
+    unsigned const nVars = varNames.size();
+    
+    
+    // Get the tree
+    TFile file(job.fileName.c_str());
+    TTree *tree = dynamic_cast<TTree *>(file.Get(treeName.c_str()));
+    long const nEntries = tree->GetEntries();
+    
+    
+    // Prepare the formulas
+    std::vector<TTreeFormula *> formulas;
+    formulas.reserve(nVars);
+    TTreeFormula weightFormula("weight", job.weightName.c_str(), tree);
+    
+    for (lstring::const_iterator vName = varNames.begin(); vName != varNames.end(); ++vName)
+        formulas.push_back(new TTreeFormula(vName->c_str(), vName->c_str(), tree));
+    
+    
+    // Read the tree in a single pass. Whether an event has been tried for training is found by
+    //advancing along the sorted list of such events together with the tree
+    std::vector<Double_t> batchInputs(batchSize * nVars);
+    std::vector<Double_t> batchWeights(batchSize);
+    std::vector<bool> batchExam(batchSize);
+    unsigned batchLength = 0;
+    std::vector<unsigned long>::const_iterator trainIt = job.trainEvents.begin();
+    
+    for (long ev = 0; ev < nEntries; ++ev)
+    {
+        tree->LoadTree(ev);
+        
+        Double_t const weight = weightFormula.EvalInstance();
+        
+        if (weight == 0.)
+            continue;
+        
+        ++job.nEntriesNonZeroWeight;
+        
+        while (trainIt != job.trainEvents.end() and *trainIt < (unsigned long)(ev))
+            ++trainIt;
+        
+        batchExam[batchLength] =
+         (trainIt == job.trainEvents.end() or *trainIt != (unsigned long)(ev));
+        batchWeights[batchLength] = weight;
         
-        // Free the memory
         for (unsigned i = 0; i < nVars; ++i)
-            delete formulas[i];
+            batchInputs[batchLength * nVars + i] = formulas[i]->EvalInstance();
+        
+        ++batchLength;
+        
+        if (batchLength == batchSize)
+        {
+            ScoreBatch(job, batchInputs, batchWeights, batchExam, batchLength);
+            batchLength = 0;
+        }
     }
     
+    if (batchLength > 0)
+        ScoreBatch(job, batchInputs, batchWeights, batchExam, batchLength);
     
-    // Normalize the histograms
-    trainHist.Scale(1. / trainHist.Integral());
-    examHist.Scale(1. / examHist.Integral());
+    
+    // Free the memory
+    for (unsigned i = 0; i < nVars; ++i)
+        delete formulas[i];
+}
+
+
+void PlotDiscrimination::ScoreBatch(FileJob &job, std::vector<Double_t> const &batchInputs,
+ std::vector<Double_t> const &batchWeights, std::vector<bool> const &batchExam,
+ unsigned batchLength)
+{
+    unsigned const nVars = varNames.size();
+    std::vector<Double_t> values(batchLength);
+    
+    // The discriminator is evaluated by one thread at a time
+    {
+#ifdef PLOT_DISCRIMINATION_THREADS
+        std::lock_guard<std::mutex> lock(mutex);
+#endif
+        
+        for (unsigned i = 0; i < batchLength; ++i)
+            values[i] = discr(&batchInputs[i * nVars]);
+    }
+    
+    
+    // Find the bins (0 is underflow and nBins + 1 is overflow, as in ROOT) and add the events
+    for (unsigned i = 0; i < batchLength; ++i)
+    {
+        unsigned bin;
+        
+        if (not (values[i] >= range.first))
+            bin = 0;
+        else if (values[i] >= range.second)
+            bin = nBins + 1;
+        else
+            bin = 1 + std::min(nBins - 1,
+             unsigned((values[i] - range.first) / (range.second - range.first) * nBins));
+        
+        Double_t const w = batchWeights[i];
+        
+        if (batchExam[i])
+        {
+            job.examSumW[bin] += w;
+            job.examSumW2[bin] += w * w;
+        }
+        else
+        {
+            job.trainSumW[bin] += w;
+            job.trainSumW2[bin] += w * w;
+        }
+    }
 }
 
 
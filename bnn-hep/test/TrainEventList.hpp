@@ -52,6 +52,13 @@ class TrainEventList
          * tried for training).
          */
         bool CheckEventExam(unsigned long event) const;
+        
+        /**
+         * \brief Returns the events in the list last read.
+         * 
+         * The indices are sorted. The vector is empty if the result of ReadEventList was false.
+         */
+        std::vector<unsigned long> const & GetEvents() const;
     
     private:
         std::ifstream file;  ///< Stream associated with the file
@@ -138,4 +145,10 @@ bool TrainEventList::CheckEventExam(unsigned long event) const
 }
 
 
+std::vector<unsigned long> const & TrainEventList::GetEvents() const
+{
+    return eventsRead;
+}
+
+
 #endif
@@ -8,6 +8,9 @@
  * 
  * The ROOT files must contain a tree called "Vars" and "run", "lumiSection", "event", each of type
  * ULong64_t. File ids.txt is created and must not exist.
+ * 
+ * Only the three branches are read, and the listed entries are visited in the increasing order.
+ * With ROOT 6 the files are processed in parallel.
  */
 
 #include <EventID.hpp>
@@ -15,6 +18,8 @@
 
 #include <TFile.h>
 #include <TTree.h>
+#include <TBranch.h>
+#include <RVersion.h>
 
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/filesystem.hpp>
@@ -27,11 +32,75 @@
 #include <memory>
 #include <algorithm>
 
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6, 0, 0)
+#define EVENT_INDEX_TO_ID_THREADS
+#include <TROOT.h>
+#include <thread>
+#include <atomic>
+#endif
+
 
 using namespace std;
 using namespace boost::algorithm;
 
 
+// Reads IDs of the events with the given (sorted) indices from the given file. Returns an error
+//message or an empty string in case of success
+string ReadEventIDs(string const &fileName, vector<unsigned long> const &indices,
+ vector<EventID> &eventIDs)
+{
+    TFile srcFile(fileName.c_str());
+    
+    if (srcFile.IsZombie())
+        return "File \"" + fileName + "\" is not found or is not a valid ROOT file.";
+    
+    unique_ptr<TTree> srcTree(dynamic_cast<TTree *>(srcFile.Get("Vars")));
+    unsigned long const nEntries = srcTree->GetEntries();
+    
+    
+    // Only the branches with the event ID are needed. Others are not even decompressed
+    char const *branchNames[3] = {"run", "lumiSection", "event"};
+    ULong64_t buffers[3];
+    srcTree->SetBranchStatus("*", 0);
+    
+    for (unsigned i = 0; i < 3; ++i)
+    {
+        srcTree->SetBranchStatus(branchNames[i], 1);
+        srcTree->SetBranchAddress(branchNames[i], &buffers[i]);
+    }
+    
+    
+    // The requested entries are sparse, and the cache is sized to hold the baskets of the three
+    //branches. There is no need for a learning phase since the set of branches is known
+    Long64_t cacheSize = 0;
+    
+    for (unsigned i = 0; i < 3; ++i)
+        cacheSize += srcTree->GetBranch(branchNames[i])->GetZipBytes();
+    
+    srcTree->SetCacheSize(min<Long64_t>(max<Long64_t>(cacheSize, 1LL << 20), 1LL << 26));
+    
+    for (unsigned i = 0; i < 3; ++i)
+        srcTree->AddBranchToCache(branchNames[i], kTRUE);
+    
+    srcTree->StopCacheLearningPhase();
+    
+    
+    // Loop over the indices, which are sorted, and fill the vector with IDs
+    eventIDs.reserve(indices.size());
+    
+    for (auto const &ev: indices)
+    {
+        if (ev >= nEntries)
+            break;
+        
+        srcTree->GetEntry(ev);
+        eventIDs.emplace_back(buffers[0], buffers[1], buffers[2]);
+    }
+    
+    return "";
+}
+
+
 int main(int argc, char const **argv)
 {
     // Check the input arguments
@@ -76,55 +145,70 @@ int main(int argc, char const **argv)
     TrainEventList eventList(argv[1], TrainEventList::Mode::Read);
     
     
-    // Make a map to store a vector of event IDs for each of provided ROOT files
-    map<string, vector<EventID>> eventIDsAllFiles;
-    
+    // Collect the files mentioned in the file with event indices together with sorted indices.
+    //The lists are read here since TrainEventList is not thread-safe
+    vector<string> fileNames;
+    vector<vector<unsigned long>> indices;
     
-    // Loop over the provided ROOT files
     for (int iFile = 3; iFile < argc; ++iFile)
     {
-        string const fileName(argv[iFile]);
-        string const shortFileName = fileName.substr(fileName.find_last_of('/') + 1);
-        
-        if (not eventList.ReadList(fileName))
+        if (not eventList.ReadList(argv[iFile]))
         //^ Current ROOT file is not mentioned in the file with event indices
             continue;
         
-        
-        // Open the ROOT file and set the buffers to read the branches
-        TFile srcFile(fileName.c_str());
-        
-        if (srcFile.IsZombie())
+        fileNames.emplace_back(argv[iFile]);
+        indices.emplace_back(eventList.GetReadEvents());
+        sort(indices.back().begin(), indices.back().end());
+    }
+    
+    
+    // Read the event IDs from the files
+    unsigned const nFiles = fileNames.size();
+    vector<vector<EventID>> eventIDs(nFiles);
+    vector<string> errors(nFiles);
+    
+#ifdef EVENT_INDEX_TO_ID_THREADS
+    unsigned const nThreads = max(1u, min(thread::hardware_concurrency(), nFiles));
+    
+    if (nThreads > 1)
+    {
+        ROOT::EnableThreadSafety();
+        atomic<unsigned> nextFile(0);
+        vector<thread> workers;
+        
+        for (unsigned t = 0; t < nThreads; ++t)
+            workers.emplace_back([&]()
+            {
+                for (unsigned i = nextFile++; i < nFiles; i = nextFile++)
+                    errors[i] = ReadEventIDs(fileNames[i], indices[i], eventIDs[i]);
+            });
+        
+        for (auto &w: workers)
+            w.join();
+    }
+    else
+#endif
+    for (unsigned i = 0; i < nFiles; ++i)
+        errors[i] = ReadEventIDs(fileNames[i], indices[i], eventIDs[i]);
+    
+    
+    // Make a map to store a vector of event IDs for each of provided ROOT files. The files are
+    //processed in the order they were given
+    map<string, vector<EventID>> eventIDsAllFiles;
+    
+    for (unsigned i = 0; i < nFiles; ++i)
+    {
+        if (errors[i].length() > 0)
         {
-            cout << "File \"" << fileName << "\" is not found or is not a valid ROOT file. Exit.\n";
+            cout << errors[i] << " Exit.\n";
             return 1;
         }
         
-        unique_ptr<TTree> srcTree(dynamic_cast<TTree *>(srcFile.Get("Vars")));
-        unsigned long const nEntries = srcTree->GetEntries();
-        
-        ULong64_t run, lumiSection, event;
-        srcTree->SetBranchAddress("run", &run);
-        srcTree->SetBranchAddress("lumiSection", &lumiSection);
-        srcTree->SetBranchAddress("event", &event);
-        
-        
+        string const shortFileName = fileNames[i].substr(fileNames[i].find_last_of('/') + 1);
         auto &eventIDsCurFile = eventIDsAllFiles[shortFileName];
-        eventIDsCurFile.reserve(eventList.GetReadEvents().size());
-        
-        
-        // Loop over all the read indices and fill the vector with IDs
-        for (auto const &ev: eventList.GetReadEvents())
-        {
-            if (ev >= nEntries)
-                break;
-            
-            srcTree->GetEntry(ev);
-            eventIDsCurFile.emplace_back(run, lumiSection, event);
-        }
-        
+        eventIDsCurFile.insert(eventIDsCurFile.end(), eventIDs[i].begin(), eventIDs[i].end());
         
-        // Vector with event IDs for the current file has been filled. Make sure it is ordered
+        // Make sure the vector is ordered
         sort(eventIDsCurFile.begin(), eventIDsCurFile.end());
     }
     
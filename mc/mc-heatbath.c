@@ -32,19 +32,32 @@ void mc_heatbath
   float decay		/* Decay factor for existing momentum */
 )
 { 
+  static double *noise = 0;	/* Space for Gaussian noise, when decay>0 */
+  static int noise_dim = 0;	/* Size of the above */
+
   double std_dev;
   int j;
 
   std_dev = sqrt (temperature * (1-decay*decay));
 
+  /* The Gaussian values are generated in bulk with a counter-based stream
+     (see rand.c), which may be done in parallel. */
+
   if (decay==0)
-  { for (j = 0; j<ds->dim; j++)
-    { ds->p[j] = std_dev * rand_gaussian();
+  { rand_gaussian_fill (ds->p, ds->dim);
+    for (j = 0; j<ds->dim; j++)
+    { ds->p[j] *= std_dev;
     }
   }
   else
-  { for (j = 0; j<ds->dim; j++)
-    { ds->p[j] = decay * ds->p[j] + std_dev * rand_gaussian();
+  { if (noise_dim<ds->dim)
+    { if (noise!=0) free(noise);
+      noise = chk_alloc (ds->dim, sizeof *noise);
+      noise_dim = ds->dim;
+    }
+    rand_gaussian_fill (noise, ds->dim);
+    for (j = 0; j<ds->dim; j++)
+    { ds->p[j] = decay * ds->p[j] + std_dev * noise[j];
     }
   }
 
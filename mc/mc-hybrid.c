@@ -537,3 +537,420 @@ void mc_spiral
   ds->know_kinetic = 1;
   ds->know_grad    = 0;
 }
+
+
+/* PERFORM STOCHASTIC GRADIENT HAMILTONIAN DYNAMICS.  Follows a trajectory
+   of the given number of steps in which the gradient at each step is
+   estimated from a randomly chosen mini-batch of training cases, as
+   supplied by the application.  The energy of the full data is never
+   computed, and the end point is always accepted.  Friction and injected
+   noise keep the distribution approximately invariant despite the noise
+   in the gradient (see T. Chen, E. B. Fox, and C. Guestrin, "Stochastic
+   gradient Hamiltonian Monte Carlo", ICML 2014).  With friction of one
+   and a single step, this reduces to stochastic gradient Langevin 
+   dynamics.  If a place for gradient variances is passed, the noise 
+   injected is reduced by the application's estimate of the noise in 
+   the gradient. */
+
+void mc_sghmc
+( mc_dynamic_state *ds,	/* State to update */
+  mc_iter *it,		/* Description of this iteration */
+  int steps,		/* Number of steps to do */
+  int batch_size,	/* Number of training cases in each mini-batch */
+  double friction,	/* Fraction of momentum removed at each step */
+  mc_value *gvar	/* Place for gradient variances, null if no correction */
+)
+{
+  double e, s;
+  int n, j;
+
+  for (n = 0; n<steps; n++)
+  { 
+    if (!mc_app_batch_grad (ds, batch_size, ds->grad, gvar))
+    { fprintf(stderr,
+        "Application doesn't support stochastic gradient dynamics\n");
+      exit(1);
+    }
+
+    for (j = 0; j<ds->dim; j++)
+    { 
+      e = it->stepsize_factor * ds->stepsize[j];
+
+      s = friction;
+      if (gvar) s -= e*e*gvar[j] / 2;
+      s = s>0 ? sqrt (2 * s * it->temperature) : 0;
+
+      ds->p[j] += - e*ds->grad[j] - friction*ds->p[j] + s*rand_gaussian();
+      ds->q[j] += e*ds->p[j];
+    }
+  }
+
+  ds->know_pot = 0;
+  ds->know_kinetic = 0;
+  ds->know_grad = 0;
+}
+
+
+/* NO-U-TURN SAMPLER.  Performs an update using the no-U-turn sampler of
+   M. D. Hoffman and A. Gelman, "The No-U-Turn Sampler: Adaptively Setting
+   Path Lengths in Hamiltonian Monte Carlo", JMLR 15, 1593-1623, 2014 
+   (their efficient slice sampling version, Algorithm 3).  The trajectory 
+   is extended forwards or backwards in time by a doubling procedure, 
+   until the two ends start to come closer together, or the maximum tree 
+   depth is reached.  The new state is chosen from those along the 
+   trajectory.  Leapfrog steps are always used, without approximations.
+
+   If an adaptation count is given, the stepsize factor is adapted by the
+   dual averaging scheme of the same paper (Algorithm 5) during that number
+   of calls, and then fixed at its final averaged value.  The adaptation 
+   state is kept in ds->adapt_state, and so persists across runs.
+
+   The momentum should be drawn anew before each call (ie, with a heatbath
+   operation with zero decay). */
+
+#define Nuts_max_delta 1000	/* Energy error indicating a divergence */
+
+#define Adapt_mu    2.302585	/* Log of 10, where stepsize factor shrinks to*/
+#define Adapt_gamma 0.05	/* Amount of shrinkage towards Adapt_mu */
+#define Adapt_t0    10		/* Stabilizes early adaptation iterations */
+#define Adapt_kappa 0.75	/* Decay rate for averaging of stepsize factor*/
+
+typedef struct
+{ mc_value *q;		/* Position */
+  mc_value *p;		/* Momentum */
+  mc_value *g;		/* Gradient of potential energy, if needed */
+  double pot;		/* Potential energy */
+} nuts_point;
+
+static int nuts_dim = 0;	/* Dimension that space is allocated for */
+static int nuts_depth = 0;	/* Maximum depth that space is allocated for */
+
+static nuts_point nuts_minus;	/* Backward end of whole trajectory */
+static nuts_point nuts_plus;	/* Forward end of whole trajectory */
+static nuts_point nuts_prop;	/* State selected from whole trajectory */
+static nuts_point *nuts_inner;	/* Inner end of subtree, for each depth */
+static nuts_point *nuts_sub;	/* State selected from subtree, for each depth */
+
+static nuts_point *nuts_edge;	/* End of trajectory being extended */
+static int nuts_dir;		/* Direction of extension, +1 or -1 */
+static double nuts_sf;		/* Stepsize factor */
+static double nuts_temp;	/* Temperature */
+static double nuts_H0;		/* Initial total energy, over temperature */
+static double nuts_log_u;	/* Log of slice level */
+static int nuts_steps;		/* Number of leapfrog steps done */
+static double nuts_alpha;	/* Sum of acceptance probabilities */
+
+static void nuts_alloc    (nuts_point *, int, int);
+static void nuts_copy     (nuts_point *, nuts_point *, int, int);
+static int  nuts_build    (mc_dynamic_state *, int, int *);
+static void nuts_leapfrog (mc_dynamic_state *, nuts_point *);
+static int  nuts_no_uturn (mc_dynamic_state *, nuts_point *, nuts_point *);
+static double nuts_kinetic(mc_dynamic_state *, mc_value *);
+
+void mc_nuts
+( mc_dynamic_state *ds,	/* State to update */
+  mc_iter *it,		/* Description of this iteration */
+  int max_depth,	/* Maximum depth of tree of trajectory doublings */
+  int adapt_count,	/* Number of calls to adapt stepsize for, or zero */
+  double adapt_target	/* Target acceptance statistic for adaptation */
+)
+{
+  mc_adapt_state *as;
+  nuts_point *old_inner, *old_sub;
+  double H, m, w;
+  int n, n1, s, j, moved;
+
+  /* Allocate space, if not done already. */
+
+  if (ds->dim!=nuts_dim || max_depth>nuts_depth)
+  { 
+    if (nuts_dim==0) 
+    { nuts_alloc (&nuts_minus, ds->dim, 1);
+      nuts_alloc (&nuts_plus, ds->dim, 1);
+      nuts_alloc (&nuts_prop, ds->dim, 1);
+    }
+    else if (ds->dim!=nuts_dim) abort();
+
+    /* Points for depths already allocated are kept, with only the arrays
+       holding them replaced, so just the new depths need space. */
+
+    old_inner = nuts_inner;
+    old_sub = nuts_sub;
+
+    nuts_inner = chk_alloc (max_depth, sizeof *nuts_inner);
+    nuts_sub   = chk_alloc (max_depth, sizeof *nuts_sub);
+    for (j = 0; j<max_depth; j++)
+    { if (j<nuts_depth)
+      { nuts_inner[j] = old_inner[j];
+        nuts_sub[j] = old_sub[j];
+      }
+      else
+      { nuts_alloc (&nuts_inner[j], ds->dim, 0);
+        nuts_alloc (&nuts_sub[j], ds->dim, 1);
+      }
+    }
+
+    if (nuts_depth>0)
+    { free (old_inner);
+      free (old_sub);
+    }
+
+    nuts_dim = ds->dim;
+    nuts_depth = max_depth;
+  }
+
+  /* Find the stepsize factor, which may have been adapted. */
+
+  as = adapt_count>0 ? ds->adapt_state : 0;
+
+  nuts_sf = it->stepsize_factor;
+  if (as)
+  { nuts_sf *= exp (as->count<adapt_count ? as->log_factor 
+                                          : as->log_factor_bar);
+  }
+
+  /* Set up the initial state as both ends of the trajectory, and as the
+     state selected so far. */
+
+  if (ds->know_grad!=1)
+  { mc_app_energy (ds, 1, 1, &ds->pot_energy, ds->grad);
+    ds->know_pot = 1;
+    ds->know_grad = 1;
+  }
+  else if (!ds->know_pot)
+  { mc_app_energy (ds, 1, 1, &ds->pot_energy, 0);
+    ds->know_pot = 1;
+  }
+
+  mc_value_copy (nuts_minus.q, ds->q, ds->dim);
+  mc_value_copy (nuts_minus.p, ds->p, ds->dim);
+  mc_value_copy (nuts_minus.g, ds->grad, ds->dim);
+  nuts_minus.pot = ds->pot_energy;
+
+  nuts_copy (&nuts_plus, &nuts_minus, ds->dim, 1);
+  nuts_copy (&nuts_prop, &nuts_minus, ds->dim, 1);
+
+  nuts_temp = it->temperature;
+  nuts_H0 = (ds->pot_energy + nuts_kinetic(ds,ds->p)) / nuts_temp;
+  nuts_log_u = log(rand_uniopen()) - nuts_H0;
+
+  nuts_steps = 0;
+  nuts_alpha = 0;
+
+  /* Double the trajectory until it makes a U-turn. */
+
+  moved = 0;
+  n = 1;
+  s = 1;
+
+  for (j = 0; s && j<max_depth; j++)
+  { 
+    nuts_dir = rand_int(2) ? +1 : -1;
+    nuts_edge = nuts_dir>0 ? &nuts_plus : &nuts_minus;
+
+    s = nuts_build (ds, j, &n1);
+
+    if (s && n1>0 && rand_uniform()*n < n1)
+    { nuts_copy (&nuts_prop, &nuts_sub[j], ds->dim, 1);
+      moved = 1;
+    }
+
+    n += n1;
+
+    s = s && nuts_no_uturn (ds, &nuts_minus, &nuts_plus);
+  }
+
+  /* Move to the selected state. */
+
+  mc_value_copy (ds->q, nuts_prop.q, ds->dim);
+  mc_value_copy (ds->p, nuts_prop.p, ds->dim);
+  mc_value_copy (ds->grad, nuts_prop.g, ds->dim);
+
+  H = nuts_prop.pot + nuts_kinetic(ds,nuts_prop.p);
+
+  ds->pot_energy = nuts_prop.pot;
+  ds->know_pot = 1;
+  ds->know_grad = 1;
+  ds->know_kinetic = 0;
+
+  it->proposals += 1;
+  it->move_point = nuts_steps;
+  it->delta = H - nuts_H0*nuts_temp;
+  if (!moved) it->rejects += 1;
+
+  /* Update the stepsize adaptation state. */
+
+  if (as && as->count<adapt_count)
+  { 
+    as->count += 1;
+    m = as->count;
+
+    w = 1 / (m+Adapt_t0);
+    as->h_bar = (1-w) * as->h_bar + w * (adapt_target - nuts_alpha/nuts_steps);
+    as->log_factor = Adapt_mu - sqrt(m) / Adapt_gamma * as->h_bar;
+
+    w = pow (m, -Adapt_kappa);
+    as->log_factor_bar = w * as->log_factor + (1-w) * as->log_factor_bar;
+  }
+}
+
+
+/* BUILD A SUBTREE FOR THE NO-U-TURN SAMPLER.  Extends the end of the 
+   trajectory in nuts_edge by 2^j steps in direction nuts_dir.  The inner 
+   end of the subtree is stored in nuts_inner[j], and the state selected
+   from it in nuts_sub[j].  The number of states in the subtree that are 
+   within the slice is stored in *n.  Returns zero if the trajectory should
+   be stopped, because of a U-turn or a divergence. */
+
+static int nuts_build
+( mc_dynamic_state *ds,	/* Dynamical state */
+  int j,		/* Depth of subtree */
+  int *n		/* Place to store number of states within slice */
+)
+{
+  double H;
+  int n1, n2, s;
+
+  if (j==0)
+  { 
+    nuts_leapfrog (ds, nuts_edge);
+    nuts_steps += 1;
+
+    H = (nuts_edge->pot + nuts_kinetic(ds,nuts_edge->p)) / nuts_temp;
+
+    nuts_alpha += H<=nuts_H0 ? 1 : exp(nuts_H0-H);
+
+    nuts_copy (&nuts_inner[0], nuts_edge, ds->dim, 0);
+    nuts_copy (&nuts_sub[0], nuts_edge, ds->dim, 1);
+
+    *n = nuts_log_u <= -H;
+
+    return nuts_log_u < Nuts_max_delta - H;
+  }
+
+  s = nuts_build (ds, j-1, &n1);
+
+  nuts_copy (&nuts_inner[j], &nuts_inner[j-1], ds->dim, 0);
+  nuts_copy (&nuts_sub[j], &nuts_sub[j-1], ds->dim, 1);
+
+  if (!s)
+  { *n = n1;
+    return 0;
+  }
+
+  s = nuts_build (ds, j-1, &n2);
+
+  if (n2>0 && rand_uniform()*(n1+n2) < n2)
+  { nuts_copy (&nuts_sub[j], &nuts_sub[j-1], ds->dim, 1);
+  }
+
+  *n = n1+n2;
+
+  return s && (nuts_dir>0 ? nuts_no_uturn (ds, &nuts_inner[j], nuts_edge)
+                          : nuts_no_uturn (ds, nuts_edge, &nuts_inner[j]));
+}
+
+
+/* DO ONE LEAPFROG STEP FOR THE NO-U-TURN SAMPLER.  The position is moved
+   into ds->q for the energy evaluation, since that is where the 
+   application looks for it. */
+
+static void nuts_leapfrog
+( mc_dynamic_state *ds,	/* Dynamical state */
+  nuts_point *e		/* Point to move */
+)
+{
+  double sf;
+  int k;
+
+  sf = nuts_dir * nuts_sf;
+
+  for (k = 0; k<ds->dim; k++)
+  { e->p[k] -= (sf/2) * ds->stepsize[k] * e->g[k];
+    ds->q[k] = e->q[k] + sf * ds->stepsize[k] * e->p[k];
+  }
+
+  mc_app_energy (ds, 1, 1, &e->pot, e->g);
+
+  for (k = 0; k<ds->dim; k++)
+  { e->p[k] -= (sf/2) * ds->stepsize[k] * e->g[k];
+    e->q[k] = ds->q[k];
+  }
+}
+
+
+/* CHECK THAT THE ENDS OF A TRAJECTORY ARE NOT COMING CLOSER TOGETHER.  
+   The velocity for each coordinate is its momentum times its stepsize. */
+
+static int nuts_no_uturn
+( mc_dynamic_state *ds,	/* Dynamical state */
+  nuts_point *minus,	/* Backward end of trajectory */
+  nuts_point *plus	/* Forward end of trajectory */
+)
+{
+  double d, sm, sp;
+  int k;
+
+  sm = sp = 0;
+
+  for (k = 0; k<ds->dim; k++)
+  { d = (plus->q[k] - minus->q[k]) * ds->stepsize[k];
+    sm += d * minus->p[k];
+    sp += d * plus->p[k];
+  }
+
+  return sm>=0 && sp>=0;
+}
+
+
+/* KINETIC ENERGY FOR GIVEN MOMENTUM. */
+
+static double nuts_kinetic
+( mc_dynamic_state *ds,	/* Dynamical state */
+  mc_value *p		/* Momentum */
+)
+{
+  double K;
+  int k;
+
+  K = 0;
+
+  for (k = 0; k<ds->dim; k++)
+  { K += p[k] * p[k];
+  }
+
+  return K / 2;
+}
+
+
+/* ALLOCATE SPACE FOR A POINT USED BY THE NO-U-TURN SAMPLER. */
+
+static void nuts_alloc
+( nuts_point *e,	/* Point to allocate space for */
+  int dim,		/* Dimension of space */
+  int need_g		/* Is space for the gradient needed? */
+)
+{
+  e->q = chk_alloc (dim, sizeof (mc_value));
+  e->p = chk_alloc (dim, sizeof (mc_value));
+  e->g = need_g ? chk_alloc (dim, sizeof (mc_value)) : 0;
+}
+
+
+/* COPY A POINT USED BY THE NO-U-TURN SAMPLER. */
+
+static void nuts_copy
+( nuts_point *to,	/* Point to copy to */
+  nuts_point *from,	/* Point to copy from */
+  int dim,		/* Dimension of space */
+  int need_g		/* Should the gradient and energy be copied too? */
+)
+{
+  mc_value_copy (to->q, from->q, dim);
+  mc_value_copy (to->p, from->p, dim);
+
+  if (need_g)
+  { mc_value_copy (to->g, from->g, dim);
+    to->pot = from->pot;
+  }
+}
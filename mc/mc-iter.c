@@ -34,6 +34,10 @@ static int echo = 0;		/* Debug option - echos operations first time */
 
 #define Max_temp_repeat	1000	/* Max repeat count in a tempered transition */
 
+#define Mass_prior 5		/* Number of states that the stepsizes from the
+				   application count as, when the stepsizes are
+				   found from adapted masses */
+
 
 /* LOCAL VARIABLES. */
 
@@ -71,6 +75,12 @@ static mc_value *p_asv;	/* Place to save p values for accept state */
 static mc_value *q_rsv;	/* Place to save q values for reject state */
 static mc_value *p_rsv;	/* Place to save p values for reject state */
 
+static int need_adapt;	/* Do we need a stepsize adaptation state? */
+static int need_mass;	/* Do we need a mass adaptation state? */
+
+static int need_gvar;	/* Do we need space for gradient noise estimates? */
+static mc_value *gvar;	/* Place to store variances of stochastic gradient */
+
 static int print_index;	/* Index used to label printed quantities */
 
 
@@ -80,6 +90,9 @@ static int print_index;	/* Index used to label printed quantities */
 static void do_group (mc_dynamic_state *, mc_iter *, int, int, int,
                       log_gobbled *, quantities_described, int);
 
+static void set_stepsizes (mc_dynamic_state *);
+static void adapt_mass (mc_dynamic_state *, int);
+
 void mc_simulated_tempering (mc_dynamic_state *, mc_iter *);
 void mc_tempered_transition (mc_dynamic_state *, mc_iter *, 
                              int, int, int, log_gobbled *, 
@@ -116,7 +129,7 @@ void mc_iter_init
   sch = sch0;
 
   need_p = need_grad = need_save = need_lowhigh = need_wsum =
-           need_savet = need_arsv = 0;
+           need_savet = need_arsv = need_gvar = need_adapt = need_mass = 0;
 
   does_print = 0;
 
@@ -172,6 +185,18 @@ void mc_iter_init
     { need_wsum = 1;
     }
 
+    if (type=='K' && ops->op[i].noise_est)
+    { need_gvar = 1;
+    }
+
+    if (type=='Z' && ops->op[i].adapt_count>0)
+    { need_adapt = 1;
+    }
+
+    if (type=='V')
+    { need_mass = 1;
+    }
+
     if (type=='p') 
     { does_print = 1;   
     }
@@ -200,6 +225,10 @@ void mc_iter_init
   { wsum = chk_alloc (ds->dim, sizeof *lowb);
   }
 
+  if (need_gvar)
+  { gvar = chk_alloc (ds->dim, sizeof *gvar);
+  }
+
   if (need_savet)
   { q_savet = chk_alloc (ds->dim, sizeof *q_savet);
     p_savet = chk_alloc (ds->dim, sizeof *p_savet);
@@ -250,6 +279,26 @@ void mc_iteration
     ds->know_grad = 0;
   }
 
+  /* Create stepsize adaptation state if needed, with no adaptation done. */
+
+  if (need_adapt && ds->adapt_state==0)
+  { 
+    ds->adapt_state = chk_alloc (1, sizeof (mc_adapt_state));
+    ds->adapt_state->count = 0;
+    ds->adapt_state->reserved = 0;
+    ds->adapt_state->log_factor = 0;
+    ds->adapt_state->log_factor_bar = 0;
+    ds->adapt_state->h_bar = 0;
+  }
+
+  /* Create mass adaptation state if needed, with no states seen yet. */
+
+  if (need_mass && ds->mass_state==0)
+  { 
+    ds->mass_state = chk_alloc (2+2*ds->dim, sizeof (mc_value));
+    for (j = 0; j<2+2*ds->dim; j++) ds->mass_state[j] = 0;
+  }
+
   /* Initialize fields describing iteration, except those that are additive. */
 
   it->stepsize_factor = 1.0;
@@ -329,7 +378,7 @@ static void do_group
      || type=='D' || type=='P' || type=='H' || type=='T'
      || type=='@' || type=='^' || type=='i' || type=='o' 
      || type=='h' || type=='G' || type=='g' || type=='l'
-     || type=='u')
+     || type=='u' || type=='K' || type=='Z')
     { 
       stepsize_adjust = ops->op[i].stepsize_adjust;
 
@@ -349,7 +398,7 @@ static void do_group
         have_ss = 0;
       }
       else if (!have_ss)
-      { mc_app_stepsizes (ds);
+      { set_stepsizes (ds);
         have_ss = 1;
       }
     }
@@ -369,7 +418,7 @@ static void do_group
 
       case 'x':
       { if (!have_ss)
-        { mc_app_stepsizes (ds);
+        { set_stepsizes (ds);
           have_ss = 1;
         }
         for (k = (ops->op[i].firsti==-1 ? 0 : ops->op[i].firsti); 
@@ -472,6 +521,24 @@ static void do_group
         break;
       }
 
+      case 'K':
+      { mc_sghmc (ds, it, ops->op[i].steps, ops->op[i].batch_size,
+                  ops->op[i].heatbath_decay, 
+                  ops->op[i].noise_est ? gvar : 0);
+        break;
+      }
+
+      case 'Z':
+      { mc_nuts (ds, it, ops->op[i].steps, ops->op[i].adapt_count,
+                 ops->op[i].adapt_target);
+        break;
+      }
+
+      case 'V':
+      { adapt_mass (ds, ops->op[i].adapt_count);
+        break;
+      }
+
       case 'S':
       { mc_slice_1 (ds, it, ops->op[i].firsti, ops->op[i].lasti, 
                     ops->op[i].steps, ops->op[i].r_update, ops->op[i].s_factor,
@@ -643,6 +710,85 @@ static void do_group
 }
 
 
+/* SET THE STEPSIZES FOR DYNAMICAL OPERATIONS.  The stepsizes are those
+   from the application, unless there is an "adapt-mass" operation and the
+   masses have been fixed.  The stepsize for each coordinate is then the
+   square root of its estimated variance, with the square of the
+   application's stepsize counting as the variance for Mass_prior states.
+   These are rescaled to have the same geometric mean as the application's
+   stepsizes, since the marginal variances of strongly correlated
+   coordinates greatly overstate the scale on which they can be changed
+   together.  Only the relative stepsizes are thus adapted, and stepsize
+   adjustment factors keep their meaning. */
+
+static void set_stepsizes
+( mc_dynamic_state *ds	/* Current state */
+)
+{
+  mc_value *ms, *m2;
+  double h, l;
+  int k;
+
+  mc_app_stepsizes (ds);
+
+  ms = ds->mass_state;
+
+  if (!need_mass || ms==0 || ms[1]==0) return;
+
+  m2 = ms + 2 + ds->dim;
+
+  l = 0;
+
+  for (k = 0; k<ds->dim; k++)
+  { h = ds->stepsize[k];
+    l += log(h);
+    ds->stepsize[k] = sqrt ((m2[k] + Mass_prior*h*h) / (ms[0]-1+Mass_prior));
+    l -= log(ds->stepsize[k]);
+  }
+
+  l = exp (l/ds->dim);
+
+  for (k = 0; k<ds->dim; k++)
+  { ds->stepsize[k] *= l;
+  }
+}
+
+
+/* ADAPT THE MASSES.  Adds the current state to the estimates of the means
+   and variances of the position coordinates (by Welford's method), and
+   fixes the masses once 'count' states have been seen. */
+
+static void adapt_mass
+( mc_dynamic_state *ds,	/* Current state */
+  int count		/* Number of states to base the masses on */
+)
+{
+  mc_value *ms, *mean, *m2;
+  double d;
+  int k;
+
+  ms = ds->mass_state;
+
+  if (ms[1]!=0) return;
+
+  mean = ms + 2;
+  m2 = ms + 2 + ds->dim;
+
+  ms[0] += 1;
+
+  for (k = 0; k<ds->dim; k++)
+  { d = ds->q[k] - mean[k];
+    mean[k] += d / ms[0];
+    m2[k] += d * (ds->q[k] - mean[k]);
+  }
+
+  if (ms[0]>=count)
+  { ms[1] = 1;
+    have_ss = 0;
+  }
+}
+
+
 /* PERFORM SIMULATED TEMPERING UPDATE.  Does a Metropolis update for a
    proposal to increase or decrease the inverse temperature. */
 
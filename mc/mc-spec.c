@@ -525,6 +525,90 @@ main
       }
     }
 
+    else if (strcmp(*ap,"sghmc")==0)
+    {
+      ops->op[o].type = 'K';
+
+      ops->op[o].stepsize_adjust = 1;
+      ops->op[o].stepsize_alpha = 0;
+      ops->op[o].noise_est = 0;
+
+      ap += 1;
+
+      if (*ap && strcmp(*ap,"-c")==0)
+      { ops->op[o].noise_est = 1;
+        ap += 1;
+      }
+
+      if (!*ap || !strchr("0123456789",**ap)) usage();
+
+      if ((ops->op[o].steps = atoi(*ap))<=0) usage();
+      if (strchr(*ap,'/')==0) usage();
+      if ((ops->op[o].batch_size = atoi(strchr(*ap,'/')+1))<=0) usage();
+
+      ap += 1;
+
+      if (!*ap || !strchr("0123456789.",**ap)) usage();
+
+      ops->op[o].heatbath_decay = atof(*ap);
+      if (ops->op[o].heatbath_decay<=0 || ops->op[o].heatbath_decay>1)
+      { fprintf(stderr,"Friction for sghmc must be in (0,1]\n");
+        exit(1);
+      }
+
+      ap += 1;
+
+      if (*ap && strchr("0123456789+-.",**ap))
+      { if ((ops->op[o].stepsize_adjust = atof(*ap))==0) usage();
+        if (strchr(*ap,':')!=0)
+        { if ((ops->op[o].stepsize_alpha = atof(strchr(*ap,':')+1))==0) usage();
+        }
+        ap += 1;
+      }
+    }
+
+    else if (strcmp(*ap,"nuts")==0)
+    {
+      ops->op[o].type = 'Z';
+
+      ops->op[o].steps = 10;
+      ops->op[o].stepsize_adjust = 1;
+      ops->op[o].stepsize_alpha = 0;
+      ops->op[o].adapt_count = 0;
+      ops->op[o].adapt_target = 0.8;
+
+      ap += 1;
+
+      if (*ap && strcmp(*ap,"-a")==0)
+      { ap += 1;
+        if (!*ap || !strchr("0123456789",**ap)) usage();
+        if ((ops->op[o].adapt_count = atoi(*ap))<0) usage();
+        if (strchr(*ap,':')!=0)
+        { ops->op[o].adapt_target = atof(strchr(*ap,':')+1);
+          if (ops->op[o].adapt_target<=0 || ops->op[o].adapt_target>=1)
+          { fprintf(stderr,"Target for adaptation must be in (0,1)\n");
+            exit(1);
+          }
+        }
+        ap += 1;
+      }
+
+      if (*ap && strchr("0123456789",**ap))
+      { if ((ops->op[o].steps = atoi(*ap))<=0) usage();
+        ap += 1;
+
+        if (*ap && strchr("0123456789+-.",**ap))
+        { if ((ops->op[o].stepsize_adjust = atof(*ap))==0) usage();
+          if (strchr(*ap,':')!=0)
+          { if ((ops->op[o].stepsize_alpha = atof(strchr(*ap,':')+1))==0) 
+            { usage();
+            }
+          }
+          ap += 1;
+        }
+      }
+    }
+
     else if (strcmp(*ap,"repeat")==0)
     {
       ops->op[o].type = 'R';
@@ -561,6 +645,17 @@ main
       }
     }
 
+    else if (strcmp(*ap,"adapt-mass")==0)
+    {
+      ops->op[o].type = 'V';
+
+      ap += 1;
+
+      if (!*ap || !strchr("0123456789",**ap)) usage();
+
+      if ((ops->op[o].adapt_count = atoi(*ap++))<2) usage();
+    }
+
     else if (strcmp(*ap,"temp-trans")==0)
     {
       ops->op[o].type = 't';
@@ -1091,6 +1186,42 @@ static void display_specs
           break;
         }
 
+        case 'Z':
+        { printf(" nuts");
+          if (ops->op[o].adapt_count!=0)
+          { printf(" -a %d:%.4f",ops->op[o].adapt_count,
+                                 ops->op[o].adapt_target);
+          }
+          printf(" %d",ops->op[o].steps);
+          if (ops->op[o].stepsize_alpha!=0)
+          { printf(" %.4f:%.4f",ops->op[o].stepsize_adjust,
+                                ops->op[o].stepsize_alpha);
+          }
+          else if (ops->op[o].stepsize_adjust!=1)
+          { printf(" %.4f",ops->op[o].stepsize_adjust);
+          }
+          printf("\n");
+          break;
+        }
+
+        case 'K':
+        { printf(" sghmc");
+          if (ops->op[o].noise_est)
+          { printf(" -c");
+          }
+          printf(" %d/%d %.6f",ops->op[o].steps,ops->op[o].batch_size,
+                               ops->op[o].heatbath_decay);
+          if (ops->op[o].stepsize_alpha!=0)
+          { printf(" %.4f:%.4f",ops->op[o].stepsize_adjust,
+                                ops->op[o].stepsize_alpha);
+          }
+          else if (ops->op[o].stepsize_adjust!=1)
+          { printf(" %.4f",ops->op[o].stepsize_adjust);
+          }
+          printf("\n");
+          break;
+        }
+
         case 's':
         { printf(" sim-temp\n");
           break;
@@ -1133,6 +1264,11 @@ static void display_specs
           break;
         }
   
+        case 'V':
+        { printf(" adapt-mass %d\n",ops->op[o].adapt_count);
+          break;
+        }
+
         case 't':
         { printf(" temp-trans\n");
           depth += 1;
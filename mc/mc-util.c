@@ -23,6 +23,16 @@
 #include "log.h"
 #include "mc.h"
 
+#ifdef MC_MPI
+#include <mpi.h>
+#endif
+
+
+/* PROCESS INDEX AND NUMBER OF PROCESSES.  Set in mc.c when run with MPI. */
+
+int mc_rank = 0;
+int mc_ranks = 1;
+
 
 /* SET REQUIRED RECORD SIZES. */
 
@@ -38,6 +48,7 @@ void mc_record_sizes
   logg->req_size['t'] = sizeof (mc_traj);
   logg->req_size['b'] = sizeof (mc_temp_state);
   logg->req_size['m'] = sizeof (mc_temp_sched);
+  logg->req_size['a'] = sizeof (mc_adapt_state);
 }
 
 
@@ -174,3 +185,49 @@ void mc_value_copy
     n -= 1;
   }
 }
+
+
+/* ADD UP PARTIAL SUMS FOR BLOCKS OVER ALL PROCESSES.  Stores in v the
+   sums of the n values for each of the N_blocks blocks in 'blocks', which
+   hold the partial sums for consecutive blocks of cases, n values for each
+   block.  The blocks are added one after another starting from zero, in
+   order of the blocks, and when there are several processes, the blocks of
+   each process follow those of the process before it.  The running sums are
+   passed from each process to the next, and the sums found by the last are
+   sent to all processes.  The additions are therefore done in the same
+   order for any number of processes, so that when the blocks are the same
+   the results are exactly the same as those of a single process, and the
+   simulations stay identical. */
+
+void mc_sum_over_ranks
+( double *v,		/* Place to store the sums */
+  double *blocks,	/* Partial sums for the blocks of this process */
+  int N_blocks,		/* Number of blocks in this process */
+  int n			/* Number of values for each block */
+)
+{
+  int b, i;
+
+#ifdef MC_MPI
+  if (mc_rank>0)
+  { MPI_Recv (v, n, MPI_DOUBLE, mc_rank-1, 0, MPI_COMM_WORLD, 
+              MPI_STATUS_IGNORE);
+  }
+  else
+#endif
+  { for (i = 0; i<n; i++) v[i] = 0;
+  }
+
+  for (b = 0; b<N_blocks; b++)
+  { for (i = 0; i<n; i++) v[i] += blocks[(long)b*n+i];
+  }
+
+#ifdef MC_MPI
+  if (mc_ranks>1)
+  { if (mc_rank<mc_ranks-1)
+    { MPI_Send (v, n, MPI_DOUBLE, mc_rank+1, 0, MPI_COMM_WORLD);
+    }
+    MPI_Bcast (v, n, MPI_DOUBLE, mc_ranks-1, MPI_COMM_WORLD);
+  }
+#endif
+}
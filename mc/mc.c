@@ -28,6 +28,10 @@
 #include "mc.h"
 #include "quantities.h"
 
+#ifdef MC_MPI
+#include <mpi.h>
+#endif
+
 
 /* CLOCKS_PER_SEC should be defined by <time.h>, but it seems that it
    isn't always.  1000000 seems to be the best guess for Unix systems. */
@@ -44,6 +48,10 @@ enum { PLT, TBL, HIST } program_type = PLT;
 
 static void usage(void);
 
+#ifdef MC_MPI
+static void abort_ranks(void);
+#endif
+
 
 /* MAIN PROGRAM. */
 
@@ -81,6 +89,23 @@ main
   unsigned new_clock; /* that type is inexplicably declared signed on most    */
                       /* systems, cutting the already-too-small range in half */
 
+  /* Start up the processes, if run with MPI.  Only process 0 prints the
+     quantities requested.  A process that exits because of an error takes
+     the others down with it, rather than leaving them waiting for it. */
+
+#ifdef MC_MPI
+  MPI_Init (&argc, &argv);
+  MPI_Comm_rank (MPI_COMM_WORLD, &mc_rank);
+  MPI_Comm_size (MPI_COMM_WORLD, &mc_ranks);
+
+  atexit (abort_ranks);
+
+  if (mc_rank>0 && freopen ("/dev/null", "w", stdout)==NULL)
+  { fprintf(stderr,"Can't redirect standard output\n");
+    exit(1);
+  }
+#endif
+
   /* Look at program arguments. */
 
   coupled = 0;
@@ -135,9 +160,15 @@ main
     exit(-1);
   }
 
-  /* Open log file and read all records. */
+  if (mc_ranks>1 && (coupled || timelimit))
+  { fprintf(stderr,
+     "Coupling and time limits are not allowed with several processes\n");
+    exit(-1);
+  }
 
-  log_file_open (&logf, 1);
+  /* Open log file and read all records.  Only process 0 writes to it. */
+
+  log_file_open (&logf, mc_rank==0);
 
   log_gobble_init(&logg,0);
   mc_record_sizes(&logg);
@@ -148,6 +179,10 @@ main
 
   index = log_gobble_last(&logf,&logg);
 
+#ifdef MC_MPI
+  MPI_Barrier (MPI_COMM_WORLD);  /* Nothing is written before all have read */
+#endif
+
   if (!timelimit && index>max)
   { fprintf(stderr,"Iterations up to %d already exist in log file\n",max);
     exit(1);
@@ -220,6 +255,19 @@ main
   { ds.temp_index = mc_temp_index (sch, ds.temp_state->inv_temp);
   }
 
+  ds.adapt_state = logg.data['a'];
+
+  ds.mass_state = logg.data['v'];
+
+  if (ds.mass_state!=0)
+  { if (logg.actual_size['v'] != (2+2*ds.dim) * sizeof (mc_value))
+    { fprintf(stderr,"Mass adaptation record has wrong size (in mc.c)\n");
+      exit(1);
+    }
+  }
+
+  logg.req_size['v'] = (2+2*ds.dim) * sizeof (mc_value);
+
 #if 0
 
   ds.therm_state = logg.data['h'];
@@ -290,7 +338,7 @@ main
 
     /* Save to file, and check for coalescence if coupling. */
 
-    if (index%modulus==0)
+    if (index%modulus==0 && mc_rank==0)
     { 
       /* Read records at current index from coupled log file.  Enable 
          comparison by log_append. */
@@ -321,6 +369,20 @@ main
         logf.header.size = sizeof (mc_temp_state);
         log_file_append (&logf, ds.temp_state);
       }
+
+      if (ds.adapt_state!=0)
+      { logf.header.type = 'a';
+        logf.header.index = index;
+        logf.header.size = sizeof (mc_adapt_state);
+        log_file_append (&logf, ds.adapt_state);
+      }
+
+      if (ds.mass_state!=0)
+      { logf.header.type = 'v';
+        logf.header.index = index;
+        logf.header.size = (2+2*ds.dim) * sizeof (mc_value);
+        log_file_append (&logf, ds.mass_state);
+      }
 #if 0
       if (ds.therm_state!=0)
       { logf.header.type = 'h';
@@ -386,10 +448,35 @@ main
 
   log_file_close(&logf);
 
+#ifdef MC_MPI
+  MPI_Finalize();
+#endif
+
   exit(0);
 }
 
 
+/* ABORT ALL PROCESSES ON AN EARLY EXIT.  Registered with atexit, so that
+   it is called when a process exits, in any module, before MPI_Finalize,
+   as it does after an error.  The processes that did not see the error
+   would otherwise wait forever in the next collective operation. */
+
+#ifdef MC_MPI
+
+static void abort_ranks(void)
+{
+  int finalized;
+
+  MPI_Finalized (&finalized);
+
+  if (!finalized)
+  { MPI_Abort (MPI_COMM_WORLD, 1);
+  }
+}
+
+#endif
+
+
 /* DISPLAY USAGE MESSAGE AND EXIT. */
 
 static void usage(void)
@@ -18,8 +18,8 @@
    give the one-character ids of operations needing various things to 
    operate. */
 
-#define MC_needs_p	"BNDPhHT@^ior*=X"	/* Need momentum variables */
-#define MC_needs_grad	"DPHT@^hiol"		/* Need gradient computed  */
+#define MC_needs_p	"BNDPhHT@^ior*=XKZ"	/* Need momentum variables */
+#define MC_needs_grad	"DPHT@^hiolKZ"		/* Need gradient computed  */
 
 
 /* OPERATIONS TO PERFORM EACH ITERATION.  This array of structures lists
@@ -44,7 +44,8 @@ typedef struct
     int repeat_count;	  /* Repetition count for type 'R'' */
 
     int steps;		  /* Number of steps in trajectory, or max steps, or
-                             max intervals for slice sampling */
+                             max intervals for slice sampling, or maximum
+                             tree depth for the no-U-turn sampler */
 
     float stepsize_adjust;/* Adjustment factor for stepsizes */
     float stepsize_alpha; /* Gamma param for stepsize dist, zero is infinity */
@@ -54,8 +55,9 @@ typedef struct
 
     float heatbath_decay; /* Momentum decay for heatbath step, also factor
                              for multiply-momentum operation minus 1, value
-			     for set-momentum operation, and amount of
-                             mixing for mix-momentum. */
+			     for set-momentum operation, amount of
+                             mixing for mix-momentum, and friction for
+                             stochastic gradient dynamics. */
 
     float temper_factor;  /* Tempering factor for tempered hybrid Monte Carlo */
     float app_param;	  /* Parameter for application-specific procedure */
@@ -87,7 +89,15 @@ typedef struct
 
     float app_param2;	  /* Second application-specific parameter */
 
-    int reserved[4];      /* Reserved for future use */
+    int batch_size;	  /* Number of training cases in each mini-batch for
+                             stochastic gradient dynamics */
+    int noise_est;	  /* 1 if the gradient noise is to be estimated and
+                             corrected for in stochastic gradient dynamics */
+
+    int adapt_count;	  /* Number of no-U-turn operations for which the
+                             stepsize is adapted, zero if not adapted, or
+                             number of states used to adapt the masses */
+    float adapt_target;	  /* Target acceptance statistic for adaptation */
 
     char appl[101];	  /* Name of application-specific procedure */
 
@@ -182,6 +192,35 @@ typedef struct
 #endif
 
 
+/* STEPSIZE ADAPTATION STATE.  This structure holds the state of the dual
+   averaging scheme used to adapt the stepsize for the no-U-turn sampler.
+   The stepsize is multiplied by exp(log_factor) while adaptation is going
+   on, and by exp(log_factor_bar) once it is over. 
+
+   Stored in log files under type 'a'.  Changes may invalidate old log files. */
+
+typedef struct
+{
+  int count;		/* Number of adaptation updates done so far */
+  int reserved;		/* Reserved for future use */
+
+  double log_factor;	/* Log of stepsize factor used during adaptation */
+  double log_factor_bar;/* Log of averaged stepsize factor, used afterwards */
+  double h_bar;		/* Average of target minus acceptance statistic */
+
+} mc_adapt_state;
+
+
+/* MASS ADAPTATION STATE.  The masses for the dynamical variables (ie, the
+   stepsizes) are adapted by estimating the variance of each position
+   variable from the states seen by the "adapt-mass" operation.  The state
+   is held in an array of 2+2*dim values: the number of states seen so far,
+   whether the masses have been fixed (0 or 1), the means of the position
+   variables, and the sums of squared deviations from these means.
+
+   Stored in log files under type 'v'.  Changes may invalidate old log files. */
+
+
 /* INFO ON MONTE CARLO ITERATION.  This structure records various bits of 
    information concerning the current iteration.  The temperature and decay
    values are derived from user specifications; the approx_order field is
@@ -237,6 +276,9 @@ typedef struct
 
   mc_temp_state *temp_state; /* State for simulated tempering */
   int temp_index;	/* Index of inverse temperature in schedule */
+
+  mc_adapt_state *adapt_state; /* State of stepsize adaptation, or zero */
+  mc_value *mass_state;	/* State of mass adaptation, or zero */
 #if 0
   mc_therm_state *therm_state; /* State of thermostat when doing that */
 #endif
@@ -268,6 +310,23 @@ extern int mc_app_zero_gen (mc_dynamic_state *);
 
 extern void mc_app_stepsizes (mc_dynamic_state *);
 
+extern int mc_app_batch_grad (mc_dynamic_state *, int, mc_value *, mc_value *);
+
+
+/* PROCESSES SHARING A SIMULATION.  When compiled with MC_MPI defined (see
+   make.include), xxx-mc may be run as several MPI processes, each holding
+   a part of the training cases (see xxx-mc.doc).  All processes do the same
+   simulation, with the same random numbers, and the application adds up
+   the likelihood parts of the energy and its gradient over processes with
+   mc_sum_over_ranks, from partial sums for blocks of cases, so that the
+   results do not depend on the number of processes.  Only process 0 writes
+   to the log file.  If a process exits before the end, all are aborted. */
+
+extern int mc_rank;	/* Index of this process, from 0 */
+extern int mc_ranks;	/* Number of processes, 1 if not run with MPI */
+
+void mc_sum_over_ranks (double *, double *, int, int);
+
 
 /* MARKOV CHAIN MONTE CARLO PROCEDURES. */
 
@@ -305,6 +364,10 @@ void mc_hybrid2 (mc_dynamic_state *, mc_iter *, mc_traj *, int, int, int,
 void mc_spiral (mc_dynamic_state *, mc_iter *, mc_traj *, int, double, int,
                 mc_value *, mc_value *, mc_value *, mc_value *);
 
+void mc_sghmc (mc_dynamic_state *, mc_iter *, int, int, double, mc_value *);
+
+void mc_nuts (mc_dynamic_state *, mc_iter *, int, int, double);
+
 void mc_slice_1      (mc_dynamic_state *, mc_iter *, int, int, int, int, 
                       int, double);
 void mc_slice        (mc_dynamic_state *, mc_iter *, 
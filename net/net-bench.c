@@ -0,0 +1,662 @@
+/* NET-BENCH.C - Program to time the computations done in network training. */
+
+/* Copyright (c) 1995-2004 by Radford M. Neal
+ *
+ * Permission is granted for anyone to copy, use, modify, or distribute this
+ * program and accompanying programs and documents for any purpose, provided
+ * this copyright notice is retained and prominently displayed, along with
+ * a note saying that the original programs are available from Radford Neal's
+ * web page, and note is made of any changes made to the programs.  The
+ * programs and documents are distributed without any warranty, express or
+ * implied.  As the programs were written for research purposes only, they have
+ * not been tested to the degree that would be advisable in any important
+ * application.  All use of these programs is entirely at the user's own risk.
+ */
+
+/* This program is not part of the original FBM distribution.  It times the
+ * routines that dominate the training (net_func, net_model_prob, net_back,
+ * net_grad_w, mc_app_energy and whole Markov chain iterations), and appends
+ * the results to a file in CSV format, so that changes in performance can be
+ * tracked.  It also measures the memory bandwidth achieved on the training
+ * data by the threads on each NUMA node.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE		/* For sched_getcpu */
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "misc.h"
+#include "rand.h"
+#include "log.h"
+#include "mc.h"
+#include "data.h"
+#include "prior.h"
+#include "model.h"
+#include "net.h"
+#include "net-data.h"
+
+
+/* CLOCKS_PER_SEC should be defined by <time.h>, but it seems that it
+   isn't always.  1000000 seems to be the best guess for Unix systems. */
+
+#ifndef CLOCKS_PER_SEC
+#define CLOCKS_PER_SEC 1000000	/* Best guess */
+#endif
+
+
+/* THE FOLLOWING IS NEEED BY THE PLOTTING ROUTINES. */
+
+enum { PLT, TBL, HIST } program_type;
+
+
+/* DESCRIPTION OF THE PROBLEM BEING TIMED.  Used to label the results. */
+
+static net_arch *arch;		/* Network architecture */
+static int N_cases;		/* Number of cases that are looped over */
+static FILE *out;		/* File to append the results to */
+
+
+static void usage (void);
+
+static void bench_kernels (net_flags *, model_specification *, net_sigmas *,
+                           net_params *, net_values *, double *, int,
+                           double *, int);
+
+static void bench_bandwidth (net_value *, int, int);
+
+static void report (char *, int, double);
+
+static double cpu_time (void);
+static double wall_time (void);
+static int cpu_node (void);
+
+
+/* MAIN PROGRAM. */
+
+main
+( int argc,
+  char **argv
+)
+{
+  mc_dynamic_state ds;
+
+  log_file logf;
+  log_gobbled logg;
+
+  net_arch arch0;
+  net_flags *flgs;
+  model_specification *model, model0;
+  net_sigmas sigmas;
+  net_params params;
+
+  net_values *cases;
+  net_value *value_block;
+  double *targets;
+  int value_count;
+
+  char *out_file;
+  int synthetic, index, reps;
+
+  double E, t;
+  mc_value *gr;
+  int i, r;
+
+  /* Look at program arguments. */
+
+  reps = 10;
+  out_file = 0;
+
+  argv += 1;
+  argc -= 1;
+
+  while (argc>0 && argv[0][0]=='-' && argv[0][1]!='s')
+  { if (argc<2) usage();
+    if (strcmp(argv[0],"-r")==0)
+    { if ((reps = atoi(argv[1]))<=0) usage();
+    }
+    else if (strcmp(argv[0],"-o")==0)
+    { out_file = argv[1];
+    }
+    else
+    { usage();
+    }
+    argv += 2;
+    argc -= 2;
+  }
+
+  synthetic = argc==4 && strcmp(argv[0],"-s")==0;
+
+  if (!synthetic && argc!=2) usage();
+
+  /* Open the file for the results, writing the header if it's new. */
+
+  out = stdout;
+
+  if (out_file!=0)
+  { out = fopen(out_file,"a");
+    if (out==NULL)
+    { fprintf(stderr,"Can't open results file: %s\n",out_file);
+      exit(1);
+    }
+    fseek(out,0,SEEK_END);
+  }
+
+  if (out==stdout || ftell(out)==0)
+  { fprintf(out,"benchmark,inputs,hidden,outputs,cases,calls,seconds,"
+                "us_per_call\n");
+  }
+
+  if (synthetic)
+  {
+    /* Set up a network with one hidden layer for binary data, with random
+       parameters, and random training cases. */
+
+    memset (&arch0, 0, sizeof arch0);
+    arch0.N_inputs = atoi(argv[1]);
+    arch0.N_layers = 1;
+    arch0.N_hidden[0] = atoi(argv[2]);
+    arch0.N_outputs = 1;
+    arch0.has_ih[0] = 1;
+    arch0.has_bh[0] = 1;
+    arch0.has_ho[0] = 1;
+    arch0.has_bo = 1;
+
+    N_cases = atoi(argv[3]);
+
+    if (arch0.N_inputs<=0 || arch0.N_inputs>Max_inputs
+     || arch0.N_hidden[0]<=0 || N_cases<=0)
+    { usage();
+    }
+
+    arch = &arch0;
+    flgs = 0;
+
+    memset (&model0, 0, sizeof model0);
+    model0.type = 'B';
+    model = &model0;
+
+    rand_seed(1);
+
+    params.total_params = net_setup_param_count(arch,flgs);
+    params.param_block = chk_alloc (params.total_params, sizeof (net_param));
+    net_setup_param_pointers (&params, arch, flgs);
+
+    for (i = 0; i<params.total_params; i++)
+    { params.param_block[i] = 0.3 * rand_gaussian();
+    }
+
+    sigmas.total_sigmas = net_setup_sigma_count(arch,flgs,model);
+    sigmas.sigma_block = chk_alloc (sigmas.total_sigmas, sizeof (net_sigma));
+    net_setup_sigma_pointers (&sigmas, arch, flgs, model);
+
+    value_count = net_setup_value_count(arch);
+    value_block = net_case_alloc (N_cases, value_count * sizeof (net_value));
+    cases = net_case_alloc (N_cases, sizeof (net_values));
+    targets = net_case_alloc (N_cases, sizeof (double));
+
+    for (i = 0; i<N_cases; i++)
+    { net_setup_value_pointers (&cases[i], value_block+value_count*i, arch);
+      for (r = 0; r<arch->N_inputs; r++)
+      { cases[i].i[r] = rand_gaussian();
+      }
+      targets[i] = rand_int(2);
+    }
+
+    bench_kernels (flgs, model, &sigmas, &params, cases, targets, 1, 0, reps);
+    bench_bandwidth (value_block, value_count, reps);
+
+    if (out!=stdout) fclose(out);
+    exit(0);
+  }
+
+  if ((index = atoi(argv[1]))<=0 && strcmp(argv[1],"0")!=0) usage();
+
+  /* Open log file and read records with indexes less than zero and with
+     index equal to that given. */
+
+  logf.file_name = argv[0];
+
+  log_file_open (&logf, 0);
+
+  log_gobble_init(&logg,0);
+  mc_record_sizes(&logg);
+
+  while (!logf.at_end && logf.header.index<0)
+  { log_gobble(&logf,&logg);
+  }
+
+  while (!logf.at_end && logf.header.index!=index)
+  { log_file_forward(&logf);
+  }
+
+  if (logf.at_end)
+  { fprintf(stderr,"No records with that index in log file\n");
+    exit(1);
+  }
+
+  log_gobble(&logf,&logg);
+
+  /* Initialize using records found.  This also reads the training data. */
+
+  ds.aux_dim = 0;
+  ds.aux = 0;
+
+  mc_app_initialize(&logg,&ds);
+
+  if (logg.data['r']!=0)
+  { rand_use_state(logg.data['r']);
+  }
+
+  arch  = logg.data['A'];
+  flgs  = logg.data['F'];
+  model = logg.data['M'];
+
+  if (model==0 || model->type==0 || model->type=='V')
+  { fprintf(stderr,"Timing requires a data model other than survival\n");
+    exit(1);
+  }
+
+  /* The single-case routines need all the values for each case, but only
+     the inputs are kept when mc_app_initialize chooses the fused 
+     computations, so the training data is read again in full. */
+
+  if (train_values==0)
+  { net_data_free();
+    net_data_read (1, 0, arch, model, 0);
+  }
+
+  N_cases = N_train;
+
+  /* The network parameters and hyperparameters are those in the dynamical
+     state, set up by mc_app_initialize. */
+
+  params.total_params = ds.dim;
+  params.param_block = ds.q;
+  net_setup_param_pointers (&params, arch, flgs);
+
+  sigmas.total_sigmas = ds.aux_dim;
+  sigmas.sigma_block = ds.aux;
+  net_setup_sigma_pointers (&sigmas, arch, flgs, model);
+
+  bench_kernels (flgs, model, &sigmas, &params, train_values, train_targets,
+                 data_spec->N_targets, train_weights, reps);
+  bench_bandwidth (train_values[0].i, net_setup_value_count(arch), reps);
+
+  /* Time the full energy function, with and without the gradient. */
+
+  gr = chk_alloc (ds.dim, sizeof *gr);
+
+  t = cpu_time();
+  for (r = 0; r<reps; r++)
+  { mc_app_energy (&ds, 1, 1, &E, 0);
+  }
+  report ("mc_app_energy", reps, cpu_time()-t);
+
+  t = cpu_time();
+  for (r = 0; r<reps; r++)
+  { mc_app_energy (&ds, 1, 1, &E, gr);
+  }
+  report ("mc_app_energy_grad", reps, cpu_time()-t);
+
+  /* Time a whole iteration, as specified in the log file.  Everything is set
+     up as in xxx-mc, but nothing is written back. */
+
+  if (logg.data['o']!=0)
+  {
+    static mc_traj tj0;
+    static mc_iter it0;
+
+    mc_traj *tj;
+    mc_iter *it;
+    mc_temp_sched *sch;
+    int j, na;
+
+    tj = logg.data['t'];
+
+    if (tj==0)
+    { tj = &tj0;
+      tj->type = 'L';
+      tj->halfp = 1;
+      tj->N_approx = 1;
+    }
+
+    it = &it0;
+
+    na = tj->N_approx>0 ? tj->N_approx : -tj->N_approx;
+    if (na>Max_approx) na = Max_approx;
+    for (j = 0; j<na; j++) it->approx_order[j] = j+1;
+
+    sch = logg.data['m'];
+
+    ds.p = logg.data['p'];
+    if (ds.p!=0 && logg.actual_size['p'] != ds.dim * sizeof (mc_value))
+    { ds.p = 0;
+    }
+
+    ds.temp_state = logg.data['b'];
+    if (ds.temp_state!=0)
+    { ds.temp_index = mc_temp_index (sch, ds.temp_state->inv_temp);
+    }
+
+    ds.adapt_state = logg.data['a'];
+
+    ds.mass_state = logg.data['v'];
+    if (ds.mass_state!=0
+     && logg.actual_size['v'] != (2+2*ds.dim) * sizeof (mc_value))
+    { ds.mass_state = 0;
+    }
+
+    ds.grad = 0;
+    ds.know_grad    = 0;
+    ds.know_pot     = 0;
+    ds.know_kinetic = 0;
+
+    mc_iter_init(&ds,logg.data['o'],tj,sch);
+
+    it->temperature = 1;
+    it->decay = -1;
+
+    t = cpu_time();
+    for (r = 0; r<reps; r++)
+    { mc_iteration (&ds, it, &logg, 0, 0);
+    }
+    report ("mc_iteration", reps, cpu_time()-t);
+  }
+
+  if (out!=stdout) fclose(out);
+
+  exit(0);
+}
+
+
+/* TIME THE ROUTINES FOR SINGLE CASES.  Each routine is applied to all the
+   cases, which is repeated the given number of times.  The derivatives for
+   net_back and net_grad_w are found beforehand, so that each routine is
+   timed on its own.  The fused computations in net-fast.c, which do the
+   work of all these routines, are timed too if they apply. */
+
+static void bench_kernels
+( net_flags *flgs,		/* Network flags, null if none */
+  model_specification *model,	/* Data model */
+  net_sigmas *sigmas,		/* Hyperparameters, including noise sigmas */
+  net_params *params,		/* Network parameters */
+  net_values *cases,		/* Values for the cases */
+  double *targets,		/* Targets for the cases */
+  int N_targets,		/* Number of targets per case */
+  double *weights,		/* Weights of the cases, null if all are one */
+  int reps			/* Number of passes over the cases */
+)
+{
+  net_values *deriv, *sc;
+  net_value *value_block;
+  net_params grad;
+  int value_count;
+  double pr, t;
+  int i, r;
+
+  value_count = net_setup_value_count(arch);
+  value_block = chk_alloc (value_count*N_cases, sizeof (net_value));
+  deriv = chk_alloc (N_cases, sizeof (net_values));
+
+  for (i = 0; i<N_cases; i++)
+  { net_setup_value_pointers (&deriv[i], value_block+value_count*i, arch);
+  }
+
+  grad.total_params = params->total_params;
+  grad.param_block = chk_alloc (grad.total_params, sizeof (net_param));
+  net_setup_param_pointers (&grad, arch, flgs);
+
+  t = cpu_time();
+  for (r = 0; r<reps; r++)
+  { for (i = 0; i<N_cases; i++)
+    { net_func (&cases[i], 0, arch, flgs, params);
+    }
+  }
+  report ("net_func", reps*N_cases, cpu_time()-t);
+
+  t = cpu_time();
+  for (r = 0; r<reps; r++)
+  { for (i = 0; i<N_cases; i++)
+    { net_model_prob (&cases[i], targets+N_targets*i, &pr, &deriv[i], arch,
+                      model, 0, sigmas, 2);
+    }
+  }
+  report ("net_model_prob", reps*N_cases, cpu_time()-t);
+
+  t = cpu_time();
+  for (r = 0; r<reps; r++)
+  { for (i = 0; i<N_cases; i++)
+    { net_back (&cases[i], &deriv[i], arch->has_ti ? -1 : 0, arch, flgs,
+                params);
+    }
+  }
+  report ("net_back", reps*N_cases, cpu_time()-t);
+
+  t = cpu_time();
+  for (r = 0; r<reps; r++)
+  { for (i = 0; i<N_cases; i++)
+    { net_grad_w (&grad, params, &cases[i], &deriv[i], arch, flgs,
+                  weights ? weights[i] : 1.0);
+    }
+  }
+  report ("net_grad_w", reps*N_cases, cpu_time()-t);
+
+  /* The fused computations replace all four routines above when they are
+     applicable to the network (see net-fast.c). */
+
+  if (net_fast_usable (arch, flgs, model, N_targets))
+  { double energy = 0;
+    sc = net_fast_scratch (arch);
+    t = cpu_time();
+    for (r = 0; r<reps; r++)
+    { net_fast_cases (cases[0].i, value_count, targets, weights, 
+                      0, N_cases, 0, N_cases, arch, params, &grad, &energy, 
+                      1.0, sc);
+    }
+    report ("net_fast_cases", reps*N_cases, cpu_time()-t);
+    net_fast_free_scratch (sc);
+  }
+
+  free(grad.param_block);
+  free(deriv);
+  free(value_block);
+}
+
+
+/* MEASURE THE MEMORY BANDWIDTH ON EACH NUMA NODE.  The values of all the
+   cases are read, with the blocks of Case_block cases divided among threads
+   as in the parallel passes over training cases, which is repeated the
+   given number of times.  For each NUMA node, a line is written for the
+   benchmark "bandwidth_node<n>", with the number of MiB read by the threads
+   running on that node in the 'calls' field, and the longest wall-clock
+   time taken by one of them in the 'seconds' field.  The node of a thread
+   is where it runs when it starts, which is meaningful only if threads are
+   bound to processors (see net-mc.doc). */
+
+static void bench_bandwidth
+( net_value *block,		/* Values for the cases, one after another */
+  int value_count,		/* Number of values for each case */
+  int reps			/* Number of passes over the cases */
+)
+{
+  double *bytes, *seconds, *sink;
+  int *node;
+  int N_threads, N_blocks, max_node, n, t;
+
+  N_threads = 1;
+#ifdef _OPENMP
+  N_threads = omp_get_max_threads();
+#endif
+
+  bytes   = chk_alloc (N_threads, sizeof *bytes);
+  seconds = chk_alloc (N_threads, sizeof *seconds);
+  sink    = chk_alloc (N_threads, sizeof *sink);
+  node    = chk_alloc (N_threads, sizeof *node);
+
+  N_blocks = (N_cases+Case_block-1) / Case_block;
+
+#ifdef _OPENMP
+# pragma omp parallel private(t)
+#endif
+  {
+    double s, t0;
+    long k, end;
+    int b, r;
+
+    t = 0;
+#ifdef _OPENMP
+    t = omp_get_thread_num();
+#endif
+
+    node[t] = cpu_node();
+    s = 0;
+
+#ifdef _OPENMP
+#   pragma omp barrier
+#endif
+
+    t0 = wall_time();
+
+    for (r = 0; r<reps; r++)
+    {
+#ifdef _OPENMP
+#     pragma omp for schedule(static) nowait
+#endif
+      for (b = 0; b<N_blocks; b++)
+      { end = (b+1)*Case_block < N_cases ? (b+1)*Case_block : N_cases;
+        end *= value_count;
+        for (k = (long) b*Case_block*value_count; k<end; k++)
+        { s += block[k];
+        }
+        bytes[t] += (double) (end - (long) b*Case_block*value_count) 
+                     * sizeof *block;
+      }
+    }
+
+    seconds[t] = wall_time() - t0;
+    sink[t] = s;  /* So that the reads are not optimized away */
+  }
+
+  max_node = 0;
+  for (t = 0; t<N_threads; t++)
+  { if (node[t]>max_node) max_node = node[t];
+  }
+
+  for (n = 0; n<=max_node; n++)
+  { 
+    double mib, sec;
+    char name[40];
+    int found;
+
+    found = 0;
+    mib = sec = 0;
+
+    for (t = 0; t<N_threads; t++)
+    { if (node[t]==n)
+      { found = 1;
+        mib += bytes[t] / (1<<20);
+        if (seconds[t]>sec) sec = seconds[t];
+      }
+    }
+
+    if (found)
+    { sprintf (name, "bandwidth_node%d", n);
+      report (name, (int) (mib+0.5), sec);
+    }
+  }
+
+  free(bytes);
+  free(seconds);
+  free(sink);
+  free(node);
+}
+
+
+/* WRITE A LINE WITH THE RESULT OF A TIMING. */
+
+static void report
+( char *name,			/* Name of the routine timed */
+  int calls,			/* Number of times it was called */
+  double seconds		/* Total CPU time taken */
+)
+{
+  int l;
+
+  fprintf (out, "%s,%d,", name, arch->N_inputs);
+
+  for (l = 0; l<arch->N_layers; l++)
+  { fprintf (out, l==0 ? "%d" : ":%d", arch->N_hidden[l]);
+  }
+
+  fprintf (out, ",%d,%d,%d,%.4f,%.4g\n", arch->N_outputs, N_cases, calls,
+           seconds, 1e6*seconds/calls);
+}
+
+
+/* RETURN THE CPU TIME USED SO FAR, IN SECONDS. */
+
+static double cpu_time (void)
+{
+  return (double) (unsigned) clock() / CLOCKS_PER_SEC;
+}
+
+
+/* RETURN THE WALL-CLOCK TIME, IN SECONDS.  Used for timings of code run
+   by several threads. */
+
+static double wall_time (void)
+{
+#ifdef _OPENMP
+  return omp_get_wtime();
+#else
+  return cpu_time();
+#endif
+}
+
+
+/* FIND THE NUMA NODE OF THE PROCESSOR RUNNING THE CALLING THREAD.  Returns
+   zero if this can't be found out. */
+
+static int cpu_node (void)
+{
+#ifdef __linux__
+
+  char path[100];
+  int cpu, n;
+
+  cpu = sched_getcpu();
+
+  if (cpu>=0)
+  { for (n = 0; n<1024; n++)
+    { sprintf (path, "/sys/devices/system/cpu/cpu%d/node%d", cpu, n);
+      if (access (path, F_OK)==0) return n;
+    }
+  }
+
+#endif
+
+  return 0;
+}
+
+
+/* DISPLAY USAGE MESSAGE AND EXIT. */
+
+static void usage (void)
+{
+  fprintf (stderr,
+"Usage: net-bench [ -r repetitions ] [ -o results-file ] log-file index\n"
+"   or: net-bench [ -r repetitions ] [ -o results-file ] -s inputs hidden cases\n");
+  exit(1);
+}
@@ -0,0 +1,193 @@
+/* NET-CMP.C - Program to compare the networks in two log files. */
+
+/* Copyright (c) 1995-2004 by Radford M. Neal
+ *
+ * Permission is granted for anyone to copy, use, modify, or distribute this
+ * program and accompanying programs and documents for any purpose, provided
+ * this copyright notice is retained and prominently displayed, along with
+ * a note saying that the original programs are available from Radford Neal's
+ * web page, and note is made of any changes made to the programs.  The
+ * programs and documents are distributed without any warranty, express or
+ * implied.  As the programs were written for research purposes only, they have
+ * not been tested to the degree that would be advisable in any important
+ * application.  All use of these programs is entirely at the user's own risk.
+ */
+
+/* The program is used to validate a build with single precision unit values
+ * (see net.h) against the usual double precision build.  Both log files
+ * should come from the same specifications and random number seed.
+ * -- Andrey Popov
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "misc.h"
+#include "log.h"
+#include "prior.h"
+#include "model.h"
+#include "data.h"
+#include "net.h"
+
+
+static void usage (void);
+
+
+/* MAIN PROGRAM. */
+
+main
+( int argc,
+  char **argv
+)
+{
+  net_arch *a1, *a2;
+  net_flags *flgs;
+  model_specification *m;
+
+  int total_sigmas, total_params;
+
+  log_file logf1, logf2;
+  log_gobbled logg1, logg2;
+
+  double tolerance, max_diff, w_diff, s_diff, d, worst;
+  net_param *w1, *w2;
+  net_sigma *s1, *s2;
+  int index, N_compared, failed;
+  int i;
+
+  /* Look at arguments. */
+
+  tolerance = -1;
+
+  if (argc!=3 && argc!=4) usage();
+
+  if (argc==4 && (tolerance = atof(argv[3]))<=0) usage();
+
+  logf1.file_name = argv[1];
+  logf2.file_name = argv[2];
+
+  /* Open log files and read network architectures, which must be the same. */
+
+  log_file_open (&logf1, 0);
+  log_file_open (&logf2, 0);
+
+  log_gobble_init(&logg1,0);
+  log_gobble_init(&logg2,0);
+  net_record_sizes(&logg1);
+  net_record_sizes(&logg2);
+
+  while (!logf1.at_end && logf1.header.index<0)
+  { log_gobble(&logf1,&logg1);
+  }
+
+  while (!logf2.at_end && logf2.header.index<0)
+  { log_gobble(&logf2,&logg2);
+  }
+
+  a1 = logg1.data['A'];
+  a2 = logg2.data['A'];
+  m = logg1.data['M'];
+  flgs = logg1.data['F'];
+
+  if (a1==0 || a2==0)
+  { fprintf(stderr,"No architecture specification in log file\n");
+    exit(1);
+  }
+
+  if (memcmp(a1,a2,sizeof *a1)!=0)
+  { fprintf(stderr,"Log files have different network architectures\n");
+    exit(1);
+  }
+
+  total_sigmas = net_setup_sigma_count(a1,flgs,m);
+  total_params = net_setup_param_count(a1,flgs);
+
+  logg1.req_size['S'] = logg2.req_size['S'] = total_sigmas * sizeof(net_sigma);
+  logg1.req_size['W'] = logg2.req_size['W'] = total_params * sizeof(net_param);
+
+  /* Compare networks with the same index in both files. */
+
+  printf("\n  Index  Max param diff  Max sigma rel diff\n\n");
+
+  N_compared = 0;
+  failed = 0;
+  worst = 0;
+
+  while (!logf1.at_end)
+  {
+    log_gobble(&logf1,&logg1);
+    index = logg1.last_index;
+
+    if (logg1.index['W']!=index || logg1.index['S']!=index)
+    { continue;
+    }
+
+    while (!logf2.at_end && logf2.header.index<index)
+    { log_file_forward(&logf2);
+    }
+
+    if (logf2.at_end) break;
+
+    if (logf2.header.index!=index) continue;
+
+    log_gobble(&logf2,&logg2);
+
+    if (logg2.index['W']!=index || logg2.index['S']!=index)
+    { continue;
+    }
+
+    w1 = logg1.data['W'];
+    w2 = logg2.data['W'];
+    s1 = logg1.data['S'];
+    s2 = logg2.data['S'];
+
+    w_diff = 0;
+    for (i = 0; i<total_params; i++)
+    { d = fabs(w1[i]-w2[i]);
+      if (d>w_diff) w_diff = d;
+    }
+
+    s_diff = 0;
+    for (i = 0; i<total_sigmas; i++)
+    { if (s1[i]!=0)
+      { d = fabs((s1[i]-s2[i])/s1[i]);
+        if (d>s_diff) s_diff = d;
+      }
+    }
+
+    max_diff = w_diff>s_diff ? w_diff : s_diff;
+    if (max_diff>worst) worst = max_diff;
+
+    printf("%7d  %14.3e  %18.3e%s\n", index, w_diff, s_diff,
+      tolerance>0 && max_diff>tolerance ? "  *" : "");
+
+    if (tolerance>0 && max_diff>tolerance) failed = 1;
+
+    N_compared += 1;
+  }
+
+  printf("\n");
+
+  if (N_compared==0)
+  { fprintf(stderr,"No networks with the same index in both log files\n");
+    exit(1);
+  }
+
+  if (tolerance>0)
+  { printf("%s: largest difference %.3e over %d networks (tolerance %.3e)\n\n",
+      failed ? "FAILED" : "OK", worst, N_compared, tolerance);
+  }
+
+  exit(failed);
+}
+
+
+/* DISPLAY USAGE MESSAGE AND EXIT. */
+
+static void usage (void)
+{
+  fprintf(stderr,"Usage: net-cmp log-file-1 log-file-2 [ tolerance ]\n");
+  exit(1);
+}
@@ -18,6 +18,10 @@
  * read through the train_weights function. The weights are read when the
  * training cases are requested if data_spec->has_weights is 1. Function
  * net_data_free is also modified to carry about a new array.
+ * The training data can be read keeping only the inputs, in the array
+ * train_inputs, without space for other values of the cases.  Space for
+ * the cases is allocated so that it is close to the threads using it on
+ * machines with several NUMA nodes.
  * -- Andrey Popov
  */
 
@@ -27,6 +31,10 @@
 #include <stdio.h>
 #include <math.h>
 
+#ifdef NET_HUGE_PAGES
+#include <sys/mman.h>
+#endif
+
 #include "misc.h"
 #include "log.h"
 #include "data.h"
@@ -42,8 +50,14 @@
 data_specifications *data_spec;	/* Specifications of data sets */
 
 int N_train;			/* Number of training cases */
+int N_train_total;		/* Number of training cases in all shards */
+
+int train_shard = 0;		/* Index of the shard of training cases kept */
+int N_train_shards = 1;		/* Number of shards training cases are split in */
+int train_first;		/* Index of first case of shard among all cases */
 
 net_values *train_values;	/* Values associated with training cases */
+net_value *train_inputs;	/* Only inputs of training cases, if read so */
 double *train_targets;		/* True targets for training cases */
 double *train_weights;      /* Weights of the training cases */
 
@@ -55,10 +69,13 @@ double *test_targets;		/* True targets for test cases */
 
 /* PROCEDURES. */
 
-static double     *read_targets (numin_source *, int,   net_arch *);
-static net_values *read_inputs  (numin_source *, int *, net_arch *, 
-                                 model_specification *, model_survival *);
-static double     *read_weights (numin_source *, int, double *);
+static double     *read_targets (numin_source *, int,   net_arch *, int);
+static net_values *read_inputs  (numin_source *, int *, int *, net_arch *, 
+                                 model_specification *, model_survival *,
+                                 net_value **);
+static double     *read_weights (numin_source *, int, double *, 
+                                 numin_source *);
+static void        shard_range  (int, int *, int *);
 
 
 /* FREE SPACE OCCUPIED BY DATA.  Also useful as a way to reset when the
@@ -72,6 +89,15 @@ void net_data_free (void)
     N_train = 0;
   }
 
+  if (train_inputs!=0)
+  { free(train_inputs);
+    train_inputs = 0;
+    N_train = 0;
+  }
+
+  N_train_total = 0;
+  train_first = 0;
+
   if (train_targets!=0)
   { free(train_targets);
     train_targets = 0;
@@ -101,10 +127,22 @@ void net_data_free (void)
    that the data specifications are consistent with the network architecture. 
 
    For survival models with non-constant hazard, the first input in a case, 
-   representing time, is set to zero by this procedure. */
+   representing time, is set to zero by this procedure. 
+
+   If want_train is 2, only the inputs of the training cases are kept, one
+   case after another, in train_inputs, and train_values is left null.  This
+   takes much less memory when the network has many hidden units.
+
+   If N_train_shards is greater than one, the training cases are split in
+   that many contiguous shards of nearly equal numbers of whole blocks of
+   Case_block cases, and only the cases in shard train_shard are kept, with
+   N_train set to their number and train_first to the index of the first of
+   them, while N_train_total is set to the number of all cases.  The cases
+   before the shard are read and skipped.  The weights are rescaled as for
+   the full training set, so they are the same as when all cases are kept. */
 
 void net_data_read
-( int want_train,	/* Do we want the training data? */
+( int want_train,	/* Do we want the training data? 2 for inputs only */
   int want_test,	/* Do we want the test data? */
   net_arch *arch,	/* Network architecture */
   model_specification *model, /* Data model being used */
@@ -113,7 +151,7 @@ void net_data_read
 {
   numin_source ns;
 
-  if (train_values!=0) want_train = 0;
+  if (train_values!=0 || train_inputs!=0) want_train = 0;
   if (test_values!=0)  want_test = 0;
 
   if (model_targets(model,arch->N_outputs) != data_spec->N_targets
@@ -139,16 +177,25 @@ void net_data_read
   { 
     numin_spec (&ns, "data@1,0",1);
     numin_spec (&ns, data_spec->train_inputs, data_spec->N_inputs);
-    train_values = read_inputs (&ns, &N_train, arch, model, surv);
+    train_values = read_inputs (&ns, &N_train, &N_train_total, arch, model,
+                                surv, want_train==2 ? &train_inputs : 0);
 
     numin_spec (&ns, data_spec->train_targets, data_spec->N_targets);
-    train_targets = read_targets (&ns, N_train, arch);
+    train_targets = read_targets (&ns, N_train_total, arch, 1);
     
     // Weighted cases support
     if (data_spec->has_weights)
     {
+      numin_source tns;
+
+      if (N_train_shards>1) /* Targets of cases in other shards are needed */
+      { numin_spec (&tns, "data@1,0",1);
+        numin_spec (&tns, data_spec->train_targets, data_spec->N_targets);
+      }
+
       numin_spec (&ns, data_spec->train_weights, 1);
-      train_weights = read_weights(&ns, N_train, train_targets);
+      train_weights = read_weights(&ns, N_train_total, train_targets,
+                                   N_train_shards>1 ? &tns : 0);
     }
   }
 
@@ -156,84 +203,131 @@ void net_data_read
   {
     numin_spec (&ns, "data@1,0",1);
     numin_spec (&ns, data_spec->test_inputs, data_spec->N_inputs);
-    test_values = read_inputs (&ns, &N_test, arch, model, surv);
+    test_values = read_inputs (&ns, &N_test, 0, arch, model, surv, 0);
 
     if (data_spec->test_targets[0]!=0)
     { numin_spec (&ns, data_spec->test_targets, data_spec->N_targets);
-      test_targets = read_targets (&ns, N_test, arch);
+      test_targets = read_targets (&ns, N_test, arch, 0);
     }
   }
 }
 
 
-/* READ INPUTS VALUES FOR A SET OF CASES. */
+/* READ INPUTS VALUES FOR A SET OF CASES.  If 'inputs' is not null, only 
+   the inputs are stored, in a block that is returned there, and the value
+   returned is null.  If N_all_ptr is not null, only the cases in the shard
+   of training cases kept are stored, and the number of all cases is stored
+   there. */
 
 static net_values *read_inputs
 ( numin_source *ns,
   int *N_cases_ptr,
+  int *N_all_ptr,	/* Place to store number of all cases, or null */
   net_arch *arch,
   model_specification *model, 
-  model_survival *surv
+  model_survival *surv,
+  net_value **inputs	/* Place to return block of inputs only, or null */
 )
 {
-  net_value *value_block;
+  net_value *value_block, *x;
   net_values *values;
+  double *in;
   int value_count;
-  int N_cases;
+  int N_cases, N_all, low, high;
   int i, j, j0;
 
-  N_cases = numin_start(ns);
+  N_all = numin_start(ns);
 
-  value_count = net_setup_value_count(arch);
+  low = 0;
+  high = N_all;
+  if (N_all_ptr!=0) 
+  { shard_range (N_all, &low, &high);
+    train_first = low;
+  }
 
-  value_block = chk_alloc (value_count*N_cases, sizeof *value_block);
-  values      = chk_alloc (N_cases, sizeof *values);
+  N_cases = high - low;
 
-  for (i = 0; i<N_cases; i++) 
-  { net_setup_value_pointers (&values[i], value_block+value_count*i, arch);
+  if (inputs!=0)
+  { *inputs = net_case_alloc (N_cases, arch->N_inputs * sizeof **inputs);
+    values = 0;
   }
+  else
+  { 
+    value_count = net_setup_value_count(arch);
+
+    value_block = net_case_alloc (N_cases, value_count * sizeof *value_block);
+    values      = net_case_alloc (N_cases, sizeof *values);
 
-  for (i = 0; i<N_cases; i++) 
-  { if (model!=0 && model->type=='V' && surv->hazard_type!='C')
-    { values[i].i[0] = 0;
+    for (i = 0; i<N_cases; i++) 
+    { net_setup_value_pointers (&values[i], value_block+value_count*i, arch);
+    }
+  }
+
+  /* Inputs are read in double precision and then stored as unit values,
+     which may be single precision. */
+
+  in = chk_alloc (arch->N_inputs, sizeof *in);
+
+  for (i = 0; i<high; i++) 
+  { if (i<low)
+    { numin_read(ns,in);
+      continue;
+    }
+    x = inputs!=0 ? *inputs + arch->N_inputs*(i-low) : values[i-low].i;
+    if (model!=0 && model->type=='V' && surv->hazard_type!='C')
+    { x[0] = 0;
       j0 = 1;
     }
     else
     { j0 = 0;
     }
-    numin_read(ns,values[i].i+j0);
+    numin_read(ns,in+j0);
     for (j = j0; j<arch->N_inputs; j++)
-    { values[i].i[j] 
-        = data_trans (values[i].i[j], data_spec->trans[j-j0]);
+    { x[j] = data_trans (in[j], data_spec->trans[j-j0]);
     }
   }
 
+  free(in);
+
   numin_close(ns);
 
   *N_cases_ptr = N_cases;
+  if (N_all_ptr!=0) *N_all_ptr = N_all;
 
   return values;
 }
 
 
-/* READ TARGET VALUES FOR A SET OF CASES. */
+/* READ TARGET VALUES FOR A SET OF CASES.  If 'sharded' is non-zero, only
+   the cases in the shard of training cases kept are stored. */
 
 static double *read_targets
 ( numin_source *ns,
-  int N_cases,
-  net_arch *arch
+  int N_all,		/* Number of all cases */
+  net_arch *arch,
+  int sharded		/* Keep only the shard of training cases? */
 )
 {
-  double *tg;
+  double *tg, *skip;
+  int N_cases, low, high;
   int i, j;
 
-  if (numin_start(ns)!=N_cases)
+  if (numin_start(ns)!=N_all)
   { fprintf(stderr,
       "Number of input cases doesn't match number of target cases\n");
     exit(1);
   }
 
-  tg = chk_alloc (data_spec->N_targets*N_cases, sizeof (double));
+  low = 0;
+  high = N_all;
+  if (sharded) shard_range (N_all, &low, &high);
+
+  N_cases = high - low;
+
+  tg = net_case_alloc (N_cases, data_spec->N_targets * sizeof (double));
+  skip = chk_alloc (data_spec->N_targets, sizeof (double));
+
+  for (i = 0; i<low; i++) numin_read(ns,skip);
 
   for (i = 0; i<N_cases; i++)
   { 
@@ -246,65 +340,99 @@ static double *read_targets
     }
   }
 
+  free(skip);
+
   numin_close(ns);
 
   return tg;
 }
 
 
-/* READ THE CASES' WEIGHTS. */
+/* READ THE CASES' WEIGHTS.  If 'tns' is not null, only the weights of the
+   cases in the shard of training cases kept are stored, and the targets of
+   all cases, which are needed to rescale the weights, are read from 'tns'.
+   The targets passed are then only those of the cases kept. */
 
 static double *read_weights
 ( numin_source *ns,
-  int N_cases,
-  double *targets
+  int N_all,		/* Number of all cases */
+  double *targets,	/* Targets of the cases kept */
+  numin_source *tns	/* Source of targets of all cases, or null */
 )
 {
-  double *wg;
-  int i;
+  double *wg, *tg;
+  double w, t;
+  int i, N_cases, low, high;
   double sum_weights_sgn = 0., sum_weights_bkg = 0.;
   long num_sgn = 0, num_bkg = 0;
 
-  if (numin_start(ns)!=N_cases)
+  if (numin_start(ns)!=N_all)
   { fprintf(stderr,
       "Number of input cases doesn't match number of weights\n");
     exit(1);
   }
 
-  wg = chk_alloc (N_cases, sizeof (double));
+  low = 0;
+  high = N_all;
+  tg = 0;
 
-  for (i = 0; i<N_cases; i++)
+  if (tns!=0)
+  { shard_range (N_all, &low, &high);
+    numin_start(tns);
+    tg = chk_alloc (data_spec->N_targets, sizeof (double));
+  }
+
+  N_cases = high - low;
+
+  wg = net_case_alloc (N_cases, sizeof (double));
+
+  for (i = 0; i<N_all; i++)
   { 
-    numin_read(ns,wg+i);
+    numin_read(ns,&w);
+
+    if (tns!=0)
+    { numin_read(tns,tg);
+      t = data_trans (tg[0], data_spec->trans[data_spec->N_inputs]);
+    }
+    else
+    { t = targets[i];
+    }
+
+    if (i>=low && i<high) wg[i-low] = w;
     
-    if (targets[i])
+    if (t)
     {
-      sum_weights_sgn += wg[i];
+      sum_weights_sgn += w;
       num_sgn++;
     }
     else
     {
-	  sum_weights_bkg += wg[i];
+	  sum_weights_bkg += w;
       num_bkg++;
     }
   }
 
   numin_close(ns);
+
+  if (tns!=0)
+  { numin_close(tns);
+    free(tg);
+  }
   
   
   // Rescale the weights if needed
   if (data_spec->rescale_weights == 1)
   {
     for (i = 0; i < N_cases; i++)
-      wg[i] *= N_cases / (sum_weights_sgn + sum_weights_bkg);
+      wg[i] *= N_all / (sum_weights_sgn + sum_weights_bkg);
   }
   else if (data_spec->rescale_weights == 2)
   {
     for (i = 0; i < N_cases; i++)
       if (targets[i])
-        wg[i] *= N_cases / (2. * sum_weights_sgn);
+        wg[i] *= N_all / (2. * sum_weights_sgn);
       else
-        wg[i] *= N_cases / (2. * sum_weights_bkg);
+        wg[i] *= N_all / (2. * sum_weights_bkg);
   }
   else if (data_spec->rescale_weights == 3)
   {
@@ -324,3 +452,97 @@ static double *read_weights
 
   return wg;
 }
+
+
+/* FIND THE SHARD OF TRAINING CASES KEPT.  Cases from 'low' up to but not
+   including 'high' out of N_cases are in shard train_shard, the shards
+   being contiguous and made of nearly equal numbers of whole blocks of
+   Case_block cases.  The blocks of cases in the shards are then the same
+   as for all cases, so sums over the cases that are formed block by block
+   do not depend on the number of shards. */
+
+static void shard_range
+( int N_cases,		/* Number of all cases */
+  int *low,		/* Place to store index of first case in shard */
+  int *high		/* Place to store index just past last case */
+)
+{
+  long N_blocks;
+
+  N_blocks = (N_cases+Case_block-1) / Case_block;
+
+  *low  = (int) ((N_blocks * train_shard) / N_train_shards) * Case_block;
+  *high = (int) ((N_blocks * (train_shard+1)) / N_train_shards) * Case_block;
+
+  if (*high>N_cases) *high = N_cases;
+}
+
+
+/* ALLOCATE SPACE FOR DATA ON CASES.  Returns space, set to zero, for
+   N_cases items of case_size bytes each.  The space is set to zero by the
+   threads that handle each block of Case_block cases in the parallel passes
+   over training cases, with the blocks divided among threads in the same
+   way.  Since memory is placed on the NUMA node of the thread that first
+   writes to it, each thread then finds the data for its cases in memory
+   attached to its own node, provided the threads are bound to processors
+   (see net-mc.doc).
+
+   When compiled with NET_HUGE_PAGES defined (see make.include), space of
+   at least Huge_page bytes is aligned to a multiple of Huge_page, and the
+   system is asked to back it with huge pages, which reduces the misses in
+   the translation lookaside buffer on passes over many cases.  The space
+   can be freed with 'free' either way. */
+
+#define Huge_page (2L<<20)	/* Size of a huge page (2 MB on x86-64) */
+
+void *net_case_alloc
+( int N_cases,		/* Number of cases */
+  long case_size	/* Number of bytes for each case */
+)
+{
+  char *p;
+  long size;
+  int b, N_blocks;
+
+  size = (long) N_cases * case_size;
+
+  p = 0;
+
+#if defined(NET_HUGE_PAGES) && defined(MADV_HUGEPAGE)
+  if (size>=Huge_page)
+  { if (posix_memalign ((void **) &p, Huge_page, size)!=0)
+    { p = 0;
+    }
+    else
+    { madvise (p, size, MADV_HUGEPAGE);  /* Only advice, so may be refused */
+    }
+  }
+#endif
+
+  if (p==0)
+  { p = malloc (size>0 ? size : 1);
+  }
+
+  if (p==0)
+  { fprintf(stderr,"Ran out of memory (while trying to allocate %ld bytes)\n",
+      size);
+    exit(1);
+  }
+
+  N_blocks = (N_cases+Case_block-1) / Case_block;
+
+#ifdef _OPENMP
+# pragma omp parallel for schedule(static)
+#endif
+  for (b = 0; b<N_blocks; b++)
+  { 
+    int end;
+
+    end = (b+1)*Case_block < N_cases ? (b+1)*Case_block : N_cases;
+
+    memset (p + (long) b*Case_block*case_size, 0, 
+            (long) (end-b*Case_block) * case_size);
+  }
+
+  return p;
+}
@@ -13,20 +13,38 @@
  * application.  All use of these programs is entirely at the user's own risk.
  */
 
-/* Array of the training cases' weights is added (s. the source file).
+/* Array of the training cases' weights is added (s. the source file).  The
+ * inputs of the training cases can be kept without the other values, in
+ * array train_inputs.  The training cases can be split in shards, of which
+ * only one is kept.
  * -- Andrey Popov
  */
 
 
 
+/* NUMBER OF TRAINING CASES IN A BLOCK.  Passes over the training cases
+   that are done in parallel (when compiled with OpenMP) handle blocks of
+   this many cases, with the blocks divided among the threads in contiguous
+   ranges (static scheduling).  Space for data on cases is allocated with
+   net_case_alloc so that each thread's blocks are in memory close to it. */
+
+#define Case_block 256
+
+
 /* VARIABLES HOLDING TRAINING AND/OR TEST DATA.  When the values or targets
    aren't known, the pointers are null. */
 
 extern data_specifications *data_spec; /* Specifications of data sets */
 
 extern int N_train;		/* Number of training cases */
+extern int N_train_total;	/* Number of training cases in all shards */
+
+extern int train_shard;		/* Index of the shard of training cases kept */
+extern int N_train_shards;	/* Number of shards training cases are split in */
+extern int train_first;		/* Index of first case of shard among all cases */
 
 extern net_values *train_values;/* Values associated with training cases */
+extern net_value *train_inputs;	/* Only inputs of training cases, if read so */
 extern double *train_targets;	/* True targets for training cases */
 extern double *train_weights;   /* Weights of the training cases */
 
@@ -42,3 +60,5 @@ void net_data_read (int, int, net_arch *,
                     model_specification *, model_survival *);
 
 void net_data_free (void);
+
+void *net_case_alloc (int, long);
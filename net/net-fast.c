@@ -0,0 +1,557 @@
+/* NET-FAST.C - Fused computations for networks with one hidden layer. */
+
+/* Copyright (c) 1995-2004 by Radford M. Neal
+ *
+ * Permission is granted for anyone to copy, use, modify, or distribute this
+ * program and accompanying programs and documents for any purpose, provided
+ * this copyright notice is retained and prominently displayed, along with
+ * a note saying that the original programs are available from Radford Neal's
+ * web page, and note is made of any changes made to the programs.  The
+ * programs and documents are distributed without any warranty, express or
+ * implied.  As the programs were written for research purposes only, they have
+ * not been tested to the degree that would be advisable in any important
+ * application.  All use of these programs is entirely at the user's own risk.
+ */
+
+/* The module is specific to this package.  It handles the networks built by
+ * bnn-hep, which have one layer of tanh hidden units and a single output for
+ * a binary target, without going through the general code in net-func.c,
+ * net-model.c, net-back.c, and net-grad.c.  The arithmetic is done in the
+ * same order as there, so the results are identical.
+ * -- Andrey Popov
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "misc.h"
+#include "log.h"
+#include "prior.h"
+#include "model.h"
+#include "data.h"
+#include "net.h"
+
+
+/* CHECK WHETHER THE FUSED COMPUTATIONS CAN BE USED.  Returns 1 if the
+   network has a single layer of tanh hidden units, connected to the inputs
+   and to a single output, no offsets, no input to output connections, no
+   omitted inputs, and the model is for binary data with one target.
+   Biases are optional.  Returns 0 otherwise. */
+
+int net_fast_usable
+( net_arch *a,		/* Network architecture */
+  net_flags *flgs,	/* Network flags, null if none */
+  model_specification *m, /* Data model */
+  int N_targets		/* Number of targets for a case */
+)
+{
+  int i;
+
+  if (m==0 || m->type!='B' || N_targets!=1) return 0;
+
+  if (a->N_layers!=1 || a->N_outputs!=1) return 0;
+
+  if (!a->has_ih[0] || !a->has_ho[0]) return 0;
+
+  if (a->has_ti || a->has_th[0] || a->has_io) return 0;
+
+  if (flgs!=0)
+  { if (flgs->layer_type[0]!=Tanh_type) return 0;
+    for (i = 0; i<a->N_inputs; i++)
+    { if (flgs->omit[i]&2) return 0;
+    }
+  }
+
+  return 1;
+}
+
+
+/* COMPUTE LOG PROBABILITIES AND GRADIENT FOR A RANGE OF CASES.  For each
+   case from 'first' up to (but not including) 'last', the network function
+   is evaluated, and inv_temp times the log probability of the target
+   (multiplied by the case weight, if there are weights) is subtracted from
+   the energy.  For cases from 'low' up to 'high', the derivatives of minus
+   the log probability (multiplied by the case weight) with respect to the
+   parameters are also added to the gradient.  Only the inputs of the
+   cases are needed.  The values of the hidden units and outputs, and their
+   derivatives, are kept only for the block of cases being handled, in the
+   scratch space from net_fast_scratch.  Must be used only when
+   net_fast_usable returns 1.
+
+   Cases are handled in blocks of Fast_block, so that each weight that is
+   loaded is used for all cases in the block.  Each sum for a case is still
+   formed in the same order as when the cases are done one at a time. */
+
+#define Fast_block 4
+
+static void forward_case (net_value *, net_values *, net_arch *, net_params *);
+static void forward_block (net_value *, int, net_values *, net_arch *,
+                           net_params *);
+static net_value case_prob (net_value, double, double *);
+static void grad_case (net_value *, net_values *, net_values *, double, 
+                       net_arch *, net_params *);
+static void grad_block (net_value *, int, net_values *, net_values *, double *,
+                        net_arch *, net_params *);
+
+void net_fast_cases
+( net_value *in,	/* Inputs for cases, one case after another */
+  int stride,		/* Distance from inputs of one case to the next */
+  double *t,		/* Targets for cases */
+  double *wt,		/* Weights of cases, or null if not weighted */
+  int first,		/* First case for which to find the log probability */
+  int last,		/* One past the last such case */
+  int low,		/* First case for which to add to the gradient */
+  int high,		/* One past the last such case */
+  net_arch *a,		/* Network architecture */
+  net_params *w,	/* Network parameters */
+  net_params *g,	/* Gradient to add to, or null if not wanted */
+  double *energy,	/* Energy to subtract from, or null if not wanted */
+  double inv_temp,	/* Inverse temperature */
+  net_values *sc	/* Scratch space from net_fast_scratch */
+)
+{
+  double weight[Fast_block];
+  net_values *v, *d;
+  net_value *x, *ds, d_o, dh;
+  net_param *wp;
+  double log_prob;
+  int c, n, k, j;
+
+  v = sc;
+  d = sc + Fast_block;
+
+  for (c = first; c<last; c += n)
+  {
+    n = last-c < Fast_block ? last-c : Fast_block;
+    x = in + (long) c * stride;
+
+    /* Values of hidden units and outputs. */
+
+    if (n==Fast_block)
+    { forward_block (x, stride, v, a, w);
+    }
+    else
+    { for (k = 0; k<n; k++) forward_case (x+k*stride, v+k, a, w);
+    }
+
+    /* Log probabilities of targets, and derivatives with respect to the
+       summed inputs of hidden units for the cases in the gradient. */
+
+    for (k = 0; k<n; k++)
+    {
+      d_o = case_prob (v[k].o[0], t[c+k], &log_prob);
+
+      if (energy)
+      { if (wt) *energy -= inv_temp * log_prob * wt[c+k];
+        else    *energy -= inv_temp * log_prob;
+      }
+
+      weight[k] = wt ? wt[c+k] : 1.;
+
+      if (g==0 || c+k<low || c+k>=high) continue;
+
+      ds = d[k].s[0];
+      d[k].o[0] = d_o;
+
+      wp = w->ho[0];
+      for (j = 0; j<a->N_hidden[0]; j++)
+      { dh = *wp++ * d_o;
+        ds[j] = (1 - v[k].h[0][j]*v[k].h[0][j]) * dh;
+      }
+    }
+
+    /* Add to the gradient. */
+
+    if (g==0) continue;
+
+    if (n==Fast_block && c>=low && c+n<=high)
+    { grad_block (x, stride, v, d, weight, a, g);
+    }
+    else
+    { for (k = 0; k<n; k++)
+      { if (c+k>=low && c+k<high)
+        { grad_case (x+k*stride, v+k, d+k, weight[k], a, g);
+        }
+      }
+    }
+  }
+}
+
+
+/* COMPUTE LOG PROBABILITIES USING STORED HIDDEN UNIT VALUES.  The values
+   of the hidden units for all cases are kept in 'hc', N_hidden values for
+   each case.  If 'changed' is null, they are all computed and stored.  
+   Otherwise, only the values of hidden units for which 'changed' is non-zero
+   are recomputed, and the others are assumed to be still valid, which is so
+   if only the weights and biases of these units, and the weights and bias
+   of the output, have changed since the values were stored.  The output is
+   then found from the hidden unit values, and inv_temp times the log 
+   probability (times the case weight) is subtracted from the energy, for
+   all cases.  The results are identical to those of net_fast_cases. */
+
+void net_fast_update
+( net_value *in,	/* Inputs for cases, one case after another */
+  int stride,		/* Distance from inputs of one case to the next */
+  double *t,		/* Targets for cases */
+  double *wt,		/* Weights of cases, or null if not weighted */
+  int N_cases,		/* Number of cases */
+  net_arch *a,		/* Network architecture */
+  net_params *w,	/* Network parameters */
+  net_value *hc,	/* Stored values of hidden units for the cases */
+  char *changed,	/* Which hidden units to recompute, null for all */
+  double *energy,	/* Energy to subtract from */
+  double inv_temp,	/* Inverse temperature */
+  net_values *sc	/* Scratch space from net_fast_scratch */
+)
+{
+  net_value *x, *h, s, o;
+  net_param *wp;
+  double log_prob, tv;
+  int N_hidden, c, i, j;
+
+  N_hidden = a->N_hidden[0];
+
+  for (c = 0; c<N_cases; c++)
+  {
+    x = in + (long) c * stride;
+    h = hc + (long) c * N_hidden;
+
+    if (changed==0)
+    { forward_case (x, sc, a, w);
+      for (j = 0; j<N_hidden; j++) h[j] = sc->h[0][j];
+      o = sc->o[0];
+    }
+    else
+    { 
+      /* Sums for the changed units are formed in the same order as in
+         forward_case. */
+
+      for (j = 0; j<N_hidden; j++)
+      { if (!changed[j]) continue;
+        s = a->has_bh[0] ? w->bh[0][j] : 0;
+        wp = w->ih[0] + j;
+        for (i = 0; i<a->N_inputs; i++)
+        { tv = x[i];
+          s += *wp * tv;
+          wp += N_hidden;
+        }
+        h[j] = tanh(s);
+      }
+
+      o = a->has_bo ? *w->bo : 0;
+
+      wp = w->ho[0];
+      for (j = 0; j<N_hidden; j++)
+      { tv = h[j];
+        o += *wp++ * tv;
+      }
+    }
+
+    case_prob (o, t[c], &log_prob);
+
+    if (wt) *energy -= inv_temp * log_prob * wt[c];
+    else    *energy -= inv_temp * log_prob;
+  }
+}
+
+
+/* ALLOCATE SCRATCH SPACE FOR NET_FAST_CASES.  Holds the values of units
+   and their derivatives for one block of cases.  Each thread that calls
+   net_fast_cases at the same time needs its own scratch space. */
+
+net_values *net_fast_scratch
+( net_arch *a		/* Network architecture */
+)
+{
+  net_value *value_block;
+  net_values *sc;
+  int value_count;
+  int k;
+
+  value_count = net_setup_value_count(a);
+
+  value_block = chk_alloc (2*Fast_block*value_count, sizeof *value_block);
+  sc = chk_alloc (2*Fast_block, sizeof *sc);
+
+  for (k = 0; k<2*Fast_block; k++)
+  { net_setup_value_pointers (&sc[k], value_block+value_count*k, a);
+  }
+
+  return sc;
+}
+
+
+/* FREE SCRATCH SPACE ALLOCATED BY NET_FAST_SCRATCH. */
+
+void net_fast_free_scratch
+( net_values *sc	/* Scratch space to free */
+)
+{
+  free(sc[0].i);
+  free(sc);
+}
+
+
+/* COMPUTE HIDDEN UNIT AND OUTPUT VALUES FOR ONE CASE. */
+
+static void forward_case
+( net_value *vi,	/* Inputs for the case */
+  net_values *v,	/* Place to store values for the case */
+  net_arch *a,		/* Network architecture */
+  net_params *w		/* Network parameters */
+)
+{
+  net_value *s, *h, o;
+  net_param *wp;
+  double tv;
+  int N_hidden, i, j;
+
+  N_hidden = a->N_hidden[0];
+
+  s  = v->s[0];
+  h  = v->h[0];
+
+  if (a->has_bh[0])
+  { for (j = 0; j<N_hidden; j++) s[j] = w->bh[0][j];
+  }
+  else
+  { for (j = 0; j<N_hidden; j++) s[j] = 0;
+  }
+
+  wp = w->ih[0];
+  for (i = 0; i<a->N_inputs; i++)
+  { tv = vi[i];
+    for (j = 0; j<N_hidden; j++) s[j] += *wp++ * tv;
+  }
+
+  for (j = 0; j<N_hidden; j++)
+  { h[j] = tanh(s[j]);
+  }
+
+  o = a->has_bo ? *w->bo : 0;
+
+  wp = w->ho[0];
+  for (j = 0; j<N_hidden; j++)
+  { tv = h[j];
+    o += *wp++ * tv;
+  }
+
+  v->o[0] = o;
+}
+
+
+/* COMPUTE HIDDEN UNIT AND OUTPUT VALUES FOR A BLOCK OF CASES. */
+
+static void forward_block
+( net_value *in,	/* Inputs for the Fast_block cases */
+  int stride,		/* Distance from inputs of one case to the next */
+  net_values *v,	/* Place to store values for the cases */
+  net_arch *a,		/* Network architecture */
+  net_params *w		/* Network parameters */
+)
+{
+  net_value *s0, *s1, *s2, *s3, *h0, *h1, *h2, *h3;
+  net_value o0, o1, o2, o3;
+  net_value *in1, *in2, *in3;
+  net_param *wp, wv;
+  double tv0, tv1, tv2, tv3;
+  int N_hidden, i, j;
+
+  N_hidden = a->N_hidden[0];
+
+  in1 = in+stride; in2 = in1+stride; in3 = in2+stride;
+
+  s0 = v[0].s[0]; s1 = v[1].s[0]; s2 = v[2].s[0]; s3 = v[3].s[0];
+  h0 = v[0].h[0]; h1 = v[1].h[0]; h2 = v[2].h[0]; h3 = v[3].h[0];
+
+  for (j = 0; j<N_hidden; j++)
+  { s0[j] = s1[j] = s2[j] = s3[j] = a->has_bh[0] ? w->bh[0][j] : 0;
+  }
+
+  wp = w->ih[0];
+  for (i = 0; i<a->N_inputs; i++)
+  { tv0 = in[i]; tv1 = in1[i]; tv2 = in2[i]; tv3 = in3[i];
+    for (j = 0; j<N_hidden; j++)
+    { wv = *wp++;
+      s0[j] += wv * tv0;
+      s1[j] += wv * tv1;
+      s2[j] += wv * tv2;
+      s3[j] += wv * tv3;
+    }
+  }
+
+  for (j = 0; j<N_hidden; j++)
+  { h0[j] = tanh(s0[j]);
+    h1[j] = tanh(s1[j]);
+    h2[j] = tanh(s2[j]);
+    h3[j] = tanh(s3[j]);
+  }
+
+  o0 = o1 = o2 = o3 = a->has_bo ? *w->bo : 0;
+
+  wp = w->ho[0];
+  for (j = 0; j<N_hidden; j++)
+  { wv = *wp++;
+    tv0 = h0[j]; tv1 = h1[j]; tv2 = h2[j]; tv3 = h3[j];
+    o0 += wv * tv0;
+    o1 += wv * tv1;
+    o2 += wv * tv2;
+    o3 += wv * tv3;
+  }
+
+  v[0].o[0] = o0; v[1].o[0] = o1; v[2].o[0] = o2; v[3].o[0] = o3;
+}
+
+
+/* FIND THE LOG PROBABILITY OF A BINARY TARGET.  Stores the log probability
+   and returns its derivative with respect to the output, computed as in
+   net_model_prob.  A target that is NaN (missing) contributes nothing. */
+
+static net_value case_prob
+( net_value o,		/* Value of the output unit */
+  double t,		/* Target, 0 or 1 */
+  double *pr		/* Place to store log probability */
+)
+{
+  net_value d_o;
+
+  *pr = 0;
+
+  if (isnan(t))
+  { d_o = 0;
+  }
+  else if (t==0)
+  { if (o<0)
+    { *pr -= log(1+exp(o));
+      d_o = 1 - 1/(1+exp(o));
+    }
+    else
+    { *pr -= o + log(1+exp(-o));
+      d_o = 1/(1+exp(-o));
+    }
+  }
+  else
+  { if (o<0)
+    { *pr -= -o + log(1+exp(o));
+      d_o = -1/(1+exp(o));
+    }
+    else
+    { *pr -= log(1+exp(-o));
+      d_o = -1 + 1/(1+exp(-o));
+    }
+  }
+
+  return d_o;
+}
+
+
+/* ADD TO THE GRADIENT FOR ONE CASE. */
+
+static void grad_case
+( net_value *vi,	/* Inputs for the case */
+  net_values *v,	/* Values for the case */
+  net_values *d,	/* Derivatives for the case */
+  double weight,	/* Weight of the case */
+  net_arch *a,		/* Network architecture */
+  net_params *g		/* Gradient to add to */
+)
+{
+  net_value *ds, *h, d_o;
+  net_param *gp;
+  double tv;
+  int N_hidden, i, j;
+
+  N_hidden = a->N_hidden[0];
+
+  ds  = d->s[0];
+  d_o = d->o[0];
+  h   = v->h[0];
+
+  if (a->has_bh[0])
+  { gp = g->bh[0];
+    for (j = 0; j<N_hidden; j++) gp[j] += ds[j] * weight;
+  }
+
+  gp = g->ih[0];
+  for (i = 0; i<a->N_inputs; i++)
+  { tv = vi[i];
+    for (j = 0; j<N_hidden; j++) *gp++ += tv * ds[j] * weight;
+  }
+
+  gp = g->ho[0];
+  for (j = 0; j<N_hidden; j++)
+  { tv = h[j];
+    gp[j] += tv * d_o * weight;
+  }
+
+  if (a->has_bo)
+  { *g->bo += d_o * weight;
+  }
+}
+
+
+/* ADD TO THE GRADIENT FOR A BLOCK OF CASES.  The contributions of the cases
+   to each component are added in order of the cases. */
+
+static void grad_block
+( net_value *in,	/* Inputs for the Fast_block cases */
+  int stride,		/* Distance from inputs of one case to the next */
+  net_values *v,	/* Values for the cases */
+  net_values *d,	/* Derivatives for the cases */
+  double *weight,	/* Weights of the cases */
+  net_arch *a,		/* Network architecture */
+  net_params *g		/* Gradient to add to */
+)
+{
+  net_value *ds0, *ds1, *ds2, *ds3, *in1, *in2, *in3;
+  net_param *gp;
+  double tv0, tv1, tv2, tv3, w0, w1, w2, w3;
+  int N_hidden, i, j;
+
+  N_hidden = a->N_hidden[0];
+
+  in1 = in+stride; in2 = in1+stride; in3 = in2+stride;
+
+  ds0 = d[0].s[0]; ds1 = d[1].s[0]; ds2 = d[2].s[0]; ds3 = d[3].s[0];
+  w0 = weight[0]; w1 = weight[1]; w2 = weight[2]; w3 = weight[3];
+
+  if (a->has_bh[0])
+  { gp = g->bh[0];
+    for (j = 0; j<N_hidden; j++) 
+    { gp[j] += ds0[j] * w0;
+      gp[j] += ds1[j] * w1;
+      gp[j] += ds2[j] * w2;
+      gp[j] += ds3[j] * w3;
+    }
+  }
+
+  gp = g->ih[0];
+  for (i = 0; i<a->N_inputs; i++)
+  { tv0 = in[i]; tv1 = in1[i]; tv2 = in2[i]; tv3 = in3[i];
+    for (j = 0; j<N_hidden; j++) 
+    { gp[j] += tv0 * ds0[j] * w0;
+      gp[j] += tv1 * ds1[j] * w1;
+      gp[j] += tv2 * ds2[j] * w2;
+      gp[j] += tv3 * ds3[j] * w3;
+    }
+    gp += N_hidden;
+  }
+
+  gp = g->ho[0];
+  for (j = 0; j<N_hidden; j++)
+  { tv0 = v[0].h[0][j]; tv1 = v[1].h[0][j]; 
+    tv2 = v[2].h[0][j]; tv3 = v[3].h[0][j];
+    gp[j] += tv0 * d[0].o[0] * w0;
+    gp[j] += tv1 * d[1].o[0] * w1;
+    gp[j] += tv2 * d[2].o[0] * w2;
+    gp[j] += tv3 * d[3].o[0] * w3;
+  }
+
+  if (a->has_bo)
+  { *g->bo += d[0].o[0] * w0;
+    *g->bo += d[1].o[0] * w1;
+    *g->bo += d[2].o[0] * w2;
+    *g->bo += d[3].o[0] * w3;
+  }
+}
@@ -18,6 +18,12 @@
  *  gibbs_noise & rgrid_met_noise: in what concerns calculation of the
  * difference between the outputs and targets (strored in variable d),
  *  mc_app_energy: in what concerns calculation of the log-prob and its gradient
+ * When the fused computations of net-fast.c are used, only the inputs of the
+ * training cases are kept, and no derivatives are stored for each case.
+ * The likelihood part of the energy and its gradient are kept, and are not
+ * recomputed, or recomputed only in part, when few parameters change.
+ * When run as several MPI processes, each holds a shard of the training
+ * cases, and the sums over cases are added up over the processes.
  * -- Andrey Popov
  */
 
@@ -75,6 +81,39 @@ static net_params grad;		/* Pointers to gradient for network parameters*/
 
 static double *quadratic_approx;/* Quadratic approximation to log likelihood */
 
+static double *block_sums;	/* Partial sums for blocks of training cases */
+static net_params block_grad;	/* Likelihood gradient for a block of cases */
+static double *grad_block_sums;	/* Partial sums of the likelihood gradient for
+				   the blocks of training cases, only with
+				   several processes */
+
+static int fast_path;		/* Use fused computations in net-fast.c? */
+static net_values *fast_scratch;/* Scratch space for net_fast_cases */
+
+static net_param *last_params;	/* Parameters at the last evaluation of the
+				   likelihood, for which the values below are */
+static net_sigma *last_noise;	/* Noise sigmas at the last evaluation */
+static net_value *last_inputs;	/* Inputs of cases at the last evaluation */
+static int last_known;		/* Has there been a last evaluation? */
+static double lik_energy;	/* Likelihood part of the energy */
+static double lik_inv_temp;	/* Inverse temperature for lik_energy */
+static int lik_energy_known;	/* Is lik_energy valid? */
+static net_params lik_grad;	/* Likelihood part of the gradient */
+static int lik_approx[2];	/* N_approx and w_approx for lik_grad */
+static int lik_grad_known;	/* Is lik_grad valid? */
+static int values_known;	/* Are the unit values for all cases (or hidden
+				   unit values, for the fast path) valid? */
+static net_value *hidden_cache;	/* Hidden unit values for cases, fast path */
+static char *unit_changed;	/* Which hidden units changed, fast path */
+
+static int *batch_order;	/* Random permutation of training cases used
+				   to form mini-batches */
+static int batch_next;		/* Position in permutation of next case */
+static net_params case_grad;	/* Gradient for a single training case */
+static double *batch_sum;	/* Sum of case gradients over mini-batch */
+static net_param *chunk_grad;	/* Gradients for chunks of a mini-batch */
+static int N_chunk_grad;	/* Number of chunks there is space for above */
+
 
 /* PROCEDURES. */
 
@@ -104,6 +143,16 @@ static void rgrid_met_conn (double, mc_iter *,
 
 static double sum_squares (net_param *, net_sigma *, int);
 
+static net_value *case_inputs (int *);
+
+static void lik_energy_grad (int, int, int, int, double);
+static int fast_changed_units (void);
+static int layer_end (int);
+
+static void compute_outputs (void);
+
+static double sum_residuals (int, double);
+
 static double rgrid_sigma (double, mc_iter *, double, 
                            double, double, double, double, int);
 
@@ -127,9 +176,10 @@ void mc_app_initialize
   mc_dynamic_state *ds	/* Structure holding pointers to dynamical state */
 )
 { 
-  net_value *value_block;
-  int value_count;
-  int i, j;
+  net_value *value_block, *x;
+  double *input_sums;
+  int value_count, stride, N_blocks;
+  int i, j, b;
 
   if (!initialize_done)
   {
@@ -148,6 +198,12 @@ void mc_app_initialize
       exit(1);
     }
 
+    if (mc_ranks>1 && model!=0 && model->type=='R' && model->noise.alpha[2]!=0)
+    { fprintf(stderr,
+       "Can't handle noise variances for each case with several processes\n");
+      exit(1);
+    }
+
     /* Look for quadratic approximation record.  If there is one, we use it. */
 
     quadratic_approx = logg->data['Q'];
@@ -223,30 +279,105 @@ void mc_app_initialize
     train_sumsq = chk_alloc (arch->N_inputs, sizeof *train_sumsq);
     for (j = 0; j<arch->N_inputs; j++) train_sumsq[j] = 0;
   
+    /* See whether the network is simple enough for the fused computations
+       of the energy and its gradient (see net-fast.c).  They need only the 
+       inputs of the training cases, with scratch space for one block of 
+       cases, so the other values and the derivatives are not stored for 
+       each case. */
+
+    fast_path = data_spec!=0 && !quadratic_approx
+                 && net_fast_usable (arch, flgs, model, data_spec->N_targets);
+
     if (data_spec!=0)
     { 
-      net_data_read (1, 0, arch, model, surv);  // Reading the training data
+      if (!fast_path && train_inputs!=0) 
+      { net_data_free();  /* Values are needed, so read data again */
+      }
+
+      // Reading the training data, or this process's shard of it
+      train_shard = mc_rank;
+      N_train_shards = mc_ranks;
+      net_data_read (fast_path ? 2 : 1, 0, arch, model, surv);
     
-      deriv = chk_alloc (N_train, sizeof *deriv);
+      if (fast_path)
+      { fast_scratch = net_fast_scratch (arch);
+        unit_changed = chk_alloc (arch->N_hidden[0], sizeof *unit_changed);
+      }
+      else
+      { 
+        deriv = net_case_alloc (N_train, sizeof *deriv);
     
-      value_count = net_setup_value_count(arch);
-      value_block = chk_alloc (value_count*N_train, sizeof *value_block);
+        value_count = net_setup_value_count(arch);
+        value_block = net_case_alloc (N_train, 
+                                      value_count * sizeof *value_block);
     
-      for (i = 0; i<N_train; i++) 
-      { net_setup_value_pointers (&deriv[i], value_block+value_count*i, arch);
+        for (i = 0; i<N_train; i++) 
+        { net_setup_value_pointers (&deriv[i], value_block+value_count*i, 
+                                    arch);
+        }
       }
     
-      for (j = 0; j<arch->N_inputs; j++)
-      { for (i = 0; i<N_train; i++)
-        { // Modified to make use of the training cases' weights
-          if (data_spec->has_weights)
-            train_sumsq[j] += train_values[i].i[j] * train_values[i].i[j] *
-              train_weights[i];
-          else
-            train_sumsq[j] += train_values[i].i[j] * train_values[i].i[j];
+      block_sums = chk_alloc ((N_train+Case_block-1)/Case_block,
+                              sizeof *block_sums);
+
+      last_params = chk_alloc (params.total_params, sizeof *last_params);
+      last_noise = chk_alloc (arch->N_outputs, sizeof *last_noise);
+      last_known = values_known = 0;
+      if (hidden_cache!=0) free(hidden_cache);
+      hidden_cache = 0;
+
+      lik_grad.total_params = params.total_params;
+      lik_grad.param_block = chk_alloc (params.total_params, 
+                                        sizeof (net_param));
+      net_setup_param_pointers (&lik_grad, arch, flgs);
+
+      block_grad.total_params = params.total_params;
+      block_grad.param_block = chk_alloc (params.total_params, 
+                                          sizeof (net_param));
+      net_setup_param_pointers (&block_grad, arch, flgs);
+
+      if (mc_ranks>1)
+      { grad_block_sums = chk_alloc ((N_train+Case_block-1)/Case_block
+                                       * params.total_params,
+                                     sizeof *grad_block_sums);
+      }
+
+      /* Blocks of Case_block cases are handled in parallel, with the cases
+         in a block summed in order for each input, and the sums for the
+         blocks are then added in order of the blocks, over all processes,
+         as in lik_energy_grad. */
+
+      x = case_inputs (&stride);
+
+      N_blocks = (N_train+Case_block-1) / Case_block;
+      input_sums = chk_alloc (N_blocks*arch->N_inputs, sizeof *input_sums);
+
+#ifdef _OPENMP
+#     pragma omp parallel for private(i,j) schedule(static)
+#endif
+      for (b = 0; b<N_blocks; b++)
+      { 
+        double *s;
+        int end;
+
+        s = input_sums + (long) b*arch->N_inputs;
+        end = (b+1)*Case_block < N_train ? (b+1)*Case_block : N_train;
+
+        for (i = b*Case_block; i<end; i++)
+        { for (j = 0; j<arch->N_inputs; j++)
+          { // Modified to make use of the training cases' weights
+            if (data_spec->has_weights)
+              s[j] += x[(long)i*stride+j] * x[(long)i*stride+j] *
+                train_weights[i];
+            else
+              s[j] += x[(long)i*stride+j] * x[(long)i*stride+j];
+          }
         }
       }
 
+      mc_sum_over_ranks (train_sumsq, input_sums, N_blocks, arch->N_inputs);
+      free(input_sums);
+
       if (model!=0 && model->type=='V' && surv->hazard_type!='C')
       {
         double tsq;
@@ -260,7 +391,7 @@ void mc_app_initialize
                                 : surv->time[n]*surv->time[n];
         }
 
-        train_sumsq[0] = N_train * tsq / n;
+        train_sumsq[0] = N_train_total * tsq / n;
       }
     }
 
@@ -529,9 +660,7 @@ static void gibbs_noise
   prior_spec *pr;
   int i, j;
 
-  for (i = 0; i<N_train; i++) 
-  { net_func (&train_values[i], 0, arch, flgs, &params);
-  }
+  compute_outputs();
 
   pr = &model->noise;
 
@@ -539,18 +668,10 @@ static void gibbs_noise
   {
     for (j = 0; j<arch->N_outputs; j++)
     {
-      sum = pr->alpha[1] * (*sigmas.noise_cm * *sigmas.noise_cm);
-      for (i = 0; i<N_train; i++)
-      { d = train_values[i].o[j] - train_targets[i*arch->N_outputs+j];
-        
-        // Modified to make use of the training cases' weights
-        if (data_spec->has_weights)
-          sum += inv_temp * d * d * train_weights[i];
-        else
-          sum += inv_temp * d*d;
-      }
+      sum = pr->alpha[1] * (*sigmas.noise_cm * *sigmas.noise_cm)
+             + sum_residuals (j, inv_temp);
 
-      nalpha = pr->alpha[1] + inv_temp * N_train;
+      nalpha = pr->alpha[1] + inv_temp * N_train_total;
       nprec = nalpha / sum;
 
       sigmas.noise[j] = prior_pick_sigma (1/sqrt(nprec), nalpha);
@@ -582,20 +703,9 @@ static void gibbs_noise
 
   if (pr->alpha[0]!=0 && pr->alpha[1]==0 && pr->alpha[2]==0)
   {
-    sum = pr->alpha[0] * (pr->width * pr->width);
-    for (i = 0; i<N_train; i++)
-    { for (j = 0; j<arch->N_outputs; j++)
-      { d = train_values[i].o[j] - train_targets[i*arch->N_outputs+j];
-        
-        // Modified to make use of the training cases' weights
-        if (data_spec->has_weights)
-          sum += inv_temp * d * d * train_weights[i];
-        else
-          sum += inv_temp * d*d;
-      }
-    }
+    sum = pr->alpha[0] * (pr->width * pr->width) + sum_residuals (-1, inv_temp);
 
-    nalpha = pr->alpha[0] + inv_temp * N_train * arch->N_outputs;
+    nalpha = pr->alpha[0] + inv_temp * N_train_total * arch->N_outputs;
     nprec = nalpha / sum;
     *sigmas.noise_cm = prior_pick_sigma (1/sqrt(nprec), nalpha);
 
@@ -643,6 +753,106 @@ static void gibbs_noise
 }
 
 
+/* LOCATE THE INPUTS OF THE TRAINING CASES.  Returns a pointer to the
+   inputs of the first case and stores the distance from the inputs of one
+   case to those of the next.  When all values are stored for each case
+   rather than only the inputs, the inputs are at the start of each case's
+   block of values, and these blocks are contiguous (see net-data.c). */
+
+static net_value *case_inputs
+( int *stride		/* Place to store distance between cases */
+)
+{
+  if (train_inputs!=0)
+  { *stride = arch->N_inputs;
+    return train_inputs;
+  }
+
+  *stride = net_setup_value_count(arch);
+
+  return N_train>0 ? train_values[0].i : 0;
+}
+
+
+/* COMPUTE NETWORK OUTPUTS FOR ALL TRAINING CASES.  The cases are
+   independent, so blocks of Case_block cases are done in parallel when
+   compiled with OpenMP, divided among threads as in sum_residuals, so that
+   each thread handles the cases whose values are in memory close to it. */
+
+static void compute_outputs (void)
+{
+  int b, N_blocks;
+
+  N_blocks = (N_train+Case_block-1) / Case_block;
+
+#ifdef _OPENMP
+# pragma omp parallel for schedule(static)
+#endif
+  for (b = 0; b<N_blocks; b++) 
+  { 
+    int i, end;
+
+    end = (b+1)*Case_block < N_train ? (b+1)*Case_block : N_train;
+
+    for (i = b*Case_block; i<end; i++)
+    { net_func (&train_values[i], 0, arch, flgs, &params);
+    }
+  }
+
+  values_known = 0;
+}
+
+
+/* FIND THE SUM OF SQUARED RESIDUALS OVER TRAINING CASES.  Returns the sum
+   over cases of inv_temp times the squared difference between output 'j'
+   and its target, multiplied by the case weight if there are weights.  If
+   'j' is -1, the sum is over all outputs too.  Network outputs must already
+   have been computed.  Blocks of Case_block cases are summed in parallel,
+   and the partial sums are then added in order of the blocks, over all
+   the processes holding shards of the training cases. */
+
+static double sum_residuals
+( int j,		/* Index of output, or -1 for all outputs */
+  double inv_temp	/* Inverse temperature */
+)
+{
+  double sum;
+  int b, N_blocks;
+
+  N_blocks = (N_train+Case_block-1) / Case_block;
+
+#ifdef _OPENMP
+# pragma omp parallel for schedule(static)
+#endif
+  for (b = 0; b<N_blocks; b++)
+  { 
+    double s, d;
+    int i, k, end;
+
+    end = (b+1)*Case_block < N_train ? (b+1)*Case_block : N_train;
+    s = 0;
+
+    for (i = b*Case_block; i<end; i++)
+    { for (k = (j<0 ? 0 : j); k <= (j<0 ? arch->N_outputs-1 : j); k++)
+      { d = train_values[i].o[k] - train_targets[i*arch->N_outputs+k];
+        
+        // Modified to make use of the training cases' weights
+        if (data_spec->has_weights)
+          s += inv_temp * d * d * train_weights[i];
+        else
+          s += inv_temp * d*d;
+      }
+    }
+
+    block_sums[b] = s;
+  }
+
+  mc_sum_over_ranks (&sum, block_sums, N_blocks, 1);
+
+  return sum;
+}
+
+
 /* DO RANDOM-GRID METROPOLIS UPDATES FOR UPPER NOISE SIGMAS. */
 
 static void rgrid_met_noise 
@@ -655,9 +865,7 @@ static void rgrid_met_noise
   prior_spec *pr;
   int i, j;
 
-  for (i = 0; i<N_train; i++) 
-  { net_func (&train_values[i], 0, arch, flgs, &params);
-  }
+  compute_outputs();
 
   pr = &model->noise;
 
@@ -1064,7 +1272,7 @@ void mc_app_energy
 )
 {
   double log_prob, inv_temp;
-  int i, low, high;
+  int i;
 
   inv_temp = !ds->temp_state ? 1 : ds->temp_state->inv_temp;
 
@@ -1131,12 +1339,193 @@ void mc_app_energy
       }
     }
 
+    else /* Likelihood from the training cases */
+    {
+      lik_energy_grad (N_approx, w_approx, energy!=0, gr!=0, inv_temp);
+
+      if (energy) *energy += lik_energy;
+
+      if (gr)
+      { for (i = 0; i<ds->dim; i++) gr[i] += lik_grad.param_block[i];
+      }
+    }
+
+    if (N_approx>1 && gr)
+    { for (i = 0; i<ds->dim; i++) gr[i] *= N_approx;
+    }
+
+    if (inv_temp!=1 && gr)
+    { for (i = 0; i<ds->dim; i++) gr[i] *= inv_temp;
+    }
+  }
+}
+
+
+/* FIND THE LIKELIHOOD PART OF THE ENERGY AND/OR ITS GRADIENT.  Sets
+   lik_energy to minus inv_temp times the log likelihood for all training
+   cases, and lik_grad to the gradient of minus the log likelihood for the
+   cases in approximation w_approx out of N_approx (cases are weighted if
+   there are weights).  Nothing is recomputed if the parameters and noise
+   sigmas are the same as when these were last found, as after updates of
+   the hyperparameters.  Otherwise, if the unit values for all cases are
+   known for the parameters at the last evaluation, only what depends on
+   the parameters that changed is recomputed - the hidden layers from the
+   first one affected, using the 'start' argument of net_func, or, with the
+   fused computations, the hidden units whose incoming weights changed.
+   For the latter, the hidden unit values of all cases are stored, in space
+   that is allocated only when some, but not most, of the parameters have
+   changed, so that it is not needed when all parameters change at each
+   evaluation, as with hybrid Monte Carlo.  The energy and gradient are
+   summed for each block of Case_block cases, and the sums for the blocks
+   are then added in order of the blocks.  When the training cases are
+   split over several processes, each holding whole blocks, the sums for
+   the blocks are added in the same order over the processes, which all
+   call this procedure with the same arguments and parameters, so the
+   results are exactly the same as with a single process. */
+
+static void lik_energy_grad
+( int N_approx,		/* Number of gradient approximations in use */
+  int w_approx,		/* Which approximation to use this time */
+  int want_energy,	/* Is the energy wanted? */
+  int want_grad,	/* Is the gradient wanted? */
+  double inv_temp	/* Inverse temperature */
+)
+{
+  double log_prob;
+  net_value *x;
+  int i, j, k, low, high, stride, first, n_changed, n_units;
+  int start = 0;
+  int b, N_blocks, g_first, g_end, begin, end, grad_b;
+  double block_energy;
+
+  /* Find which parameters and noise sigmas changed since last time. */
+
+  x = case_inputs (&stride);
+
+  if (!last_known || x!=last_inputs)
+  { lik_energy_known = lik_grad_known = values_known = 0;
+    if (hidden_cache!=0) 
+    { free(hidden_cache);
+      hidden_cache = 0;
+    }
+  }
+
+  first = params.total_params;
+  n_changed = 0;
+
+  for (k = params.total_params-1; k>=0; k--)
+  { if (params.param_block[k]!=last_params[k])
+    { first = k;
+      n_changed += 1;
+    }
+  }
+
+  if (model->type=='R')
+  { for (j = 0; j<arch->N_outputs; j++)
+    { if (sigmas.noise[j]!=last_noise[j]) n_changed += 1;
+    }
+  }
+
+  if (n_changed>0)
+  { lik_energy_known = lik_grad_known = 0;
+  }
+
+  if ((!want_energy || (lik_energy_known && lik_inv_temp==inv_temp))
+   && (!want_grad || (lik_grad_known && lik_approx[0]==N_approx
+                                     && lik_approx[1]==w_approx)))
+  { return;
+  }
+
+  /* The cases in approximation w_approx are chosen among all the cases, and
+     then those in the shard held here are found, so that they are the same
+     however the cases are split over processes. */
+
+  low  = (int) (((long) N_train_total * (w_approx-1)) / N_approx);
+  high = (int) (((long) N_train_total * w_approx) / N_approx);
+
+  low -= train_first;
+  high -= train_first;
+
+  if (low<0) low = 0;
+  if (low>N_train) low = N_train;
+  if (high<low) high = low;
+  if (high>N_train) high = N_train;
+
+  /* The energy and gradient are summed separately for each block of
+     Case_block cases, and the sums for the blocks are then added in order
+     of the blocks, here and over the processes, with mc_sum_over_ranks.
+     The additions are therefore the same for any number of processes.  The
+     sums for all blocks are kept only when there are several processes.
+     Only the blocks from g_first up to g_end contain cases for the
+     gradient. */
+
+  N_blocks = (N_train+Case_block-1) / Case_block;
+
+  g_first = low / Case_block;
+  g_end = low<high ? (high+Case_block-1) / Case_block : g_first;
+
+  if (fast_path) /* One hidden layer and a binary target */
+  {
+    n_units = fast_changed_units();
+
+    if (!want_grad && hidden_cache==0 && last_known && x==last_inputs
+     && n_changed>0 && n_units<=arch->N_hidden[0]/2)
+    { hidden_cache = net_case_alloc (N_train, 
+                                     arch->N_hidden[0] * sizeof *hidden_cache);
+    }
+  }
+  else
+  { start = 0;
+    if (values_known && !(model->type=='V' && surv->hazard_type=='P'))
+    { while (start<arch->N_layers && first>=layer_end(start)) start += 1;
+    }
+  }
+
+  if (want_energy) lik_energy = 0;
+
+  if (want_grad)
+  { for (k = 0; k<lik_grad.total_params; k++) lik_grad.param_block[k] = 0;
+  }
+
+  for (b = (want_energy ? 0 : g_first); b < (want_energy ? N_blocks : g_end);
+       b++)
+  {
+    begin = b*Case_block;
+    end = (b+1)*Case_block < N_train ? (b+1)*Case_block : N_train;
+
+    grad_b = want_grad && b>=g_first && b<g_end;
+
+    if (want_energy) block_energy = 0;
+
+    if (grad_b)
+    { for (k = 0; k<block_grad.total_params; k++) 
+      { block_grad.param_block[k] = 0;
+      }
+    }
+
+    if (fast_path && !want_grad && hidden_cache!=0)
+    { net_fast_update (x + (long) begin * stride, stride, train_targets+begin,
+                       data_spec->has_weights ? train_weights+begin : 0,
+                       end-begin, arch, &params, 
+                       hidden_cache + (long) begin * arch->N_hidden[0],
+                       values_known ? unit_changed : 0, &block_energy,
+                       inv_temp, fast_scratch);
+    }
+
+    else if (fast_path)
+    { net_fast_cases (x, stride, train_targets,
+                      data_spec->has_weights ? train_weights : 0,
+                      want_energy || begin>low ? begin : low, 
+                      want_energy || end<high ? end : high,
+                      low, high, arch, &params, grad_b ? &block_grad : 0,
+                      want_energy ? &block_energy : 0, inv_temp, fast_scratch);
+    }
+
     else /* Not approximated */
     {
-      low  = (N_train * (w_approx-1)) / N_approx;
-      high = (N_train * w_approx) / N_approx;
-      
-      for (i = (energy ? 0 : low); i < (energy ? N_train : high); i++)
+      for (i = (want_energy || begin>low ? begin : low); 
+           i < (want_energy || end<high ? end : high); 
+           i++)
       {
         if (model->type=='V'          /* Handle piecewise-constant hazard    */
          && surv->hazard_type=='P')   /*   model specially                   */
@@ -1144,13 +1533,13 @@ void mc_app_energy
           double ot, ft, t0, t1;
           int censored;
           int w;
-  
+
           if (inv_temp!=1)
           { fprintf(stderr,
               "Can't handle tempering with piecewise-constant hazard models\n");
             exit(1);
           }
-  
+
           if (train_targets[i]<0)
           { censored = 1;
             ot = -train_targets[i];
@@ -1159,37 +1548,37 @@ void mc_app_energy
           { censored = 0;
             ot = train_targets[i];
           }
-  
+
           t0 = 0;
           t1 = surv->time[0];
           train_values[i].i[0] = surv->log_time ? log(t1) : t1;
-  
+
           w = 0;
-  
+
           for (;;)
           {
             net_func (&train_values[i], 0, arch, flgs, &params);
-            
+          
             ft = ot>t1 ? -(t1-t0) : censored ? -(ot-t0) : (ot-t0);
-  
+
             net_model_prob(&train_values[i], &ft,
-                           &log_prob, gr ? &deriv[i] : 0, arch, model, surv, 
-                           &sigmas, Cheap_energy);
-  
-            if (energy) *energy -= inv_temp * log_prob;
-  
-            if (gr && i>=low && i<high)
+                           &log_prob, want_grad ? &deriv[i] : 0, arch, model,
+                           surv, &sigmas, Cheap_energy);
+
+            if (want_energy) block_energy -= inv_temp * log_prob;
+
+            if (want_grad && i>=low && i<high)
             { net_back (&train_values[i], &deriv[i], arch->has_ti ? -1 : 0,
                         arch, flgs, &params);
-              net_grad (&grad, &params, &train_values[i], &deriv[i], 
+              net_grad (&block_grad, &params, &train_values[i], &deriv[i], 
                         arch, flgs);
             }
-  
+
             if (ot<=t1) break;
-   
+ 
             t0 = t1;
             w += 1;
-            
+          
             if (surv->time[w]==0) 
             { t1 = ot;
               train_values[i].i[0] = surv->log_time ? log(t0) : t0;
@@ -1201,55 +1590,409 @@ void mc_app_energy
             }
           }
         }
-  
+
         else /* Everything except piecewise-constant hazard model */
         { 
-          net_func (&train_values[i], 0, arch, flgs, &params);
-          
+          net_func (&train_values[i], start, arch, flgs, &params);
+        
           // Here the log-probability for the current training case is calculated
           net_model_prob(&train_values[i], train_targets+data_spec->N_targets*i,
-                         &log_prob, gr ? &deriv[i] : 0, arch, model, surv,
-                         &sigmas, Cheap_energy);
-          
+                         &log_prob, want_grad ? &deriv[i] : 0, arch, model, 
+                         surv, &sigmas, Cheap_energy);
+        
           // Correct for the case weight (note that it's been checked to have sence
           // for binary models only!)
           if (data_spec->has_weights)
           {
-            if (energy)
-              *energy -= inv_temp * log_prob * train_weights[i];
-            
-            if (gr && i>=low && i<high)
+            if (want_energy)
+              block_energy -= inv_temp * log_prob * train_weights[i];
+          
+            if (want_grad && i>=low && i<high)
             {
               net_back(&train_values[i], &deriv[i], arch->has_ti ? -1 : 0, arch, flgs,
                        &params);
-              net_grad_w(&grad, &params, &train_values[i], &deriv[i], arch, flgs,
-                         train_weights[i]);
+              net_grad_w(&block_grad, &params, &train_values[i], &deriv[i], 
+                         arch, flgs, train_weights[i]);
             }
           }
           else
           {
-            if (energy)
-              *energy -= inv_temp * log_prob;
-            
-            if (gr && i>=low && i<high)
+            if (want_energy)
+              block_energy -= inv_temp * log_prob;
+          
+            if (want_grad && i>=low && i<high)
             {
               net_back(&train_values[i], &deriv[i], arch->has_ti ? -1 : 0, arch, flgs,
                        &params);
-              net_grad(&grad, &params, &train_values[i], &deriv[i], arch, flgs);
+              net_grad(&block_grad, &params, &train_values[i], &deriv[i], arch, 
+                       flgs);
             }
           }
         }
       }
     }
 
-    if (N_approx>1 && gr)
-    { for (i = 0; i<ds->dim; i++) gr[i] *= N_approx;
+    /* With a single process, the sums for the blocks are added as soon as
+       they are found, in the same order as mc_sum_over_ranks would. */
+
+    if (mc_ranks>1)
+    { if (want_energy) block_sums[b] = block_energy;
+      if (grad_b)
+      { for (k = 0; k<block_grad.total_params; k++)
+        { grad_block_sums[(long)(b-g_first)*block_grad.total_params+k]
+            = block_grad.param_block[k];
+        }
+      }
     }
+    else
+    { if (want_energy) lik_energy += block_energy;
+      if (grad_b)
+      { for (k = 0; k<lik_grad.total_params; k++)
+        { lik_grad.param_block[k] += block_grad.param_block[k];
+        }
+      }
+    }
+  }
 
-    if (inv_temp!=1 && gr)
-    { for (i = 0; i<ds->dim; i++) gr[i] *= inv_temp;
+  if (fast_path)
+  { values_known = !want_grad && hidden_cache!=0;
+  }
+  else
+  { values_known = want_energy
+                    && !(model->type=='V' && surv->hazard_type=='P');
+  }
+
+  /* Add up the sums for the blocks, over all processes. */
+
+  if (mc_ranks>1 && want_energy) 
+  { mc_sum_over_ranks (&lik_energy, block_sums, N_blocks, 1);
+  }
+
+  if (mc_ranks>1 && want_grad) 
+  { mc_sum_over_ranks (lik_grad.param_block, grad_block_sums, g_end-g_first,
+                       lik_grad.total_params);
+  }
+
+  /* Remember what the results are for. */
+
+  for (k = 0; k<params.total_params; k++)
+  { last_params[k] = params.param_block[k];
+  }
+
+  if (model->type=='R')
+  { for (j = 0; j<arch->N_outputs; j++) last_noise[j] = sigmas.noise[j];
+  }
+
+  last_inputs = x;
+  last_known = 1;
+
+  if (want_energy)
+  { lik_energy_known = 1;
+    lik_inv_temp = inv_temp;
+  }
+
+  if (want_grad)
+  { lik_grad_known = 1;
+    lik_approx[0] = N_approx;
+    lik_approx[1] = w_approx;
+  }
+}
+
+
+/* FIND WHICH HIDDEN UNITS HAVE CHANGED INCOMING WEIGHTS.  For the fused
+   computations, sets unit_changed to show which hidden units have input
+   weights or a bias different from those in last_params, and returns how
+   many such units there are. */
+
+static int fast_changed_units (void)
+{
+  net_param *lp;
+  int N_hidden, n, k, j;
+
+  N_hidden = arch->N_hidden[0];
+
+  for (j = 0; j<N_hidden; j++) unit_changed[j] = 0;
+
+  lp = last_params + (params.ih[0] - params.param_block);
+  for (k = 0; k<arch->N_inputs*N_hidden; k++)
+  { if (params.ih[0][k]!=lp[k]) unit_changed[k%N_hidden] = 1;
+  }
+
+  if (arch->has_bh[0])
+  { lp = last_params + (params.bh[0] - params.param_block);
+    for (j = 0; j<N_hidden; j++)
+    { if (params.bh[0][j]!=lp[j]) unit_changed[j] = 1;
     }
   }
+
+  n = 0;
+  for (j = 0; j<N_hidden; j++) n += unit_changed[j];
+
+  return n;
+}
+
+
+/* FIND WHERE THE PARAMETERS AFFECTING A HIDDEN LAYER END.  Returns the
+   offset in the parameter block just past the parameters that can change
+   the values of hidden layer l.  Parameters are laid out layer by layer
+   (see net_setup_param_pointers), so the values of layers 0 to l do not
+   change when only parameters at or after this offset change. */
+
+static int layer_end
+( int l			/* Index of hidden layer */
+)
+{
+  net_param *next;
+  int m;
+
+  next = arch->has_th[l] ? params.th[l] : 0;
+
+  for (m = l+1; next==0 && m<arch->N_layers; m++)
+  { next = arch->has_hh[m-1] ? params.hh[m-1]
+         : arch->has_ih[m]   ? params.ih[m]
+         : arch->has_bh[m]   ? params.bh[m]
+         : arch->has_th[m]   ? params.th[m] : 0;
+  }
+
+  for (m = arch->N_layers-1; next==0 && m>=0; m--)
+  { if (arch->has_ho[m]) next = params.ho[m];
+  }
+
+  if (next==0 && arch->has_io) next = params.io;
+  if (next==0 && arch->has_bo) next = params.bo;
+
+  return next==0 ? params.total_params : next - params.param_block;
+}
+
+
+/* ESTIMATE GRADIENT OF POTENTIAL ENERGY FROM A MINI-BATCH.  The gradient
+   of minus the log prior is added to the gradient of minus the log
+   likelihood for the next 'batch_size' training cases in a random
+   permutation, scaled up by N_train/batch_size.  A new permutation is
+   drawn when too few cases remain in the current one.  If 'gv' is not
+   null, the variance of the estimate for each component is stored there,
+   computed from the spread of the gradients for the cases in the batch.
+   Returns zero if this is not possible for the model being used. */
+
+int mc_app_batch_grad
+( mc_dynamic_state *ds,	/* Current dynamical state */
+  int batch_size,	/* Number of training cases in mini-batch */
+  mc_value *gr,		/* Place to store gradient */
+  mc_value *gv		/* Place to store variances of gradient, or null */
+)
+{
+  double log_prob, inv_temp, scale, wt, v;
+  net_value *x;
+  int i, j, k, stride;
+
+  if (quadratic_approx || (model!=0 && model->type=='V'))
+  { return 0;
+  }
+
+  if (mc_ranks>1)
+  { fprintf(stderr,"Can't use mini-batches with several processes\n");
+    exit(1);
+  }
+
+  inv_temp = !ds->temp_state ? 1 : ds->temp_state->inv_temp;
+
+  if (gr!=grad.param_block)
+  { grad.param_block = gr;
+    net_setup_param_pointers (&grad, arch, flgs);
+  }
+
+  if (inv_temp>=0)
+  { net_prior_prob (&params, &sigmas, 0, &grad, arch, flgs, priors, 2);
+  }
+  else
+  { for (j = 0; j<ds->dim; j++) 
+    { gr[j] = 0;
+    }
+    inv_temp = -inv_temp;
+  }
+
+  if (gv)
+  { for (j = 0; j<ds->dim; j++) 
+    { gv[j] = 0;
+    }
+  }
+
+  if (inv_temp==0 || data_spec==0 || N_train==0) 
+  { return 1;
+  }
+
+  if (batch_size>N_train) batch_size = N_train;
+
+  if (batch_order==0)
+  { batch_order = chk_alloc (N_train, sizeof *batch_order);
+    for (i = 0; i<N_train; i++) batch_order[i] = i;
+    batch_next = N_train;
+  }
+
+  if (batch_next+batch_size>N_train)
+  { for (i = N_train-1; i>0; i--)
+    { j = rand_int(i+1);
+      k = batch_order[i]; batch_order[i] = batch_order[j]; batch_order[j] = k;
+    }
+    batch_next = 0;
+  }
+
+  if (gv && case_grad.param_block==0)
+  { case_grad.total_params = params.total_params;
+    case_grad.param_block = chk_alloc (params.total_params, sizeof (net_param));
+    net_setup_param_pointers (&case_grad, arch, flgs);
+    batch_sum = chk_alloc (params.total_params, sizeof *batch_sum);
+  }
+
+  if (gv)
+  { for (j = 0; j<ds->dim; j++) 
+    { batch_sum[j] = 0;
+    }
+  }
+
+  scale = inv_temp * N_train / batch_size;
+
+  x = fast_path ? case_inputs (&stride) : 0;
+
+  /* When the variances are not needed, the cases in the mini-batch are
+     handled in chunks of Case_block, in parallel, each with its own
+     gradient, and the gradients for the chunks are added in order.  With
+     the fused computations, each chunk has its own scratch space. */
+
+  if (gv==0)
+  { 
+    int N_chunks, c;
+
+    N_chunks = (batch_size+Case_block-1) / Case_block;
+
+    if (N_chunks>N_chunk_grad)
+    { if (chunk_grad!=0) free(chunk_grad);
+      chunk_grad = chk_alloc (N_chunks*ds->dim, sizeof *chunk_grad);
+      N_chunk_grad = N_chunks;
+    }
+
+#ifdef _OPENMP
+#   pragma omp parallel for private(i,j,k,log_prob,wt) schedule(static)
+#endif
+    for (c = 0; c<N_chunks; c++)
+    { 
+      net_params cg;
+      net_values *sc;
+      double cw;
+      int end;
+
+      cg.total_params = params.total_params;
+      cg.param_block = chunk_grad + c*ds->dim;
+      net_setup_param_pointers (&cg, arch, flgs);
+
+      for (j = 0; j<ds->dim; j++) 
+      { cg.param_block[j] = 0;
+      }
+
+      end = (c+1)*Case_block < batch_size ? (c+1)*Case_block : batch_size;
+
+      sc = fast_path ? net_fast_scratch (arch) : 0;
+
+      for (k = c*Case_block; k<end; k++)
+      { 
+        i = batch_order[batch_next+k];
+
+        wt = data_spec->has_weights ? train_weights[i] : 1;
+
+        if (fast_path)
+        { cw = wt*scale;
+          net_fast_cases (x+(long)i*stride, stride, train_targets+i, &cw,
+                          0, 1, 0, 1, arch, &params, &cg, 0, 1, sc);
+          continue;
+        }
+
+        net_func (&train_values[i], 0, arch, flgs, &params);
+
+        net_model_prob(&train_values[i], train_targets+data_spec->N_targets*i,
+                       &log_prob, &deriv[i], arch, model, surv, &sigmas, 
+                       Cheap_energy);
+
+        net_back (&train_values[i], &deriv[i], arch->has_ti ? -1 : 0, 
+                  arch, flgs, &params);
+
+        net_grad_w (&cg, &params, &train_values[i], &deriv[i], arch, flgs,
+                    wt*scale);
+      }
+
+      if (sc!=0) net_fast_free_scratch(sc);
+    }
+
+    for (c = 0; c<N_chunks; c++)
+    { for (j = 0; j<ds->dim; j++)
+      { gr[j] += chunk_grad[c*ds->dim+j];
+      }
+    }
+
+    batch_next += batch_size;
+
+    if (!fast_path) values_known = 0;
+
+    return 1;
+  }
+
+  for (k = 0; k<batch_size; k++)
+  { 
+    i = batch_order[batch_next+k];
+
+    wt = data_spec->has_weights ? train_weights[i] : 1;
+
+    for (j = 0; j<ds->dim; j++) 
+    { case_grad.param_block[j] = 0;
+    }
+
+    if (fast_path)
+    { net_fast_cases (x+(long)i*stride, stride, train_targets+i, &wt,
+                      0, 1, 0, 1, arch, &params, &case_grad, 0, 1, 
+                      fast_scratch);
+    }
+    else
+    { 
+      net_func (&train_values[i], 0, arch, flgs, &params);
+
+      net_model_prob(&train_values[i], train_targets+data_spec->N_targets*i,
+                     &log_prob, &deriv[i], arch, model, surv, &sigmas, 
+                     Cheap_energy);
+
+      net_back (&train_values[i], &deriv[i], arch->has_ti ? -1 : 0, 
+                arch, flgs, &params);
+
+      net_grad_w (&case_grad, &params, &train_values[i], &deriv[i], 
+                  arch, flgs, wt);
+    }
+    for (j = 0; j<ds->dim; j++)
+    { batch_sum[j] += case_grad.param_block[j];
+      gv[j] += case_grad.param_block[j] * case_grad.param_block[j];
+    }
+  }
+
+  batch_next += batch_size;
+
+  if (!fast_path) values_known = 0;
+
+  /* Add the likelihood part to the gradient, and find the variance of the 
+     estimate from the sample variance of the case gradients, allowing for 
+     the cases being drawn without replacement. */
+
+  if (gv)
+  { 
+    v = batch_size>1 ? scale * scale * batch_size 
+                         * (1 - (double) batch_size / N_train) 
+                         / (batch_size-1) 
+                     : 0;
+
+    for (j = 0; j<ds->dim; j++)
+    { gr[j] += scale * batch_sum[j];
+      gv[j] = v * (gv[j] - batch_sum[j] * batch_sum[j] / batch_size);
+      if (gv[j]<0) gv[j] = 0;
+    }
+  }
+
+  return 1;
 }
 
 
@@ -1358,7 +2101,7 @@ void mc_app_stepsizes
 
   if (arch->has_ti)
   { for (i = 0; i<arch->N_inputs; i++)
-    { stepsizes.ti[i] += N_train * seconds.i[i];
+    { stepsizes.ti[i] += N_train_total * seconds.i[i];
     }
   }
 
@@ -1366,13 +2109,13 @@ void mc_app_stepsizes
   {
     if (arch->has_th[l])
     { for (i = 0; i<arch->N_hidden[l]; i++)
-      { stepsizes.th[l][i] += N_train * seconds.h[l][i];
+      { stepsizes.th[l][i] += N_train_total * seconds.h[l][i];
       }
     }
 
     if (arch->has_bh[l])
     { for (j = 0; j<arch->N_hidden[l]; j++)
-      { stepsizes.bh[l][j] += N_train * seconds.s[l][j];
+      { stepsizes.bh[l][j] += N_train_total * seconds.s[l][j];
       }
     }
 
@@ -1393,7 +2136,7 @@ void mc_app_stepsizes
     { for (i = 0; i<arch->N_hidden[l]; i++)
       { for (j = 0; j<arch->N_hidden[l+1]; j++)
         { stepsizes.hh [l] [i*arch->N_hidden[l+1] + j] 
-            += N_train * seconds.s[l+1][j];
+            += N_train_total * seconds.s[l+1][j];
         }
       }
     }
@@ -1401,7 +2144,8 @@ void mc_app_stepsizes
     if (arch->has_ho[l])
     { for (i = 0; i<arch->N_hidden[l]; i++)
       { for (j = 0; j<arch->N_outputs; j++)
-        { stepsizes.ho [l] [i*arch->N_outputs + j] += N_train * seconds.o[j];
+        { stepsizes.ho [l] [i*arch->N_outputs + j] 
+            += N_train_total * seconds.o[j];
         }
       }
     }
@@ -1421,7 +2165,7 @@ void mc_app_stepsizes
 
   if (arch->has_bo)
   { for (j = 0; j<arch->N_outputs; j++)
-    { stepsizes.bo[j] += N_train * seconds.o[j];
+    { stepsizes.bo[j] += N_train_total * seconds.o[j];
     }
   }
 
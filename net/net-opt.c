@@ -0,0 +1,221 @@
+/* NET-OPT.C - Program to find a starting point for sampling by optimization. */
+
+/* Copyright (c) 1995-2004 by Radford M. Neal
+ *
+ * Permission is granted for anyone to copy, use, modify, or distribute this
+ * program and accompanying programs and documents for any purpose, provided
+ * this copyright notice is retained and prominently displayed, along with
+ * a note saying that the original programs are available from Radford Neal's
+ * web page, and note is made of any changes made to the programs.  The
+ * programs and documents are distributed without any warranty, express or
+ * implied.  As the programs were written for research purposes only, they have
+ * not been tested to the degree that would be advisable in any important
+ * application.  All use of these programs is entirely at the user's own risk.
+ */
+
+/* The program is specific to this package.  It moves the network parameters
+ * towards the maximum of the posterior density with mini-batch Adam or
+ * momentum gradient descent, so that less of the Markov chain that follows
+ * is burn-in.  The mini-batch gradients are found by mc_app_batch_grad,
+ * which handles parts of a mini-batch in parallel when compiled with OpenMP.
+ * -- Andrey Popov
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "misc.h"
+#include "rand.h"
+#include "log.h"
+#include "mc.h"
+#include "data.h"
+#include "prior.h"
+#include "model.h"
+#include "net.h"
+#include "net-data.h"
+
+
+/* THE FOLLOWING IS NEEED BY THE PLOTTING ROUTINES. */
+
+enum { PLT, TBL, HIST } program_type;
+
+
+static void usage (void);
+
+
+/* MAIN PROGRAM. */
+
+main
+( int argc,
+  char **argv
+)
+{
+  mc_dynamic_state ds;
+
+  log_file logf;
+  log_gobbled logg;
+
+  enum { Adam, SGD } method;
+  double stepsize, beta1, beta2, momentum;
+  int epochs, batch_size, steps;
+
+  mc_value *gr, *m, *v;
+  double E0, E, b1t, b2t, mh, vh;
+  int index, s, j;
+
+  /* Look at program arguments. */
+
+  beta1 = 0.9;
+  beta2 = 0.999;
+  momentum = 0.9;
+
+  if (argc<7 || strcmp(argv[4],"/")!=0) usage();
+
+  if ((epochs = atoi(argv[2]))<=0) usage();
+  if ((batch_size = atoi(argv[3]))<=0) usage();
+
+  if (strcmp(argv[5],"adam")==0)
+  { method = Adam;
+    if (argc!=7 && argc!=9) usage();
+    if (argc==9)
+    { beta1 = atof(argv[7]);
+      beta2 = atof(argv[8]);
+      if (beta1<0 || beta1>=1 || beta2<0 || beta2>=1) usage();
+    }
+  }
+  else if (strcmp(argv[5],"sgd")==0)
+  { method = SGD;
+    if (argc!=7 && argc!=8) usage();
+    if (argc==8 && ((momentum = atof(argv[7]))<0 || momentum>=1)) usage();
+  }
+  else
+  { usage();
+  }
+
+  if ((stepsize = atof(argv[6]))<=0) usage();
+
+  logf.file_name = argv[1];
+
+  /* Open log file and read all records. */
+
+  log_file_open (&logf, 1);
+
+  log_gobble_init(&logg,0);
+  mc_record_sizes(&logg);
+
+  while (!logf.at_end)
+  { log_gobble(&logf,&logg);
+  }
+
+  index = log_gobble_last(&logf,&logg) - 1;
+
+  if (logg.data['W']==0 || logg.index['W']!=index)
+  { fprintf(stderr,"No network in log file to start from (use net-gen)\n");
+    exit(1);
+  }
+
+  /* Set up the network and training data. */
+
+  ds.aux_dim = 0;
+  ds.aux = 0;
+
+  mc_app_initialize(&logg,&ds);
+
+  if (logg.data['r']!=0)
+  { rand_use_state(logg.data['r']);
+  }
+
+  gr = chk_alloc (ds.dim, sizeof *gr);
+  m  = chk_alloc (ds.dim, sizeof *m);
+  v  = chk_alloc (ds.dim, sizeof *v);
+
+  for (j = 0; j<ds.dim; j++)
+  { m[j] = 0;
+    v[j] = 0;
+  }
+
+  if (data_spec==0 || N_train==0)
+  { fprintf(stderr,"No training data in log file\n");
+    exit(1);
+  }
+
+  if (!mc_app_batch_grad (&ds, 1, gr, 0))
+  { fprintf(stderr,"Mini-batch gradients are not available for this model\n");
+    exit(1);
+  }
+
+  mc_app_energy (&ds, 1, 1, &E0, 0);
+
+  if (batch_size>N_train) batch_size = N_train;
+
+  steps = epochs * ((N_train + batch_size - 1) / batch_size);
+
+  /* Do the updates.  The stepsize for momentum gradient descent is scaled
+     down by the number of training cases plus one, as in net-gd. */
+
+  b1t = 1;
+  b2t = 1;
+
+  for (s = 0; s<steps; s++)
+  {
+    mc_app_batch_grad (&ds, batch_size, gr, 0);
+
+    if (method==Adam)
+    { b1t *= beta1;
+      b2t *= beta2;
+      for (j = 0; j<ds.dim; j++)
+      { m[j] = beta1 * m[j] + (1-beta1) * gr[j];
+        v[j] = beta2 * v[j] + (1-beta2) * gr[j] * gr[j];
+        mh = m[j] / (1-b1t);
+        vh = v[j] / (1-b2t);
+        ds.q[j] -= stepsize * mh / (sqrt(vh) + 1e-8);
+      }
+    }
+    else
+    { for (j = 0; j<ds.dim; j++)
+      { m[j] = momentum * m[j] - stepsize / (N_train+1) * gr[j];
+        ds.q[j] += m[j];
+      }
+    }
+  }
+
+  /* Keep the result only if it is better than the starting point. */
+
+  mc_app_energy (&ds, 1, 1, &E, 0);
+
+  printf("Energy changed from %.6e to %.6e in %d updates (%d epochs)\n",
+          E0, E, steps, epochs);
+
+  if (!(E<E0))
+  { fprintf(stderr,
+      "Optimization did not decrease the energy; network is left unchanged\n");
+    exit(0);
+  }
+
+  /* Write the network, and the random number state, with the same index as
+     the starting network, so that sampling continues from it. */
+
+  mc_app_save (&ds, &logf, index);
+
+  logf.header.type = 'r';
+  logf.header.index = index;
+  logf.header.size = sizeof (rand_state);
+  log_file_append (&logf, rand_get_state());
+
+  log_file_close(&logf);
+
+  exit(0);
+}
+
+
+/* DISPLAY USAGE MESSAGE AND EXIT. */
+
+static void usage(void)
+{
+  fprintf (stderr,
+"Usage: net-opt log-file epochs batch-size / adam stepsize [ beta1 beta2 ]\n"
+"   or: net-opt log-file epochs batch-size / sgd stepsize [ momentum ]\n");
+  exit(1);
+}
@@ -0,0 +1,477 @@
+/* NET-PT.C - Program to sample with parallel tempering (replica exchange). */
+
+/* Copyright (c) 1995-2004 by Radford M. Neal
+ *
+ * Permission is granted for anyone to copy, use, modify, or distribute this
+ * program and accompanying programs and documents for any purpose, provided
+ * this copyright notice is retained and prominently displayed, along with
+ * a note saying that the original programs are available from Radford Neal's
+ * web page, and note is made of any changes made to the programs.  The
+ * programs and documents are distributed without any warranty, express or
+ * implied.  As the programs were written for research purposes only, they have
+ * not been tested to the degree that would be advisable in any important
+ * application.  All use of these programs is entirely at the user's own risk.
+ */
+
+/* The program is specific to this package.  A replica of the Markov chain
+ * is simulated at each inverse temperature of the tempering schedule.  The
+ * replicas are run as separate net-mc processes, so that they make use of
+ * several processors, since the network module keeps its state in static
+ * variables.  Between the runs, swaps of the states of replicas at
+ * neighbouring temperatures are proposed.  The replica at inverse
+ * temperature one stays in the original log file.
+ * -- Andrey Popov
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "misc.h"
+#include "rand.h"
+#include "log.h"
+#include "mc.h"
+#include "data.h"
+#include "prior.h"
+#include "model.h"
+#include "net.h"
+#include "net-data.h"
+
+
+/* THE FOLLOWING IS NEEED BY THE PLOTTING ROUTINES. */
+
+enum { PLT, TBL, HIST } program_type;
+
+
+static void usage (void);
+static void copy_file (char *, char *);
+static void append_record (char *, int, int, int, void *);
+static int read_state (char *, mc_value *, mc_value *, int, int);
+static double likelihood_energy (mc_dynamic_state *);
+
+
+/* MAIN PROGRAM. */
+
+main
+( int argc,
+  char **argv
+)
+{
+  mc_dynamic_state ds;
+  mc_temp_sched *sch;
+  mc_temp_state ts;
+  rand_state rs;
+
+  log_file logf;
+  log_gobbled logg;
+
+  char **files, *program, *p, **args, target_arg[20], threads_arg[20];
+  mc_value **q, **aux, *tmp;
+  double *U, d, e;
+  int *proposals, *accepts, *changed;
+  pid_t *pids;
+  int max, interval, N_temps, index, target, round, status, k;
+  int threads;
+  FILE *f;
+
+  /* Look at program arguments. */
+
+  if (argc!=4) usage();
+
+  if ((max = atoi(argv[2]))<=0) usage();
+  if ((interval = atoi(argv[3]))<=0) usage();
+
+  logf.file_name = argv[1];
+
+  /* Open log file and read all records. */
+
+  log_file_open (&logf, 0);
+
+  log_gobble_init(&logg,0);
+  mc_record_sizes(&logg);
+
+  while (!logf.at_end)
+  { log_gobble(&logf,&logg);
+  }
+
+  index = log_gobble_last(&logf,&logg) - 1;
+
+  log_file_close(&logf);
+
+  if (logg.data['W']==0 || logg.index['W']!=index)
+  { fprintf(stderr,"No network in log file to start from (use net-gen)\n");
+    exit(1);
+  }
+
+  if (index>=max)
+  { fprintf(stderr,"Iterations up to %d already exist in log file\n",max);
+    exit(1);
+  }
+
+  /* Find the inverse temperatures of the replicas from the schedule. */
+
+  sch = logg.data['m'];
+
+  if (sch==0)
+  { fprintf(stderr,
+      "No tempering schedule has been specified (use mc-temp-sched)\n");
+    exit(1);
+  }
+
+  for (N_temps = 1; sch->sched[N_temps-1].inv_temp!=1; N_temps++)
+  { if (N_temps==Max_temps) abort();
+    if (sch->sched[N_temps-1].inv_temp<0)
+    { fprintf(stderr,
+        "Inverse temperatures for parallel tempering must not be negative\n");
+      exit(1);
+    }
+  }
+
+  if (N_temps<2)
+  { fprintf(stderr,"Tempering schedule has only one temperature\n");
+    exit(1);
+  }
+
+  if (logg.data['b']!=0)
+  { fprintf(stderr,
+      "Log file has a tempering state; it must be at inverse temperature one\n");
+    exit(1);
+  }
+
+  /* Set up the network and training data. */
+
+  ds.aux_dim = 0;
+  ds.aux = 0;
+
+  mc_app_initialize(&logg,&ds);
+
+  if (logg.data['r']!=0)
+  { rand_use_state(logg.data['r']);
+  }
+
+  /* Set up the log files of the replicas.  A new one is a copy of the
+     original log file with a tempering state record added.  The last
+     log file is the original one, for inverse temperature one. */
+
+  files = chk_alloc (N_temps, sizeof *files);
+  q = chk_alloc (N_temps, sizeof *q);
+  aux = chk_alloc (N_temps, sizeof *aux);
+  U = chk_alloc (N_temps, sizeof *U);
+  changed = chk_alloc (N_temps, sizeof *changed);
+  pids = chk_alloc (N_temps, sizeof *pids);
+  proposals = chk_alloc (N_temps, sizeof *proposals);
+  accepts = chk_alloc (N_temps, sizeof *accepts);
+
+  for (k = 0; k<N_temps; k++)
+  {
+    q[k] = chk_alloc (ds.dim, sizeof (mc_value));
+    aux[k] = chk_alloc (ds.aux_dim, sizeof (mc_value));
+    proposals[k] = 0;
+    accepts[k] = 0;
+
+    if (k==N_temps-1)
+    { files[k] = argv[1];
+      continue;
+    }
+
+    files[k] = chk_alloc (strlen(argv[1])+20, 1);
+    sprintf (files[k], "%s.pt%d", argv[1], k);
+
+    f = fopen(files[k],"rb");
+
+    if (f==NULL)
+    { copy_file (argv[1], files[k]);
+      ts.inv_temp = sch->sched[k].inv_temp;
+      ts.temp_dir = 1;
+      append_record (files[k], 'b', index, sizeof ts, &ts);
+    }
+    else
+    { fclose(f);
+      if (read_state (files[k], q[k], aux[k], ds.dim, ds.aux_dim)!=index)
+      { fprintf(stderr,"Log file %s does not end at the same index as %s\n",
+                 files[k], argv[1]);
+        exit(1);
+      }
+    }
+  }
+
+  /* Find the path to net-mc, which is taken to be in the same directory
+     as this program. */
+
+  program = chk_alloc (strlen(argv[0])+strlen("net-mc")+1, 1);
+  strcpy (program, argv[0]);
+  p = strrchr (program, '/');
+  strcpy (p ? p+1 : program, "net-mc");
+
+  args = chk_alloc (4, sizeof *args);
+  args[0] = program;
+  args[2] = target_arg;
+  args[3] = 0;
+
+  /* Divide the threads among the replicas, which run at the same time, so
+     that the processors are not oversubscribed.  The threads available are
+     those given by OMP_NUM_THREADS, or else the number of processors. */
+
+  p = getenv("OMP_NUM_THREADS");
+  threads = p!=0 && atoi(p)>0 ? atoi(p) : (int) sysconf(_SC_NPROCESSORS_ONLN);
+  threads = threads/N_temps>1 ? threads/N_temps : 1;
+
+  sprintf (threads_arg, "%d", threads);
+  if (setenv ("OMP_NUM_THREADS", threads_arg, 1)!=0)
+  { fprintf(stderr,"Can't set the number of threads for the replicas\n");
+    exit(1);
+  }
+
+  /* Do rounds of simulation of all the replicas followed by proposals to
+     swap states of neighbouring replicas.  Even and odd pairs of replicas
+     are tried in alternate rounds. */
+
+  for (round = 0; index<max; round++)
+  {
+    target = index+interval<max ? index+interval : max;
+    sprintf (target_arg, "%d", target);
+
+    /* Give each replica a new random number seed, since the random number
+       generator is restarted from the seed in each run of net-mc. */
+
+    for (k = 0; k<N_temps; k++)
+    { rs = *rand_get_state();
+      rs.seed = rand_word();
+      append_record (files[k], 'r', index, sizeof rs, &rs);
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+
+    for (k = 0; k<N_temps; k++)
+    {
+      pids[k] = fork();
+
+      if (pids[k]<0)
+      { fprintf(stderr,"Can't start a process for a replica\n");
+        exit(1);
+      }
+
+      if (pids[k]==0)
+      { args[1] = files[k];
+        execvp (program, args);
+        fprintf(stderr,"Can't run %s\n",program);
+        _exit(1);
+      }
+    }
+
+    for (k = 0; k<N_temps; k++)
+    { if (waitpid(pids[k],&status,0)<0
+         || !WIFEXITED(status) || WEXITSTATUS(status)!=0)
+      { fprintf(stderr,"Simulation of replica with log file %s failed\n",
+                 files[k]);
+        exit(1);
+      }
+    }
+
+    /* Read the new states and find minus the log likelihood for each. */
+
+    for (k = 0; k<N_temps; k++)
+    {
+      if (read_state (files[k], q[k], aux[k], ds.dim, ds.aux_dim)!=target)
+      { fprintf(stderr,"Log file %s does not end at index %d\n",
+                 files[k], target);
+        exit(1);
+      }
+
+      memcpy (ds.q, q[k], ds.dim * sizeof (mc_value));
+      memcpy (ds.aux, aux[k], ds.aux_dim * sizeof (mc_value));
+
+      U[k] = likelihood_energy(&ds);
+      changed[k] = 0;
+    }
+
+    /* Propose swaps.  The acceptance probability follows from the
+       distributions at the two temperatures differing only in the power
+       to which the likelihood is raised. */
+
+    for (k = round%2; k+1<N_temps; k += 2)
+    {
+      d = (sch->sched[k].inv_temp - sch->sched[k+1].inv_temp)
+            * (U[k] - U[k+1]);
+
+      proposals[k] += 1;
+
+      if (d>=0 || rand_uniform()<exp(d))
+      { tmp = q[k]; q[k] = q[k+1]; q[k+1] = tmp;
+        tmp = aux[k]; aux[k] = aux[k+1]; aux[k+1] = tmp;
+        e = U[k]; U[k] = U[k+1]; U[k+1] = e;
+        changed[k] = changed[k+1] = 1;
+        accepts[k] += 1;
+      }
+    }
+
+    /* Write the swapped states with the same index as the last iteration,
+       so that the next run of net-mc continues from them. */
+
+    for (k = 0; k<N_temps; k++)
+    { if (changed[k])
+      { append_record (files[k], 'S', target, ds.aux_dim * sizeof (mc_value),
+                       aux[k]);
+        append_record (files[k], 'W', target, ds.dim * sizeof (mc_value),
+                       q[k]);
+      }
+    }
+
+    index = target;
+  }
+
+  /* Report how often swaps were accepted. */
+
+  printf("\n  Inverse temperatures  Swaps accepted\n\n");
+
+  for (k = 0; k+1<N_temps; k++)
+  { printf("  %8.5f  %8.5f  %8d of %d\n", sch->sched[k].inv_temp,
+      sch->sched[k+1].inv_temp, accepts[k], proposals[k]);
+  }
+
+  printf("\n");
+
+  exit(0);
+}
+
+
+/* FIND ENERGY FROM THE LIKELIHOOD.  Found as the difference between the
+   energies at inverse temperatures one and zero, for the state currently
+   in the dynamical state structure. */
+
+static double likelihood_energy
+( mc_dynamic_state *ds
+)
+{
+  mc_temp_state ts;
+  double e1, e0;
+
+  ds->temp_state = &ts;
+  ts.temp_dir = 1;
+
+  ts.inv_temp = 1;
+  mc_app_energy (ds, 1, 1, &e1, 0);
+
+  ts.inv_temp = 0;
+  mc_app_energy (ds, 1, 1, &e0, 0);
+
+  ds->temp_state = 0;
+
+  return e1 - e0;
+}
+
+
+/* READ THE LAST STATE IN A LOG FILE.  Copies the network parameters and
+   hyperparameters with the last index in the log file, and returns that
+   index. */
+
+static int read_state
+( char *file_name,	/* Name of log file */
+  mc_value *q,		/* Place to store network parameters */
+  mc_value *aux,	/* Place to store hyperparameters */
+  int dim,		/* Number of network parameters */
+  int aux_dim		/* Number of hyperparameters */
+)
+{
+  static log_gobbled logg;
+  log_file logf;
+  int index;
+
+  logf.file_name = file_name;
+
+  log_file_open (&logf, 0);
+
+  log_gobble_init(&logg,1);
+  logg.req_size['W'] = dim * sizeof (mc_value);
+  logg.req_size['S'] = aux_dim * sizeof (mc_value);
+
+  index = log_gobble_last(&logf,&logg) - 1;
+
+  log_file_close(&logf);
+
+  if (logg.data['W']==0 || logg.index['W']!=index
+   || logg.data['S']==0 || logg.index['S']!=index)
+  { fprintf(stderr,"No network at the end of log file %s\n",file_name);
+    exit(1);
+  }
+
+  memcpy (q, logg.data['W'], dim * sizeof (mc_value));
+  memcpy (aux, logg.data['S'], aux_dim * sizeof (mc_value));
+
+  return index;
+}
+
+
+/* APPEND A RECORD TO A LOG FILE. */
+
+static void append_record
+( char *file_name,	/* Name of log file */
+  int type,		/* Type of record */
+  int index,		/* Index of record */
+  int size,		/* Size of data */
+  void *data		/* Data to write */
+)
+{
+  log_file logf;
+
+  logf.file_name = file_name;
+
+  log_file_open (&logf, 1);
+
+  logf.header.type = type;
+  logf.header.index = index;
+  logf.header.size = size;
+  log_file_append (&logf, data);
+
+  log_file_close(&logf);
+}
+
+
+/* COPY A FILE. */
+
+static void copy_file
+( char *from,		/* Name of file to copy */
+  char *to		/* Name of new file */
+)
+{
+  char buf[4096];
+  FILE *in, *out;
+  int n;
+
+  in = fopen(from,"rb");
+  out = fopen(to,"wb");
+
+  if (in==NULL || out==NULL)
+  { fprintf(stderr,"Can't copy %s to %s\n",from,to);
+    exit(1);
+  }
+
+  while ((n = fread(buf,1,sizeof buf,in))>0)
+  { if (fwrite(buf,1,n,out)!=n)
+    { fprintf(stderr,"Error writing %s\n",to);
+      exit(1);
+    }
+  }
+
+  if (ferror(in) || fclose(out)!=0)
+  { fprintf(stderr,"Error copying %s to %s\n",from,to);
+    exit(1);
+  }
+
+  fclose(in);
+}
+
+
+/* DISPLAY USAGE MESSAGE AND EXIT. */
+
+static void usage(void)
+{
+  fprintf (stderr,
+    "Usage: net-pt log-file max-index iterations-between-swaps\n");
+  exit(1);
+}
@@ -181,9 +181,19 @@ typedef struct
    are also used for other data associated with units, such as derivatives 
    of the "error" for a case with respect to unit values.  The value of an
    input or hidden unit does not include the offset; instead this is added 
-   in whenever the value is used. */
+   in whenever the value is used.
 
+   Unit values are single precision if NET_VALUE_FLOAT is defined when
+   compiling (see make.include).  This halves the memory for the values
+   of training cases and the traffic over them.  Parameters, gradients,
+   and energies stay in double precision, since they are part of the
+   Markov chain state or are accumulated over many cases. */
+
+#ifdef NET_VALUE_FLOAT
+typedef float net_value;  /* Precision of unit values */
+#else
 typedef double net_value; /* Precision of unit values */
+#endif
 
 typedef struct
 { 
@@ -228,6 +238,16 @@ void net_grad (net_params *, net_params *, net_values *, net_values *,
 void net_grad_w (net_params *, net_params *, net_values *, net_values *, 
                  net_arch *, net_flags *, double);
 
+int net_fast_usable (net_arch *, net_flags *, model_specification *, int);
+void net_fast_cases (net_value *, int, double *, double *, int, int, int, int,
+                     net_arch *, net_params *, net_params *, double *, double,
+                     net_values *);
+void net_fast_update (net_value *, int, double *, double *, int, net_arch *,
+                      net_params *, net_value *, char *, double *, double,
+                      net_values *);
+net_values *net_fast_scratch (net_arch *);
+void net_fast_free_scratch (net_values *);
+
 void net_model_prob(net_values *, double *, double *, net_values *, net_arch *,
                     model_specification *, model_survival *, net_sigmas *, int);
 
@@ -152,6 +152,10 @@ void rand_use_state
   if (!initialized) initialize();
 
   state = st;
+  
+  // The ROOT generator does not keep its state in the structure, so restart it from the seed
+  //recorded there.  Otherwise every program would start from the same default seed. --A.
+  CTRandom_SetSeed((unsigned int) state->seed);
 }
 
 
@@ -402,3 +406,178 @@ double rand_beta
 
   return r;
 }
+
+
+/* FILL ARRAY WITH GAUSSIAN VALUES.  Uses a counter-based stream whose seed
+   and stream number are taken from the current generator, so the result
+   depends only on the state of that generator, and exactly two words are
+   taken from it however many values are generated.  The values are found
+   in parallel when compiled with OpenMP (see rand_stream_gaussian_fill). */
+
+void rand_gaussian_fill
+( double *x,		/* Array to fill */
+  int n			/* Number of values */
+)
+{
+  rand_stream st;
+  int seed;
+
+  seed = rand_word();
+  rand_stream_init (&st, seed, rand_word());
+
+  rand_stream_gaussian_fill (&st, x, n);
+}
+
+
+/* CONSTANTS FOR PHILOX4x32-10.  See Salmon, J. K., Moraes, M. A., Dror,
+   R. O., and Shaw, D. E. (2011) "Parallel random numbers: As easy as
+   1, 2, 3", Proceedings of SC11. */
+
+#define Philox_M0 0xD2511F53u
+#define Philox_M1 0xCD9E8D57u
+#define Philox_W0 0x9E3779B9u
+#define Philox_W1 0xBB67AE85u
+
+
+/* COMPUTE A BLOCK OF FOUR RANDOM WORDS.  The block is a function of the
+   key and of the counter only.  The counter is the position of the block
+   in the stream (two words) followed by two words of zeros. */
+
+static void philox
+( unsigned int *key,	/* Two words of key */
+  unsigned int lo,	/* Low word of block position */
+  unsigned int hi,	/* High word of block position */
+  unsigned int *out	/* Place to store the four words */
+)
+{
+  unsigned long long p0, p1;
+  unsigned int c0, c1, c2, c3, k0, k1;
+  int r;
+
+  c0 = lo; c1 = hi; c2 = 0; c3 = 0;
+  k0 = key[0]; k1 = key[1];
+
+  for (r = 0; r<10; r++)
+  { p0 = (unsigned long long) Philox_M0 * c0;
+    p1 = (unsigned long long) Philox_M1 * c2;
+    c0 = (unsigned int) (p1>>32) ^ c1 ^ k0;
+    c1 = (unsigned int) p1;
+    c2 = (unsigned int) (p0>>32) ^ c3 ^ k1;
+    c3 = (unsigned int) p0;
+    k0 += Philox_W0;
+    k1 += Philox_W1;
+  }
+
+  out[0] = c0; out[1] = c1; out[2] = c2; out[3] = c3;
+}
+
+
+/* CONVERT TWO WORDS TO A REAL NUMBER UNIFORM IN (0,1).  Uses 53 bits, and
+   never gives exactly zero or one. */
+
+static double words_to_uniopen
+( unsigned int a,
+  unsigned int b
+)
+{
+  return ((double)(a>>5) * 67108864.0 + (double)(b>>6) + 0.5) 
+           / 9007199254740992.0;
+}
+
+
+/* SET UP A STREAM.  The stream is positioned at its start. */
+
+void rand_stream_init
+( rand_stream *st,	/* Stream to set up */
+  int seed,		/* Seed */
+  int number		/* Number of stream for this seed */
+)
+{
+  st->key[0] = (unsigned int) seed;
+  st->key[1] = (unsigned int) number;
+  st->pos[0] = 0;
+  st->pos[1] = 0;
+}
+
+
+/* GO TO A POSITION IN A STREAM.  Positions are counted in blocks, each of
+   which gives two uniform or two Gaussian values. */
+
+void rand_stream_seek
+( rand_stream *st,	/* Stream */
+  double pos		/* Position to go to, a non-negative integer */
+)
+{
+  st->pos[1] = (unsigned int) (pos / 4294967296.0);
+  st->pos[0] = (unsigned int) (pos - 4294967296.0 * st->pos[1]);
+}
+
+
+/* ADVANCE POSITION IN A STREAM BY SOME NUMBER OF BLOCKS. */
+
+static void advance
+( rand_stream *st,
+  unsigned int n
+)
+{
+  st->pos[0] += n;
+  if (st->pos[0]<n) st->pos[1] += 1;
+}
+
+
+/* GENERATE UNIFORMLY FROM (0,1) USING A STREAM.  Each value uses a whole
+   block, so that the position of a value does not depend on what was
+   generated before. */
+
+double rand_stream_uniform
+( rand_stream *st
+)
+{
+  unsigned int w[4];
+
+  philox (st->key, st->pos[0], st->pos[1], w);
+  advance (st, 1);
+
+  return words_to_uniopen (w[0], w[1]);
+}
+
+
+/* FILL ARRAY WITH GAUSSIAN VALUES USING A STREAM.  Values are produced in
+   pairs by the Box-Muller method, using both variates, with pair k taken
+   from the block at the current position plus k.  The pairs are therefore
+   independent, and are found in parallel when compiled with OpenMP, with
+   the same results for any number of threads.  The stream is advanced
+   past all the blocks used. */
+
+void rand_stream_gaussian_fill
+( rand_stream *st,	/* Stream */
+  double *x,		/* Array to fill */
+  int n			/* Number of values */
+)
+{
+  int k, N_pairs;
+
+  N_pairs = (n+1)/2;
+
+#ifdef _OPENMP
+# pragma omp parallel for schedule(static) if (N_pairs>=4096)
+#endif
+  for (k = 0; k<N_pairs; k++)
+  { 
+    unsigned int w[4], lo, hi;
+    double r, a;
+
+    lo = st->pos[0] + (unsigned int) k;
+    hi = st->pos[1] + (lo<st->pos[0]);
+
+    philox (st->key, lo, hi, w);
+
+    r = sqrt (-2.0 * log (words_to_uniopen (w[0], w[1])));
+    a = 2.0 * M_PI * words_to_uniopen (w[2], w[3]);
+
+    x[2*k] = r * cos(a);
+    if (2*k+1<n) x[2*k+1] = r * sin(a);
+  }
+
+  advance (st, (unsigned int) N_pairs);
+}
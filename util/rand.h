@@ -49,3 +49,26 @@ double rand_exp (void);		/* Exponential with mean one */
 double rand_cauchy (void);	/* Cauchy centred at zero with unit width */
 double rand_gamma (double);	/* Gamma with given shape parameter */
 double rand_beta (double, double); /* Beta with given parameters */
+
+void rand_gaussian_fill (double *, int); /* Fill array with Gaussian values */
+
+
+/* COUNTER-BASED RANDOM NUMBER STREAMS.  Each stream is identified by a
+   seed and a stream number, and its output is a function of these and of
+   the position in the stream, so that streams for different threads or
+   chains are independent, any position can be reached directly, and the
+   results do not depend on how work is scheduled among threads.  The
+   Philox4x32-10 generator is used.  A stream structure holds no state
+   beyond the position, so it can be saved and restored by copying. */
+
+typedef struct
+{ unsigned int key[2];		/* Seed and stream number */
+  unsigned int pos[2];		/* Position in stream, low word first */
+} rand_stream;
+
+void rand_stream_init (rand_stream *, int, int); /* Set up by seed & number */
+void rand_stream_seek (rand_stream *, double);	 /* Go to given position */
+
+double rand_stream_uniform (rand_stream *);	/* Uniform from (0,1) */
+void rand_stream_gaussian_fill (rand_stream *, double *, int);
+						/* Fill array with Gaussians */